@@ -27,22 +27,31 @@
 
 /* inserire gli altri include che servono */
 
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
-#include <sys/mman.h>
 #include <sys/un.h>
 #include <fcntl.h>
 #include "connections.h"
 #include "ops.h"
-#include "queue.h"
+#include "scheduler.h"
+#include "reactor.h"
+#include "fileio.h"
+#include "handoff.h"
 #include "parser.h"
-#include "icl_hash.h"
+#include "usertab.h"
 #include "user.h"
 #include "util.h"
 #include "stats.h"
 
-#define NBUCKETS 1024 // Dimensione tabella hash 
+#define NBUCKETS 1024 // Posizioni iniziali della tabella degli utenti (ogni sezione raddoppia con gli utenti) 
+#define MAXEVENTS 64  // Numero massimo di eventi restituiti da una epoll_wait
+#define MAXBATCH 32   // Richieste gia' ricevute servite di fila su una connessione
+#define POPBATCH 4    // Connessioni estratte insieme da un worker quando la coda e' lunga
+#define POOL_PERIOD 100      // Periodo (ms) del controllore del pool di thread
+#define POOL_WAIT_US 1000    // Attesa media in coda oltre la quale si aggiunge un worker
+#define POOL_UTIL_HIGH 90    // Utilizzo (%) oltre il quale si aggiunge un worker
+#define POOL_UTIL_LOW 30     // Utilizzo (%) sotto il quale si toglie un worker
 
 /*********************************** Variabili globali ***********************************/ 
 
@@ -50,7 +59,7 @@
  * e' definita in stats.h.
  *
  */
-struct statistics chattyStats = { 0,0,0,0,0,0,0 };
+struct statistics chattyStats = { 0,0,0,0,0,0,0,0,0,0 };
 
 /* Struttura che memorizza le configurazioni del server, struct serverConfiguration
  * e' definita in parser.h.
@@ -61,10 +70,23 @@ struct serverConf configuration = { {'\0', '\0', '\0', 0, 0, 0, 0, 0} };
 // Bitmap segnali
 sigset_t sigset;
 
-// Coda
-Queue_t *q; 
+// Reactor tra cui vengono ripartite le connessioni, ognuno con la propria coda
+reactor_t **reactors = NULL;
+int nreactors = 0;
 
-pthread_t *threadPool, sigTread;
+pthread_t sigTread, poolTread;
+
+// Worker di ogni reactor, uno per slot del suo scheduler
+static pthread_t **workers = NULL;
+static int **wjoin = NULL;              // 1 se il thread dello slot va raccolto con join
+static int *wmin = NULL, *wmax = NULL;  // Limiti del numero di worker di ogni reactor
+
+// Pool di thread per le operazioni su disco, NULL se eseguite dai worker
+static fio_pool_t *iopool = NULL;
+
+// io_uring del worker per le consegne in batch (IoUring), NULL per deliverMsg.
+// Usato solo dagli handler che non girano in coroutine (vedi runHandler)
+static __thread uring_t *wring = NULL;
 
 // Strutture dati 
 users_db_t *users_db = NULL;
@@ -72,17 +94,21 @@ users_db_t *users_db = NULL;
 // Variabile per far terminare il server
 static volatile sig_atomic_t stop = 0;
 
-// Insime dei fd attivi
-fd_set set;
+// Socket di ascolto, condiviso da tutti i reactor
+static int fd_socket;
+
+// Socket verso il nuovo processo a cui passare lo stato alla chiusura (SIGUSR2), -1 se nessuno
+static int handoff_fd = -1;
 
-static pthread_mutex_t mtx_set = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t mtx_stats = PTHREAD_MUTEX_INITIALIZER;
 
 /********************************* Funzioni  *********************************/
 
 static void usage(const char *progname){
     fprintf(stderr, "Il server va lanciato con il seguente comando:\n");
-    fprintf(stderr, "  %s -f conffile\n", progname);
+    fprintf(stderr, "  %s -f conffile [-u]\n", progname);
+    fprintf(stderr, "  -u  riceve socket, connessioni e utenti dal server in esecuzione\n");
+    fprintf(stderr, "      quando questo riceve SIGUSR2 (HandoffPath nel file di configurazione)\n");
 }
 
 /**
@@ -108,9 +134,31 @@ void *sigHandler(void *arg) {
         if(sig == SIGINT || sig == SIGTERM || sig == SIGQUIT){
 	        fprintf(stdout, "\t[SigWaitThread] Ricevuto segnale di chiusura server!\n");
             stop = 1;
+            // I reactor non hanno timeout, li sveglio
+            for(int i = 0; reactors != NULL && i < nreactors; i++){
+                reactorWakeup(reactors[i]);
+            }
         }
         else if(sig == SIGUSR1){   //BUG stampa
             fprintf(stdout, "\t[SigWaitThread]Ricevuto segnale di stampa statistiche!\n");
+            // Le attese attive sono contate dagli scheduler dei reactor
+            unsigned long spins = 0, hits = 0;
+            for(int i = 0; reactors != NULL && i < nreactors; i++){
+                unsigned long sp, h;
+                if(reactors[i] == NULL) continue;
+                schedSpinStats(reactors[i]->sched, &sp, &h);
+                spins += sp;
+                hits  += h;
+            }
+            unsigned long nbuckets = 0, load = 0;
+            if(users_db != NULL) load = utLoad(users_db->db, &nbuckets);
+            MUTEX_BLOCK(mtx_stats, {
+                chattyStats.nspins = spins;
+                chattyStats.nspinhits = hits;
+                chattyStats.nbuckets = nbuckets;
+                chattyStats.loadfactor = load;
+            });
+            if(spins > 0) fprintf(stdout, "\t[SigWaitThread] Attese attive: %lu, %lu%% con lavoro trovato\n", spins, hits * 100 / spins);
             FILE * statsFile = fopen(configuration.StatFileName, "a");
             if(statsFile == NULL){
                 perror("fopen");
@@ -121,6 +169,22 @@ void *sigHandler(void *arg) {
             fprintf(stdout, "\t[SigWaitThread]Scrittura file statistiche completata\n");
             fclose(statsFile);
         }
+        else if(sig == SIGUSR2){
+            // Un nuovo processo avviato con -u attende lo stato su HandoffPath
+            if(configuration.HandoffPath[0] == '\0'){
+                fprintf(stderr, "\t[SigWaitThread] HandoffPath non impostato, SIGUSR2 ignorato\n");
+                continue;
+            }
+            if((handoff_fd = handoffConnect(configuration.HandoffPath)) == -1){
+                perror("handoffConnect");
+                continue;
+            }
+            fprintf(stdout, "\t[SigWaitThread] Passaggio dello stato al nuovo processo\n");
+            stop = 1;
+            for(int i = 0; reactors != NULL && i < nreactors; i++){
+                reactorWakeup(reactors[i]);
+            }
+        }
     }
     return NULL;
 }
@@ -157,6 +221,24 @@ char * setDir(char *filePath){
 }
 
 
+/**
+ * @function close_client
+ * @brief Disconnette l'utente associato all'fd (se connesso) e chiude la connessione
+ *
+ * @param fd     descrittore della connessione
+ */
+static void close_client(int fd){
+    char name[MAX_NAME_LENGTH + 1];
+    unsigned long rx = 0, tx = 0;
+    connStats(fd, &rx, &tx);
+    // Solo se sulla connessione si e' connesso un utente lo cerco tra quelli online
+    if(connUser(fd, name) && disconnect_user_fd(users_db, fd) == 0){
+        MUTEX_BLOCK(mtx_stats, {chattyStats.nonline--;});
+    }
+    fprintf(stdout, "Connessione %d chiusa (%s): %lu byte ricevuti, %lu byte inviati\n", fd, name, rx, tx);
+    closeConn(fd);   // La chiusura rimuove l'fd dall'epoll
+}
+
 /**
  * @function register_op
  * @brief Gestisce la richiesta di registrazione di un nickname
@@ -187,20 +269,20 @@ int register_op(message_t msg_receved, int client_fd){
 
         else{ // Utente connesso
             MUTEX_BLOCK(mtx_stats, {chattyStats.nonline++;});
+            connSetUser(client_fd, sender);
             fprintf(stdout, "\t\t%s connesso\n", sender);
                 
-            char *users_online; 
-            
             // Recupero e invio la lista degli utenti online
-            int len = get_users_online(users_db, &users_online);  
+            online_list_t *users_online = acquire_users_online(users_db);
+            if(users_online == NULL) return -1;
             setHeader(&(ack.hdr), OP_OK, "");
-            setData(&(ack.data), "server", users_online, len * (MAX_NAME_LENGTH + 1)); 
+            setData(&(ack.data), "server", users_online->names, users_online->n * (MAX_NAME_LENGTH + 1)); 
             if(sendRequest(client_fd,&ack) <= 0){
                 fprintf(stderr, "\t\tErrore invio lista utenti online\n");
-                free(users_online);
+                release_users_online(users_db, users_online);
                 return -1;
             }
-            free(users_online);
+            release_users_online(users_db, users_online);
             fprintf(stdout, "\t\tUtenti online inviati correttamente\n");
         }
     }else if(r == -1) { // Nome utente già registrato
@@ -238,19 +320,19 @@ int connect_op(message_t msg_receved, int client_fd){
     int ret = connect_user(users_db, sender, client_fd);
     if (ret == 0){   // Sender connesso
         MUTEX_BLOCK(mtx_stats, {chattyStats.nonline++;});
+        connSetUser(client_fd, sender);
         fprintf(stdout, "\t\t%s Connesso\n", sender);
-        char *users_online;
-
         // Recupero e invio la lista degli utenti online
-        int len = get_users_online(users_db, &users_online);
+        online_list_t *users_online = acquire_users_online(users_db);
+        if(users_online == NULL) return -1;
         setHeader(&(ack.hdr), OP_OK, "");
-        setData(&(ack.data), "server", users_online, len * (MAX_NAME_LENGTH + 1)); 
+        setData(&(ack.data), "server", users_online->names, users_online->n * (MAX_NAME_LENGTH + 1)); 
         if(sendRequest(client_fd,&ack) <= 0){
             fprintf(stderr, "\t\tErrore invio utenti online\n");
-            free(users_online);
+            release_users_online(users_db, users_online);
             return -1;
         }
-        free(users_online);
+        release_users_online(users_db, users_online);
         fprintf(stdout, "\t\tUtenti online inviati correttamente\n");
     }
     else if(ret == -2){  // Sender non registrato
@@ -293,34 +375,33 @@ int posttxt_op(message_t msg_receved, int client_fd){
     }
 
     // Ottengo la struttura dati del receiver
-    user_t *user = get_user(users_db, receiver);
-    if(user == NULL){
+    user_t user;
+    if(get_user(users_db, receiver, &user) == -1){
         MUTEX_BLOCK(mtx_stats, {chattyStats.nerrors++;});
-        fprintf(stderr, "\t\tOP_FAIL (Recupero utente dalla tabella hash)\n");
+        fprintf(stderr, "\t\tOP_FAIL (Recupero utente dalla tabella)\n");
         setSendAck(ack.hdr, OP_FAIL, client_fd);
         return -1;
     }
-    int fd_rcv = user->fd;
+    int fd_rcv = user.fd;
     msg_receved.hdr.op = TXT_MESSAGE;
     
     // Copio il messaggio ricevuto dal client
     message_t *tosend = copyMessage(&msg_receved);   
-    if(user->fd > 0){ //Receiver connesso e registrato
+    if(user.fd > 0){ //Receiver connesso e registrato
         fprintf(stdout, "\t\t%s è online, gli invio il messaggio\n", receiver);
 
-        // Invio del messaggio 
-        if(sendRequest(fd_rcv, tosend) <= 0){                   
-            MUTEX_BLOCK(mtx_stats, {chattyStats.nerrors++;});
-            setSendAck(ack.hdr, OP_FAIL, client_fd);
-            freeMessage(tosend);
-            return -1;
+        // Consegna del messaggio, non blocca se il receiver non sta leggendo
+        if(deliverMsg(fd_rcv, tosend) <= 0){                   
+            // Coda di uscita piena o receiver disconnesso: resta nella history
+            fprintf(stderr, "\t\tConsegna a %s fallita, messaggio nella history\n", receiver);
+        }else{
+            MUTEX_BLOCK(mtx_stats, {chattyStats.nnotdelivered--;});
+            MUTEX_BLOCK(mtx_stats, {chattyStats.ndelivered++;});
         }
-        MUTEX_BLOCK(mtx_stats, {chattyStats.nnotdelivered--;});
-        MUTEX_BLOCK(mtx_stats, {chattyStats.ndelivered++;});
     }
     
     // Inserisco il messaggio nella history dell'utente
-    if(insertMsg(user->history, tosend) < 0){                
+    if(insertMsg(user.history, tosend) < 0){                
         MUTEX_BLOCK(mtx_stats, {chattyStats.nerrors++;});
         fprintf(stderr, "\t\tOP_FAIL (Inserimento messaggio nella history)\n");
         setSendAck(ack.hdr, OP_FAIL, client_fd);
@@ -334,6 +415,34 @@ int posttxt_op(message_t msg_receved, int client_fd){
     return 0;
 }
 
+/**
+ * @function deliver_all
+ * @brief Consegna msg alle connessioni fds con deliverBatch: con l'io_uring
+ *        del worker gli invii partono con una sola system call
+ *
+ * @param fds       connessioni destinatarie (al piu' TX_GATHER)
+ * @param n         numero di connessioni
+ * @param msg       messaggio da consegnare
+ *
+ * @return 0, le connessioni rimaste da consegnare
+ */
+static int deliver_all(long *fds, int n, message_t *msg){
+    int res[TX_GATHER], ok = 0;
+    if(deliverBatch(wring, fds, n, msg, res) == -1){
+        fprintf(stderr, "\t\tio_uring del worker disabilitato\n");
+        uringDestroy(wring);
+        wring = NULL;
+    }
+    for(int i = 0; i < n; i++){
+        if(res[i] > 0) ok++;
+        else fprintf(stderr,"\t\tInvio messaggio a [fd:%ld] fallito\n", fds[i]);
+    }
+    if(ok > 0){
+        MUTEX_BLOCK(mtx_stats, {chattyStats.nnotdelivered -= ok; chattyStats.ndelivered += ok;});
+    }
+    return 0;
+}
+
 /**
  * @function posttxtall_op
  * @brief Gestisce l'invio di un messaggio testuale a tutti gli utenti registrati  
@@ -359,31 +468,28 @@ int posttxtall_op(message_t msg_receved, int client_fd){
     }
 
     user_t *user; 
-    // Scorro in mutua esclusione la tabella hash
-    icl_hash_foreach_mutex(users_db->db, user, {
-        msg_receved.hdr.op = TXT_MESSAGE;
-        message_t *tosend = copyMessage(&msg_receved);                     
-
+    long fds[TX_GATHER];
+    int nfds = 0;
+    msg_receved.hdr.op = TXT_MESSAGE;
+    // Scorro in mutua esclusione la tabella degli utenti: gli utenti online
+    // di una sezione ricevono il messaggio insieme, prima di rilasciarla
+    usertab_foreach_mutex_end(users_db->db, user, {
         // Controllo per non inviare il messaggio a chi ha fatto richiesta 
         if(strncmp(user->name, sender, MAX_NAME_LENGTH+1)) {
             // Controllo se l'utente è online
             if(user->fd != -1){
-                if(sendRequest(user->fd, tosend) <= 0) {
-                    fprintf(stderr,"\t\tInvio messaggio a %s fallito\n", user->name);
-                } else {
-                    MUTEX_BLOCK(mtx_stats, {chattyStats.nnotdelivered--;});
-                    MUTEX_BLOCK(mtx_stats, {chattyStats.ndelivered++;});
-                }
+                fds[nfds++] = user->fd;
+                if(nfds == TX_GATHER) nfds = deliver_all(fds, nfds, &msg_receved);
             }
 
             //Inserisco il messaggio nella history
-            if(insertMsg(user->history, tosend) < 0){
+            if(insertMsg(user->history, copyMessage(&msg_receved)) < 0){
                 fprintf(stderr, "\t\tInserimento messaggio nella history fallito\n");
             }
             MUTEX_BLOCK(mtx_stats, {chattyStats.nnotdelivered++;});
-        }else{
-            freeMessage(tosend);
         }
+    }, {
+        if(nfds > 0) nfds = deliver_all(fds, nfds, &msg_receved);
     })
 
     if(setSendAck(ack.hdr, OP_OK, client_fd) == -1) return -1;
@@ -402,81 +508,81 @@ int posttxtall_op(message_t msg_receved, int client_fd){
 int postfile_op(message_t msg_receved, int client_fd){
     char *sender = msg_receved.hdr.sender;
     char *receiver = msg_receved.data.hdr.receiver;
-    char *dir;
     message_t ack; 
-    message_data_t file;
+    message_data_hdr_t file;
     memset(&ack, 0, sizeof(message_t));
 
     fprintf(stdout, "\t\tPOSTFILE_OP: %s\n", sender);
-    if(readData(client_fd, &file) <= 0){                            
-        printf("\t\tErrore readData\n");
+    // La richiesta arriva due volte: con il solo header del file e, dopo
+    // recvFile, a contenuto scritto su disco
+    int st = takeFile(client_fd, &file);
+    if(st <= 0){                            
+        printf("\t\tErrore takeFile\n");
         return -1;
     }
 
-    // Controllo grandezza file
-    if( (file.hdr.len)/1024 > configuration.MaxFileSize){
+    // Controllo grandezza file prima di riceverne il contenuto
+    if( (file.len)/1024 > configuration.MaxFileSize){
         MUTEX_BLOCK(mtx_stats, {chattyStats.nerrors++;});
         fprintf(stderr,"\t\tOP_MSG_TOOLONG\n");
         setSendAck(ack.hdr, OP_MSG_TOOLONG, client_fd);
-        free(file.buf);
-        return -1;
-    }
-    
-    // Ricostruisco l'intero path del file  Esempio: /tmp/chatty/file.*   
-    dir = setDir(msg_receved.data.buf);          
-    //Apro il file in sola scrittura, se non esiste lo creo 
-    FILE *fd_f;
-    fd_f = fopen(dir, "w");
-    if (fd_f == NULL){
-        fprintf(stderr, "\t\tErrore apertura file\n");
-        free(file.buf);
-        free(dir);
+        // Il contenuto non viene letto: chiudo il lato di lettura e la
+        // connessione (closeConn invia prima l'ack), il client che sta
+        // ancora scrivendo riceve EPIPE invece di farsi leggere fino a 4 GB
+        shutdown(client_fd, SHUT_RD);
         return -1;
     }
-    free(dir);
 
-    int len_file = file.hdr.len;
-    
-    // Scrivo il file controllando che abbia scritto tuto 
-    if(fwrite(file.buf, sizeof(char), len_file, fd_f) != len_file){
-                perror("fwrite");
-                fclose(fd_f);
-                free(file.buf);
-                return -1;
+    if(st == 1){
+        // Ricostruisco l'intero path del file  Esempio: /tmp/chatty/file.*   
+        char *path = setDir(msg_receved.data.buf);
+        off_t size;
+        //Apro il file in sola scrittura, se non esiste lo creo. Con il pool di
+        //I/O la coroutine della richiesta si sospende fino all'apertura
+        int file_fd = fioOpen(iopool, client_fd, path, O_WRONLY | O_CREAT | O_TRUNC, &size);
+        free(path);
+        if (file_fd == -1){
+            fprintf(stderr, "\t\tErrore apertura file\n");
+            return -1;
+        }
+
+        // Il contenuto viene scritto nel file a blocchi man mano che arriva,
+        // senza mai tenerlo tutto in memoria
+        if(recvFile(client_fd, &msg_receved, file_fd) != 1){
+            fprintf(stderr, "\t\tErrore ricezione file\n");
+            return -1;
+        }
+        return 0;
     }
     // Scrittura del file completata
 
-    free(file.buf);
-    fclose(fd_f);
-
     // Ottengo la struttura del receiver
-    user_t *user = get_user(users_db, receiver);
-    if(user == NULL){
+    user_t user;
+    if(get_user(users_db, receiver, &user) == -1){
         MUTEX_BLOCK(mtx_stats, {chattyStats.nerrors++;});
-        printf("\t\tOP_FAIL (Recupero utente dalla tabella hash)\n");
+        printf("\t\tOP_FAIL (Recupero utente dalla tabella)\n");
         setSendAck(ack.hdr, OP_FAIL, client_fd);
         return -1;
     }
-    int fd_rcv = user->fd;
+    int fd_rcv = user.fd;
 
     msg_receved.hdr.op = FILE_MESSAGE;
     // Copio il messaggio ricevuto del client    
     message_t *tosend = copyMessage(&msg_receved);
 
     if(fd_rcv > 0){ //Receiver connesso e registrato
-        // Invio messaggio al ricevente per avvertirlo che c'è un file a lui destinato
-        if(sendRequest(fd_rcv, tosend) <= 0){
-            MUTEX_BLOCK(mtx_stats, {chattyStats.nerrors++;});
-            setSendAck(ack.hdr, OP_FAIL, client_fd);
-            freeMessage(tosend);
-            return -1;
+        // Avverto il ricevente che c'è un file a lui destinato, senza bloccarmi
+        if(deliverMsg(fd_rcv, tosend) <= 0){
+            // Coda di uscita piena o receiver disconnesso: resta nella history
+            fprintf(stderr, "\t\tNotifica a %s fallita, messaggio nella history\n", receiver);
+        }else{
+            MUTEX_BLOCK(mtx_stats, {chattyStats.nfilenotdelivered--;});
+            MUTEX_BLOCK(mtx_stats, {chattyStats.nfiledelivered++;});
         }
-        MUTEX_BLOCK(mtx_stats, {chattyStats.nfilenotdelivered--;});
-        MUTEX_BLOCK(mtx_stats, {chattyStats.nfiledelivered++;});
     }
 
     // Inserisco il messaggio nella history
-    if (insertMsg(user->history, tosend) < 0){
+    if (insertMsg(user.history, tosend) < 0){
         MUTEX_BLOCK(mtx_stats, {chattyStats.nerrors++;});
         printf("\t\tOP_FAIL (Inserimento file nella history)\n");
         setSendAck(ack.hdr, OP_FAIL, client_fd);
@@ -492,7 +598,7 @@ int postfile_op(message_t msg_receved, int client_fd){
 
 /**
  * @function getfile_op
- * @brief Gestisce la richiesta di recupero di un file inviato da un altro nickname  
+ * @brief Gestisce la richiesta di recupero di un file inviato da un altro nickname  
  *
  * @param msg_receved       messaggio ricevuto dal client
  * @param client_fd         descrittore della connessione
@@ -506,56 +612,37 @@ int getfile_op(message_t msg_receved, int client_fd){
 
     fprintf(stdout, "\t\tGETFILE_OP: %s\n", sender);
     // Ricostruisco l'intero path del file  Esempio: /tmp/chatty/file.*       
-    char *dir = setDir(msg_receved.data.buf);
-        
-    // Apro il file in sola lettura
-    int fd = open(dir, O_RDONLY);
-    if (fd < 0){
+    char *path = setDir(msg_receved.data.buf);
+    off_t size;
+    // Apro il file in sola lettura. Con il pool di I/O la coroutine della
+    // richiesta si sospende fino all'apertura
+    int file_fd = fioOpen(iopool, client_fd, path, O_RDONLY, &size);
+    free(path);
+    if (file_fd < 0){
         MUTEX_BLOCK(mtx_stats, {chattyStats.nerrors++;});
         fprintf(stderr, "\t\tOP_NO_SUCH_FILE\n");
         setSendAck(ack.hdr, OP_NO_SUCH_FILE, client_fd);
-        free(dir);
         return -1;
     }
-
-    // Ricavo informazioni sul file
-    struct stat st;
-    if(stat(dir, &st) == -1){
-        MUTEX_BLOCK(mtx_stats, {chattyStats.nerrors++;});
-        fprintf(stderr, "\t\tOP_NO_SUCH_FILE\n");    
-        setSendAck(ack.hdr, OP_NO_SUCH_FILE, client_fd);
-        free(dir);
-        return -1;
-    }
-    free(dir);
     
-    // Controllo dimensione del file
-    if(st.st_size > configuration.MaxFileSize){
+    // Controllo dimensione del file (MaxFileSize e' in kilobytes)
+    if(size/1024 > configuration.MaxFileSize){
         MUTEX_BLOCK(mtx_stats, {chattyStats.nerrors++;});
         fprintf(stderr,"\t\tOP_MSG_TOOLONG\n");
         setSendAck(ack.hdr, OP_MSG_TOOLONG, client_fd);
+        close(file_fd);
         return -1;
     }
 
-    // Mappiamo il file da spedire in memoria
-    char *mappedfile = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (mappedfile == MAP_FAILED) {
-		perror("mmap");
-		fprintf(stderr, "\t\tERRORE: mappando il file in memoria\n");
-		close(fd);
-		return -1;
-	}
-    close(fd);
-
+    // Il contenuto del file va dal descrittore al socket con sendfile,
+    // senza essere mappato o copiato nella memoria del server
     message_t tosend;
     setHeader(&(tosend.hdr), OP_OK, "");
-    setData(&(tosend.data), "server", mappedfile, st.st_size);   
-    if(sendRequest(client_fd, &tosend) <= 0){
+    setData(&(tosend.data), "server", NULL, size);   
+    if(sendFile(client_fd, &tosend, file_fd) <= 0){
         fprintf(stderr,"\t\tErrore invio file\n"); 
-        munmap(mappedfile, st.st_size);
         return -1;
     }
-    munmap(mappedfile, st.st_size);
     return 0;
 }
 
@@ -593,32 +680,23 @@ int getprevmsgs_op(message_t msg_receved, int client_fd){
 
             // Sono presenti messaggi nella history
             if(n_msg > 0){
-                int error = 0;
+                int ntxt = 0;
                 printf("\t\tInvio messaggi in corso...\n");
-                // Itero sull'array che contiene i messaggi 
+                // Aggiorno le statistiche in base ai messaggi letti
                 for(int i = 0; i < n_msg; i++){
-                    message_t *msg = msgs[i];
-                    
-                    // Aggiorno le statistiche in base al messaggio letto 
-                    if(msg->hdr.op == TXT_MESSAGE){
-                        MUTEX_BLOCK(mtx_stats,{ chattyStats.nnotdelivered--;
-                                    chattyStats.ndelivered++; }
-                                    );
-                    }
-                    else{
-                        MUTEX_BLOCK(mtx_stats,{ chattyStats.nfilenotdelivered--;
-                                    chattyStats.nfiledelivered++; }
-                                    );
-                        }
-                    int ret = sendRequest(client_fd, msg); // Invio messaggio
-                    freeMessage(msg);
-                    if(ret <= 0){
-                        error++; 
-                    } 
+                    if(msgs[i]->hdr.op == TXT_MESSAGE) ntxt++;
                 }
-                
+                MUTEX_BLOCK(mtx_stats,{ chattyStats.nnotdelivered -= ntxt;
+                            chattyStats.ndelivered += ntxt;
+                            chattyStats.nfilenotdelivered -= n_msg - ntxt;
+                            chattyStats.nfiledelivered += n_msg - ntxt; }
+                            );
+
+                // Una writev ogni TX_GATHER messaggi invece di una per messaggio
+                int ret = sendMsgs(client_fd, msgs, n_msg);
+                for(int i = 0; i < n_msg; i++) freeMessage(msgs[i]);
                 free(msgs);
-                if(error > 0){
+                if(ret <= 0){
                     fprintf(stderr, "\t\tErrore invio messaggi\n");
                     return -1;
                 } 
@@ -646,23 +724,22 @@ int getprevmsgs_op(message_t msg_receved, int client_fd){
  */
 int usrlist_op(message_t msg_receved, int client_fd){
     char *sender = msg_receved.hdr.sender;
-    char *users_online;
     message_t ack; 
     memset(&ack, 0, sizeof(message_t));
 
     fprintf(stdout, "\t\tUSRLIST_OP: %s\n", sender);
 
-    // Recupero la lista degli utenti online
-    int n = get_users_online(users_db, &users_online);
-    if(n > 0){
+    // Recupero la lista degli utenti online, condivisa con gli altri lettori
+    online_list_t *users_online = acquire_users_online(users_db);
+    if(users_online != NULL && users_online->n > 0){
         setHeader(&(ack.hdr), OP_OK, "");
-        setData(&(ack.data), "server", users_online, n * (MAX_NAME_LENGTH + 1)); 
+        setData(&(ack.data), "server", users_online->names, users_online->n * (MAX_NAME_LENGTH + 1)); 
         if (sendRequest(client_fd, &(ack)) <= 0){
             printf("\t\tErrore invio utenti online\n");
-            free(users_online);
+            release_users_online(users_db, users_online);
             return -1;
         }
-        free(users_online);
+        release_users_online(users_db, users_online);
         printf("\t\tUtenti online inviati correttamente\n");
         return 0;
     }
@@ -670,7 +747,7 @@ int usrlist_op(message_t msg_receved, int client_fd){
     MUTEX_BLOCK(mtx_stats, {chattyStats.nerrors++;});
     fprintf(stdout, "\t\tOP_FAIL\n");
     setSendAck(ack.hdr, OP_FAIL, client_fd);
-    free(users_online);
+    release_users_online(users_db, users_online);
     return -1;
 }
 
@@ -694,6 +771,7 @@ int unregister_op(message_t msg_receved, int client_fd){
     if (r == 0){ //Deregistrazione completata
         MUTEX_BLOCK(mtx_stats, {chattyStats.nusers--;});
         MUTEX_BLOCK(mtx_stats, {chattyStats.nonline--;});     
+        connSetUser(client_fd, "");
         printf("\t\tNickname eliminato\n");
         // Invio ack 
         if(setSendAck(ack.hdr, OP_OK, client_fd) == -1) return -1;
@@ -724,6 +802,7 @@ int disconnect_op(message_t msg_receved, int client_fd){
     int d = disconnect_user(users_db, sender);
     if(d == 0){ // Disconessione riuscita
         MUTEX_BLOCK(mtx_stats, {chattyStats.nonline--;});
+        connSetUser(client_fd, "");
         if(setSendAck(ack.hdr, OP_OK, client_fd) == -1) return -1;
         return 0;
     }
@@ -816,66 +895,475 @@ int handler(message_t msg_receved, int client_fd){
     }
 }
 
+/**
+ *  @struct co_req
+ *  @brief Richiesta servita in una coroutine (vedi runHandler)
+ *
+ *  @var msg        richiesta del client (buffer dati posseduto)
+ *  @var fd         descrittore della connessione
+ */
+typedef struct {
+    message_t  msg;
+    int        fd;
+} co_req_t;
+
+/**
+ * @function handler_co
+ * @brief Corpo della coroutine di una richiesta: esegue l'handler e libera la richiesta
+ *
+ * @return esito dell'handler
+ */
+static int handler_co(void *arg){
+    co_req_t *r = (co_req_t *) arg;
+    int ret = handler(r->msg, r->fd);
+    free(r->msg.data.buf);
+    free(r);
+    return ret;
+}
+
+/**
+ * @function runHandler
+ * @brief Esegue l'handler della richiesta. Con il pool di I/O le richieste
+ *        che aprono file girano in una coroutine: se si sospende sull'apertura
+ *        il worker torna libero e la richiesta prosegue nel thread di I/O
+ *
+ * @param msg       richiesta del client, il buffer dati passa alla coroutine
+ * @param fd        descrittore della connessione
+ *
+ * @return 0 successo, -1 fallimento, FIO_PENDING la connessione e' del pool di I/O
+ */
+static int runHandler(message_t *msg, int fd){
+    op_t op = msg->hdr.op;
+    // Solo le richieste che aprono file hanno un punto di sospensione: gli
+    // altri handler (es. POSTTXT_OP, GETPREVMSGS_OP) non attendono mai,
+    // history e utenti sono in memoria e le risposte vanno nella coda di
+    // uscita senza bloccare. In una coroutine pagherebbero solo il cambio
+    // di contesto (una sigprocmask per ogni swapcontext)
+    if(iopool != NULL && (op == POSTFILE_OP || op == GETFILE_OP)){
+        co_req_t *r = malloc(sizeof(co_req_t));
+        coro_t *co = r != NULL ? coCreate(handler_co, r) : NULL;
+        if(co != NULL){
+            r->msg = *msg;
+            r->fd  = fd;
+            msg->data.buf = NULL;
+            if(coResume(co) == 1) return FIO_PENDING;
+            int ret = co->ret;
+            coDestroy(co);
+            return ret;
+        }
+        // Senza coroutine l'apertura avviene nel worker
+        free(r);
+    }
+    return handler(*msg, fd);
+}
+
+/**
+ * @function lane
+ * @brief Corsia dello scheduler per la richiesta pronta sulla connessione: 
+ *        i trasferimenti di file e della history occupano un worker a lungo
+ *        e non devono ritardare le operazioni brevi
+ *
+ * @param fd        descrittore della connessione
+ *
+ * @return SCH_BULK o SCH_CTRL
+ */
+static sched_lane_t lane(int fd){
+    switch(connOp(fd)){
+        case POSTFILE_OP:
+        case GETFILE_OP:
+        case GETPREVMSGS_OP:
+            return SCH_BULK;
+        default:
+            return SCH_CTRL;
+    }
+}
+
+/**
+ * @function releaseConn
+ * @brief Rilascia la connessione al termine delle richieste servite: di nuovo
+ *        in coda se ha altre richieste pronte, altrimenti al reactor
+ *
+ * @param s         scheduler del reactor della connessione
+ * @param fd        descrittore della connessione
+ * @param next      esito di recvMsg sulla richiesta successiva
+ */
+static void releaseConn(sched_t *s, int fd, int next){
+    if(next > 0){
+        // Budget esaurito con altre richieste pronte: torno in coda
+        schedPush(s, fd, lane(fd));
+    }else if(next < 0 && errno == EAGAIN){
+        // Restituisco la connessione al reactor
+        if(connRearm(fd) == -1){
+            fprintf(stdout, "\t[fd:%d] Errore in scrittura sul client... disconnetto\n", fd);
+            close_client(fd);
+        }
+    }else{
+        fprintf(stdout, "\t[fd:%d] Connessione chiusa dal client... disconnetto\n", fd);
+        close_client(fd);
+    }
+}
+
+/**
+ * @function serveConn
+ * @brief Serve di seguito le richieste gia' complete nel buffer della
+ *        connessione (client che inviano in pipeline), fino a MAXBATCH per
+ *        non affamare le altre, poi la rilascia
+ *
+ * @param thid      thread id del worker
+ * @param s         scheduler del reactor della connessione
+ * @param connfd    descrittore della connessione
+ */
+static void serveConn(int thid, sched_t *s, int connfd){
+    message_t msg_c;
+    int next = 1, served = 0;
+    while(next > 0 && served < MAXBATCH){
+        // Senza pool di I/O i blocchi dei file ricevuti dal reactor li scrive il worker
+        int chunk = connWriteChunk(connfd);
+        if(chunk != 0){
+            if(chunk == -1){
+                fprintf(stderr, "\tWorker %d (scrittura file fallita)\n", thid);
+                next = -2;
+                break;
+            }
+            served++;
+            next = recvMsg(connfd);
+            continue;
+        }
+        memset(&msg_c, 0, sizeof(message_t));
+        // Estraggo la richiesta, gia' ricevuta per intero
+        if(takeMsg(connfd, &msg_c) <= 0){ 
+            fprintf(stdout, "\tWorker %d (Nessuna richiesta dal client... disconnetto)\n", thid);
+            next = -2;
+            break;
+        }
+        fprintf(stdout, "\tWorker %d (Messaggio del client [fd:%d] letto correttamente)\n", thid, connfd);
+        fprintf(stdout, "\tWorker %d (Operazione richiesta da %s)\n", thid, msg_c.hdr.sender);
+        
+        // Gestione richiesta del client 
+        int ret = runHandler(&msg_c, connfd);
+        if(msg_c.data.buf != NULL)
+            free(msg_c.data.buf); 
+        if(ret == FIO_PENDING){
+            // Il pool di I/O possiede la connessione fino al completamento
+            fprintf(stdout, "\tWorker %d (richiesta affidata al pool di I/O)\n", thid);
+            return;
+        }
+        if(ret != 0){
+            // Gesione richiesta fallita
+            fprintf(stderr, "\tWorker %d (handler fallito)\n", thid);
+            next = -2;
+            break;
+        }
+        fprintf(stdout, "\tWorker %d (handler concluso correttamente)\n", thid);
+        served++;
+        // La richiesta successiva potrebbe essere gia' nel buffer della connessione
+        next = recvMsg(connfd);
+    }
+
+    if(next == -2){
+        close_client(connfd);
+    }else{
+        releaseConn(s, connfd, next);
+    }
+}
+
 /**
  * @function thread_worker
  * @brief Funzione eseguita dai thread presenti nel pool
  *
- * @param arg       thread id 
+ * @param arg       thread id, il worker serve il reactor thid % nreactors
  *
  * @return null
  */
 void *thread_worker(void *arg){
-    message_t msg_c;
     int thid = (intptr_t) arg;
-    fprintf(stdout, "\tWorker %d start\n", thid);
+    reactor_t *r = reactors[thid % nreactors];
+    sched_t *s = r->sched;
+    int w = thid / nreactors;   // Indice del worker nello scheduler del reactor
+    long batch[POPBATCH];
+    fprintf(stdout, "\tWorker %d start (reactor %d)\n", thid, r->id);
+    // Se il kernel non supporta io_uring le consegne usano deliverMsg
+    if(configuration.IoUring) wring = uringCreate(TX_GATHER);
 
     while (!stop){
-        int *tmp, connfd;
-        memset(&msg_c, 0, sizeof(message_t));
-        // Pop file descriptor dalla coda 
-        tmp = (void *) pop(q);
-        connfd = *tmp;
+        // Pop file descriptor dalla coda, piu' di uno se la coda e' lunga
+        int n = schedPopMany(s, w, batch, POPBATCH);
+        int connfd = (int) batch[0];
+        // Il controllore del pool ha ridotto i worker del reactor
+        if(connfd == SCH_EXIT){
+            fprintf(stdout, "\tWorker %d terminato (pool ridotto)\n", thid);
+            break;
+        }
         // Controllo se è stata richiesta la terminazione del server
         if(connfd == -2){
-            push(q, tmp);
-            return NULL;
+            schedPush(s, connfd, SCH_CTRL);
+            break;
         }
-        free(tmp);
-        
-        // Leggo il messaggio del client 
-        if(readMsg(connfd, &msg_c) > 0){ 
-            fprintf(stdout, "\tWorker %d (Messaggio del client [fd:%d] letto correttamente)\n", thid, connfd);
-            fprintf(stdout, "\tWorker %d (Operazione richiesta da %s)\n", thid, msg_c.hdr.sender);
+
+        for(int i = 0; i < n; i++) serveConn(thid, s, (int) batch[i]);
+    }
+    uringDestroy(wring);
+    wring = NULL;
+    return NULL;
+}
+
+/**
+ * @function file_written
+ * @brief Completamento della scrittura di un blocco di file nel pool di I/O
+ *
+ * @param req       richiesta di scrittura completata
+ *
+ * @return 0 successo, -1 fallimento
+ */
+static int file_written(fio_req_t *req){
+    return fileWritten(req->conn, req->err);
+}
+
+/**
+ * @function file_writer
+ * @brief Scrittore asincrono dei blocchi dei file ricevuti (vedi connFileWriter):
+ *        affida la scrittura al pool di I/O
+ *
+ * @return 0 successo, -1 fallimento
+ */
+static int file_writer(long fd, int file_fd, char *buf, size_t len, int last){
+    fio_req_t *req = fioAlloc(FIO_WRITE, fd, file_written);
+    if(req == NULL){
+        free(buf);
+        if(last) close(file_fd);
+        return -1;
+    }
+    req->file_fd = file_fd;
+    req->buf     = buf;
+    req->len     = len;
+    req->last    = last;
+    return fioSubmit(iopool, req) == FIO_PENDING ? 0 : -1;
+}
+
+/**
+ * @function io_complete
+ * @brief Eseguita dal pool di I/O dopo la callback di una richiesta o la fine
+ *        della coroutine di un handler: come un worker, prosegue con le
+ *        richieste gia' ricevute sulla connessione o la restituisce al suo reactor
+ *
+ * @param fd        descrittore della connessione
+ * @param ret       esito della callback o dell'handler (0 successo, -1 fallimento)
+ */
+static void io_complete(long fd, int ret){
+    reactor_t *r = (reactor_t *) connOwner(fd);
+    if(r == NULL) return;
+    if(ret != 0){
+        close_client(fd);
+        return;
+    }
+    releaseConn(r->sched, fd, recvMsg(fd));
+}
+
+/**
+ * @function splitThreads
+ * @brief Quota di total thread spettante al reactor r (almeno 1)
+ */
+static int splitThreads(int total, int r){
+    int n = total / nreactors + (r < total % nreactors);
+    return n < 1 ? 1 : n;
+}
+
+/**
+ * @function startWorkers
+ * @brief Avvia un worker del reactor r su ogni slot restituito da schedResize
+ *
+ * @param r         indice del reactor
+ * @param spawn     slot su cui avviare un worker
+ * @param n         numero di slot
+ */
+static void startWorkers(int r, int *spawn, int n){
+    for(int i = 0; i < n; i++){
+        int w = spawn[i];
+        // Lo slot puo' essere stato di un worker gia' terminato
+        if(wjoin[r][w]) pthread_join(workers[r][w], NULL);
+        int thid = w * nreactors + r;
+        wjoin[r][w] = pthread_create(&workers[r][w], NULL, thread_worker, (void *) (intptr_t) thid) == 0;
+        if(!wjoin[r][w]){
+            fprintf(stderr,"Creazione worker %d fallita\n", thid); 
+            continue;
+        }
+        fprintf(stdout, "Worker %d creato\n", thid);
+    }
+}
+
+/**
+ * @function pool_controller
+ * @brief Ogni POOL_PERIOD ms misura attesa in coda ed utilizzo dei worker di
+ *        ogni reactor, ed aggiunge o toglie un worker entro MinThreads e MaxThreads
+ *
+ * @param arg
+ *
+ * @return null
+ */
+void *pool_controller(void *arg){
+    int maxslots = 0;
+    for(int r = 0; r < nreactors; r++) if(wmax[r] > maxslots) maxslots = wmax[r];
+    int *spawn = Calloc(maxslots, sizeof(int));
+    struct timespec period = { POOL_PERIOD / 1000, (POOL_PERIOD % 1000) * 1000000L };
+    fprintf(stdout, "\tThread controllore del pool start\n");
+
+    while(!stop){
+        nanosleep(&period, NULL);
+        for(int r = 0; r < nreactors && !stop; r++){
+            sched_t *s = reactors[r]->sched;
+            unsigned long wait;
+            unsigned util;
+            schedSample(s, &wait, &util);
+
+            int n = s->nactive, m = n;
+            if((wait >= POOL_WAIT_US || util >= POOL_UTIL_HIGH) && n < wmax[r]) m = n + 1;
+            else if(wait < POOL_WAIT_US / 10 && util <= POOL_UTIL_LOW && n > wmin[r]) m = n - 1;
+            if(m == n) continue;
+
+            fprintf(stdout, "[Pool] Reactor %d: %d -> %d worker (attesa media %lu us, utilizzo %u%%)\n", r, n, m, wait, util);
+            MUTEX_BLOCK(mtx_stats, {
+                if(m > n) chattyStats.npoolgrow++;
+                else chattyStats.npoolshrink++;
+                chattyStats.nthreads += m - n;
+            });
+            startWorkers(r, spawn, schedResize(s, m, spawn));
+        }
+    }
+    free(spawn);
+    return NULL;
+}
+
+/**
+ * @function reactor_loop
+ * @brief Event loop di un reactor: accetta nuove connessioni dal socket di 
+ *        ascolto condiviso e inoltra ai propri worker gli fd pronti
+ *
+ * @param arg       puntatore al reactor
+ *
+ * @return null
+ */
+void *reactor_loop(void *arg){
+    reactor_t *r = (reactor_t *) arg;
+    struct epoll_event *events;
+    int i, fd, connfd, nonline, nready;
+    long ready[MAXEVENTS];            // Connessioni con una richiesta completa in questo giro
+    sched_lane_t lanes[MAXEVENTS];
+
+    events = (struct epoll_event *) Calloc(MAXEVENTS, sizeof(struct epoll_event));
+    fprintf(stdout, "[Reactor %d] start\n", r->id);
+
+    while (!stop){ 
+        // Nessun timeout: il reactor viene svegliato dagli fd pronti, dai riarmi
+        // dei worker (EPOLL_CTL_MOD) o dall'eventfd
+        int res = epoll_wait(r->epfd, events, MAXEVENTS, -1);
+        if(res < 0) continue;
+        // Con io_uring le letture di tutti i client pronti partono insieme
+        if(r->ring != NULL && connReadBatch(r->ring, events, res) == -1){
+            fprintf(stderr, "[Reactor %d] io_uring disabilitato\n", r->id);
+            uringDestroy(r->ring);
+            r->ring = NULL;
+        }
+        // Scorro solo gli fd pronti
+        nready = 0;
+        for (i = 0; i < res; i++){
+            fd = events[i].data.fd;
+            if (fd == r->evfd){
+                // Notifica esplicita, svuoto il contatore dell'eventfd
+                reactorDrain(r);
+            }
+            else if (fd == fd_socket){ 
+                // Richiesta di connesione, il socket e' non bloccante perche' 
+                // un altro reactor potrebbe averla gia' accettata
+                if((connfd = accept(fd_socket, (struct sockaddr *)NULL, NULL)) == -1){
+                    if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("accept");
+                    continue;
+                }
+                  
+                MUTEX_BLOCK(mtx_stats, {nonline = chattyStats.nonline;});
             
-            // Gestione richiesta del client 
-            if (handler(msg_c, connfd) == 0){
-                fprintf(stdout, "\tWorker %d (handler concluso correttamente)\n", thid);
-                pthread_mutex_lock(&mtx_set);
-                FD_SET(connfd, &set);     // Inserisco l'fd nel set della select
-                pthread_mutex_unlock(&mtx_set);
-            }else{
-                // Gesione richiesta fallita
-                fprintf(stderr, "\tWorker %d (handler fallito)\n", thid);
-                if(disconnect_user_fd(users_db, connfd) == 0){        // Se connesso lo disconnetto altrimenti non faccio nulla 
-                    MUTEX_BLOCK(mtx_stats, {chattyStats.nonline--;});
+                // Controllo limite connessini   
+                if(nonline >= configuration.MaxConnections){
+                    fprintf(stdout, "[Reactor %d] Connessioni massime raggiunte\n", r->id);
+                    message_t ack;
+                    MUTEX_BLOCK(mtx_stats, {chattyStats.nerrors++;});
+                    setSendAck(ack.hdr, OP_FAIL, connfd);
+                    close(connfd);
+                }
+                else if(newConn(connfd, r->epfd, r) == -1){
+                    perror("newConn");
+                    close(connfd);
+                }
+                // Registro connfd nell'epoll del reactor, una sola notifica alla volta
+                else if(reactorAdd(r, connfd, EPOLLIN | EPOLLONESHOT) == -1){
+                    closeConn(connfd);
                 }
             }
-        }else{
-            fprintf(stdout, "\tWorker %d (Nessuna richiesta dal client... disconnetto)\n", thid);
-            if(disconnect_user_fd(users_db, connfd) == 0){            // Se connesso lo disconnetto altrimenti non faccio nulla 
-                MUTEX_BLOCK(mtx_stats,{chattyStats.nonline--;});
+            else{ // Evento su un client connesso
+                // Invio della coda di uscita e ricezione non bloccante: 
+                // solo le richieste complete arrivano ai worker
+                int ret = connEvent(fd, events[i].events);
+                if(ret > 0){
+                    fprintf(stdout, "[Reactor %d] Richiesta da client [fd:%d]\n", r->id, fd);
+
+                    // La connessione non riceve altre richieste fino al connRearm del worker.
+                    // Gli fd pronti vanno in coda tutti insieme, nella corsia dell'operazione richiesta
+                    ready[nready] = fd;
+                    lanes[nready++] = lane(fd);
+                }
+                else if(ret < 0){
+                    fprintf(stdout, "[Reactor %d] Client [fd:%d] disconnesso\n", r->id, fd);
+                    close_client(fd);
+                }
             }
         }
-        if(msg_c.data.buf != NULL)
-            free(msg_c.data.buf); 
+        // Un solo inserimento (ed un solo risveglio dei worker) per tutto il giro
+        if(nready > 0) schedPushMany(r->sched, ready, lanes, nready);
     }
+    free(events);
     return NULL;
 }
 
+/**
+ * @function adoptConns
+ * @brief Registra nei reactor le connessioni ricevute dal processo precedente,
+ *        riconnette i loro utenti e serve le richieste gia' complete nei byte
+ *        letti da quel processo. Va chiamata prima di avviare i reactor
+ *
+ * @param conns     connessioni ricevute
+ * @param n         numero di connessioni
+ */
+static void adoptConns(ho_conn_t *conns, int n){
+    for(int i = 0; i < n; i++){
+        reactor_t *r = reactors[i % nreactors];
+        int fd = conns[i].fd;
+        if(newConn(fd, r->epfd, r) == -1){
+            perror("newConn");
+            close(fd);
+            continue;
+        }
+        if(connImport(fd, conns[i].pending, conns[i].len) == -1 
+           || reactorAdd(r, fd, EPOLLIN | EPOLLONESHOT) == -1){
+            closeConn(fd);
+            continue;
+        }
+        if(conns[i].user[0] != '\0' && connect_user(users_db, conns[i].user, fd) == 0){
+            MUTEX_BLOCK(mtx_stats, {chattyStats.nonline++;});
+            connSetUser(fd, conns[i].user);
+        }
+        // Come per un evento in lettura: i byte ereditati possono gia'
+        // contenere una richiesta completa
+        int ret = connEvent(fd, EPOLLIN);
+        if(ret > 0) schedPush(r->sched, fd, lane(fd));
+        else if(ret < 0) close_client(fd);
+    }
+    fprintf(stdout, "[Main] %d connessioni ricevute dal processo precedente\n", n);
+}
+
 int main(int argc, char *argv[]){
 
     // Controllo parametri in ingresso
-    if (argc != 3 || strncmp(argv[1], "-f", 2) != 0){
+    int upgrade = argc == 4 && strcmp(argv[3], "-u") == 0;
+    if ((argc != 3 && !upgrade) || strncmp(argv[1], "-f", 2) != 0){
         usage(argv[0]);
         return -1;
     }
@@ -899,11 +1387,18 @@ int main(int argc, char *argv[]){
     fprintf(stdout, "MaxMsgSize: %d\n", configuration.MaxMsgSize);
     fprintf(stdout, "MaxFileSize: %d\n", configuration.MaxFileSize);
     fprintf(stdout, "MaxHistMsgs: %d\n", configuration.MaxHistMsgs);
+    fprintf(stdout, "ReactorThreads: %d\n", configuration.ReactorThreads);
+    fprintf(stdout, "IoUring: %d\n", configuration.IoUring);
+    fprintf(stdout, "WorkStealing: %d\n", configuration.WorkStealing);
+    fprintf(stdout, "MinThreads: %d\n", configuration.MinThreads);
+    fprintf(stdout, "MaxThreads: %d\n", configuration.MaxThreads);
+    fprintf(stdout, "BulkShare: %d\n", configuration.BulkShare);
+    fprintf(stdout, "IoThreads: %d\n", configuration.IoThreads);
+    fprintf(stdout, "SpinWaitUs: %d\n", configuration.SpinWaitUs);
+    fprintf(stdout, "HandoffPath: %s\n", configuration.HandoffPath);
     fprintf(stdout, "************************************\n");
     fprintf(stdout, "\n");
 
-    unlink(configuration.UnixPath);   
-
     // Gestione segnali 
     sigemptyset(&sigset);      // Resetto tutti i bits
     sigaddset(&sigset,SIGINT);
@@ -922,10 +1417,6 @@ int main(int argc, char *argv[]){
         exit(EXIT_FAILURE); 
     }
 
-    //Creo il socket
-    int fd_socket;
-    SYSCALL(fd_socket, socket(AF_UNIX, SOCK_STREAM, 0), "socket");
-
     // Inizializzazione strutture dati  
     users_db = users_db_create(NBUCKETS, configuration.MaxConnections, configuration.MaxHistMsgs); 
     if(users_db == NULL){
@@ -933,119 +1424,178 @@ int main(int argc, char *argv[]){
         exit(EXIT_FAILURE);
     }
 
-    // Inizializzazione coda  
-    q = initQueue();
-    if(q == NULL){
-        fprintf(stderr,"[Main] Iniziallizzazione coda fallita\n");
-        exit(EXIT_FAILURE);
-    } 
-
     // Imposta un flag sulla libreria Connections.c per abilitare la mutua esclusione
     initConnection();
 
-    struct sockaddr_un sa;
-    strncpy(sa.sun_path, configuration.UnixPath, strlen(configuration.UnixPath) + 1);
-    sa.sun_family = AF_UNIX;
-    SYSCALL(notused, bind(fd_socket, (struct sockaddr *)&sa, sizeof(sa)), "bind");  
-    SYSCALL(notused, listen(fd_socket, configuration.MaxConnections), "listen");     
+    ho_conn_t *adopted = NULL;
+    int nadopted = 0;
+    if(upgrade){
+        // Socket di ascolto, connessioni, utenti e history arrivano dal server
+        // in esecuzione: UnixPath resta quello su cui e' gia' in ascolto
+        if(configuration.HandoffPath[0] == '\0'){
+            fprintf(stderr,"[Main] -u richiede HandoffPath nel file di configurazione\n");
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stdout, "[Main] In attesa dello stato su %s (inviare SIGUSR2 al server in esecuzione)\n",
+                configuration.HandoffPath);
+        int ho = handoffAccept(configuration.HandoffPath);
+        if(ho == -1 || (nadopted = handoffRecv(ho, &fd_socket, users_db, &chattyStats, &adopted)) == -1){
+            perror("handoff");
+            exit(EXIT_FAILURE);
+        }
+        close(ho);
+        // Statistiche del processo precedente, tranne quelle dei thread e degli utenti online
+        chattyStats.nonline = chattyStats.nthreads = chattyStats.npoolgrow = chattyStats.npoolshrink = 0;
+    }else{
+        unlink(configuration.UnixPath);   
+
+        //Creo il socket
+        SYSCALL(fd_socket, socket(AF_UNIX, SOCK_STREAM, 0), "socket");
+
+        struct sockaddr_un sa;
+        strncpy(sa.sun_path, configuration.UnixPath, strlen(configuration.UnixPath) + 1);
+        sa.sun_family = AF_UNIX;
+        SYSCALL(notused, bind(fd_socket, (struct sockaddr *)&sa, sizeof(sa)), "bind");  
+        SYSCALL(notused, listen(fd_socket, configuration.MaxConnections), "listen");     
+    }
     fprintf(stdout, "[Main] Server start\n");
 
-    // Set dei fd da ascoltare
-    int connfd, fd, fd_max = 0;
-    fd_set tmpset;
-    FD_ZERO(&set);
-    FD_ZERO(&tmpset);
-    FD_SET(fd_socket, &set);
+    // Il socket di ascolto e' condiviso tra i reactor: non bloccante e registrato 
+    // con EPOLLEXCLUSIVE per svegliare un solo reactor per connessione
+    SYSCALL(notused, fcntl(fd_socket, F_SETFL, fcntl(fd_socket, F_GETFL, 0) | O_NONBLOCK), "fcntl");
+
+    // Ogni reactor deve avere almeno un worker
+    nreactors = configuration.ReactorThreads;
+    if(nreactors <= 0) nreactors = 1;
+    if(nreactors > configuration.ThreadsInPool) nreactors = configuration.ThreadsInPool;
+
+    // Limiti del pool: senza MinThreads e MaxThreads il pool resta di ThreadsInPool thread
+    if(configuration.MinThreads <= 0 || configuration.MinThreads > configuration.ThreadsInPool)
+        configuration.MinThreads = configuration.ThreadsInPool;
+    if(configuration.MaxThreads < configuration.ThreadsInPool)
+        configuration.MaxThreads = configuration.ThreadsInPool;
+
+    // Pool di I/O su disco: i file vengono aperti e scritti fuori dai worker e dai reactor
+    if(configuration.IoThreads > 0){
+        if((iopool = fioCreate(configuration.IoThreads, io_complete, configuration.IoUring)) == NULL){
+            fprintf(stderr,"[Main] Creazione pool di I/O fallita, file gestiti dai worker\n");
+        }else{
+            connFileWriter(file_writer);
+        }
+    }
 
-    fd_max = fd_socket; 
+    // Creazione reactor
+    reactors = (reactor_t **) Calloc(nreactors, sizeof(reactor_t *));
+    workers  = (pthread_t **) Calloc(nreactors, sizeof(pthread_t *));
+    wjoin    = (int **) Calloc(nreactors, sizeof(int *));
+    wmin     = (int *) Calloc(nreactors, sizeof(int));
+    wmax     = (int *) Calloc(nreactors, sizeof(int));
+    int adaptive = 0;
+    for(i = 0; i < nreactors; i++){
+        // Worker del reactor i: quelli con indice i, i + nreactors, ...
+        wmin[i] = splitThreads(configuration.MinThreads, i);
+        wmax[i] = splitThreads(configuration.MaxThreads, i);
+        if(wmin[i] != wmax[i]) adaptive = 1;
+        workers[i] = (pthread_t *) Calloc(wmax[i], sizeof(pthread_t));
+        wjoin[i]   = (int *) Calloc(wmax[i], sizeof(int));
+        reactors[i] = createReactor(i, configuration.WorkStealing ? SCH_STEAL : SCH_FIFO, wmax[i],
+                                    configuration.BulkShare, configuration.SpinWaitUs,
+                                    configuration.IoUring ? MAXEVENTS : 0);
+        if(reactors[i] == NULL || reactorAdd(reactors[i], fd_socket, EPOLLIN | EPOLLEXCLUSIVE) == -1){
+            fprintf(stderr,"[Main] Iniziallizzazione reactor %d fallita\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
 
     // Creazione ThreadPool 
-    threadPool = (pthread_t *) Malloc(configuration.ThreadsInPool * sizeof(pthread_t));
+    for(i = 0; i < nreactors; i++){
+        int *spawn = Calloc(wmax[i], sizeof(int));
+        int n = schedResize(reactors[i]->sched, splitThreads(configuration.ThreadsInPool, i), spawn);
+        chattyStats.nthreads += n;
+        startWorkers(i, spawn, n);
+        free(spawn);
+    }
 
-    for(i = 0; i < configuration.ThreadsInPool; i++){
-        if(pthread_create(&threadPool[i], NULL, thread_worker, (void *) (intptr_t) i) != 0){
-            fprintf(stderr,"Creazione worker %d fallita\n", i); 
-        }
-        fprintf(stdout, "Worker %d creato\n", i);
+    // Il controllore del pool serve solo se il numero di worker puo' variare
+    if(adaptive && pthread_create(&poolTread, NULL, pool_controller, NULL) != 0){
+        fprintf(stderr,"[Main] Creazione controllore del pool fallita\n");
+        adaptive = 0;
     }
 
-    int nonline;
+    // Connessioni ereditate, prima che i reactor inizino a gestirne gli eventi
+    if(upgrade){
+        adoptConns(adopted, nadopted);
+        free(adopted);
+    }
 
-    // Loop del server
-    while (!stop){ 
-        pthread_mutex_lock(&mtx_set);
-        tmpset = set;
-        pthread_mutex_unlock(&mtx_set);
+    // Il reactor 0 e' eseguito dal thread main, gli altri da thread dedicati
+    for(i = 1; i < nreactors; i++){
+        if(pthread_create(&reactors[i]->tid, NULL, reactor_loop, (void *) reactors[i]) != 0){
+            fprintf(stderr,"[Main] Creazione reactor %d fallita\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
 
-        // Timiout select 1000 usec
-        struct timeval tv = {0, 1000}; 
+    // Loop del server
+    reactor_loop(reactors[0]);
 
-        int res = select(fd_max + 1, &tmpset, NULL, NULL, &tv);
-        if(res < 0) continue;
-        for (fd = 0; fd <= fd_max; fd++){
-            if (FD_ISSET(fd, &tmpset)){
-                if (fd == fd_socket){ 
-                    // Richiesta di connesione 
-                    SYSCALL(connfd, accept(fd_socket, (struct sockaddr *)NULL, NULL), "accept");
-                      
-                    MUTEX_BLOCK(mtx_stats, {nonline = chattyStats.nonline;});
-                
-                    // Controllo limite connessini   
-                    if(nonline >= configuration.MaxConnections){
-                        fprintf(stdout, "[Main] Connessioni massime raggiunte\n");
-                        message_t ack;
-                        MUTEX_BLOCK(mtx_stats, {chattyStats.nerrors++;});
-                        setSendAck(ack.hdr, OP_FAIL, connfd);
-
-                    }
-                    else{
-                        pthread_mutex_lock(&mtx_set);
-                        FD_SET(connfd, &set);          // Aggiungo connfd all' insieme set
-                        pthread_mutex_unlock(&mtx_set);
-                        if (connfd > fd_max) fd_max = connfd; 
-                    }
-                }
-                else{ // Richiesta da un client connesso
-                    fprintf(stdout, "[Main] Richiesta da client [fd:%d]\n", fd);
+    /************************************ Gestione chiusura server ************************************/
+    for(i = 1; i < nreactors; i++){
+        pthread_join(reactors[i]->tid, NULL);
+        fprintf(stdout, "[Main] Join reactor %d\n", i);
+    }
 
-                    int *data = Calloc(1,sizeof(int));
-                    *data = fd; 
-            
-                    pthread_mutex_lock(&mtx_set);
-                    FD_CLR(fd, &set);               // Non gestisto piu il client
-                    pthread_mutex_unlock(&mtx_set);
-                    
-                    // Inserimento fd nella coda
-                    push(q, data);
-                }
-            }
-        }
+    if(adaptive){
+        pthread_join(poolTread, NULL);
+        fprintf(stdout, "[Main] Join controllore del pool\n");
     }
 
-    /************************************ Gestione chiusura server ************************************/
-    //Inserisco nella coda l'EOS
-    int *eos = Calloc(1, sizeof(int));
-    *eos = -2;
-    push(q, eos);
+    //Inserisco nella coda di ogni reactor l'EOS
+    for(i = 0; i < nreactors; i++){
+        schedPush(reactors[i]->sched, -2, SCH_CTRL);
+    }
 
     pthread_join(sigTread, NULL);
     fprintf(stdout, "[Main] Join thread sigwait\n");
 
     // Aspetto i thread che terminino
-    for (i = 0; i < configuration.ThreadsInPool; i++){
-        pthread_join(threadPool[i], NULL);
-        fprintf(stdout, "[Main] Join thread %d\n", i);
+    for(i = 0; i < nreactors; i++){
+        for(int w = 0; w < wmax[i]; w++){
+            if(!wjoin[i][w]) continue;
+            pthread_join(workers[i][w], NULL);
+            fprintf(stdout, "[Main] Join thread %d\n", w * nreactors + i);
+        }
+        free(workers[i]);
+        free(wjoin[i]);
+    }
+
+    // Le richieste su disco ancora in corso riprendono le proprie connessioni
+    // prima che i reactor vengano distrutti
+    fioDestroy(iopool);
+
+    // Nessun thread e' piu' attivo: lo stato passa al nuovo processo, le
+    // connessioni non trasferibili vengono chiuse con le altre risorse
+    if(handoff_fd != -1){
+        int n = handoffSend(handoff_fd, fd_socket, users_db, &chattyStats);
+        if(n == -1) perror("handoffSend");
+        else fprintf(stdout, "[Main] %d connessioni passate al nuovo processo\n", n);
+        close(handoff_fd);
     }
 
     //Libero memoria allocata precedentemente
     fprintf(stdout, "[Main] Pulizia memoria...\n");
-    deleteQueue(q);
+    for(i = 0; i < nreactors; i++){
+        destroyReactor(reactors[i]);
+    }
+    free(reactors);
     users_db_destroy(users_db);
     close(fd_socket);
     free(users_db);
-    free(threadPool);
+    free(workers);
+    free(wjoin);
+    free(wmin);
+    free(wmax);
     destroyConnection();
-    free(eos);
     fprintf(stdout, "Server chiuso.\n");
     return 0;
 }
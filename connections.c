@@ -7,22 +7,30 @@
  * 
  */
 
+#define _POSIX_C_SOURCE 200809L
 #include <sys/types.h> 
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include "util.h"
 #include "connections.h"
 
-#define NSECTIONS 4
-
-static pthread_mutex_t *mtx_conn; 
 int flag = 0;                       // Flag utilizzato per abilitare la mutua esclusione 
 
+static conn_t **conns = NULL;       // Tabella delle connessioni indicizzata per fd (elementi mai liberati prima di destroyConnection)
+static long nconns = 0;             // Dimensione della tabella
+static file_writer_t file_writer = NULL;   // Scrittore asincrono dei blocchi dei file ricevuti
+
 /**
  * @function readn
  * @brief Legge esattamente size byte 
@@ -66,6 +74,12 @@ static inline int writen(long fd, void *buf, size_t size) {
     while(left>0) {
 	    if ((r=write((int)fd ,bufptr,left)) == -1) {
 	        if (errno == EINTR) continue;
+	        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+	            // Socket non bloccante pieno: attendo che torni scrivibile
+	            struct pollfd pfd = { (int)fd, POLLOUT, 0 };
+	            if (poll(&pfd, 1, -1) == -1 && errno != EINTR) return -1;
+	            continue;
+	        }
 	        return -1;
 	    }
 	    if (r == 0) return 0;  
@@ -75,20 +89,173 @@ static inline int writen(long fd, void *buf, size_t size) {
     return 1;
 }
 
+/**
+ * @function iovSkip
+ * @brief Copia in out gli iovec di iov saltando i primi off byte, 
+ *        per riprendere una scrittura parziale
+ *
+ * @param iov     iovec del messaggio completo
+ * @param cnt     numero di iovec
+ * @param off     byte gia' scritti
+ * @param out     iovec da scrivere (almeno cnt elementi)
+ *
+ * @return numero di iovec in out
+ */
+static int iovSkip(struct iovec *iov, int cnt, size_t off, struct iovec *out){
+    int n = 0;
+    for(int i = 0; i < cnt; i++){
+        if(off >= iov[i].iov_len){
+            off -= iov[i].iov_len;
+            continue;
+        }
+        out[n].iov_base = (char *)iov[i].iov_base + off;
+        out[n].iov_len  = iov[i].iov_len - off;
+        off = 0;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @function writevn
+ * @brief Scrive per intero gli iovec con una writev per tentativo, 
+ *        riprendendo dopo le scritture parziali
+ *
+ * @param fd      descrittore su cui scrivere 
+ * @param iov     parti del messaggio da scrivere
+ * @param cnt     numero di iovec (al piu' 3)
+ *
+ * @return 1 successo, -1 errore
+ */
+static int writevn(long fd, struct iovec *iov, int cnt){
+    struct iovec tmp[3];
+    size_t size = 0, off = 0;
+    for(int i = 0; i < cnt; i++) size += iov[i].iov_len;
+
+    while(off < size){
+        int n = iovSkip(iov, cnt, off, tmp);
+        ssize_t r = writev((int)fd, tmp, n);
+        if(r == -1){
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                // Socket non bloccante pieno: attendo che torni scrivibile
+                struct pollfd pfd = { (int)fd, POLLOUT, 0 };
+                if(poll(&pfd, 1, -1) == -1 && errno != EINTR) return -1;
+                continue;
+            }
+            return -1;
+        }
+        off += r;
+    }
+    return 1;
+}
+
+/**
+ * @function sendfilen
+ * @brief Invia per intero size byte di un file con sendfile, attendendo che
+ *        il socket torni scrivibile se non bloccante
+ *
+ * @param fd        descrittore su cui scrivere
+ * @param file_fd   descrittore del file da inviare
+ * @param size      byte da inviare a partire dall'inizio del file
+ *
+ * @return 1 successo, -1 errore
+ */
+static int sendfilen(long fd, int file_fd, size_t size){
+    off_t off = 0;
+    while((size_t)off < size){
+        ssize_t r = sendfile((int)fd, file_fd, &off, size - off);
+        if(r == -1){
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                struct pollfd pfd = { (int)fd, POLLOUT, 0 };
+                if(poll(&pfd, 1, -1) == -1 && errno != EINTR) return -1;
+                continue;
+            }
+            return -1;
+        }
+        // Il file e' piu' corto di quanto dichiarato nell'header
+        if(r == 0){
+            errno = EIO;
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @function msgIov
+ * @brief Prepara gli iovec di un messaggio: header, header dati e buffer dati
+ *
+ * @param iov     array di almeno 3 iovec
+ * @param hdr     header del messaggio
+ * @param dhdr    header della parte dati, NULL per un ack
+ * @param buf     buffer dati
+ *
+ * @return numero di iovec
+ */
+static inline int msgIov(struct iovec *iov, message_hdr_t *hdr, message_data_hdr_t *dhdr, char *buf){
+    iov[0].iov_base = hdr;
+    iov[0].iov_len  = sizeof(message_hdr_t);
+    if(dhdr == NULL) return 1;
+    iov[1].iov_base = dhdr;
+    iov[1].iov_len  = sizeof(message_data_hdr_t);
+    iov[2].iov_base = buf;
+    iov[2].iov_len  = dhdr->len;
+    return 3;
+}
+
+// Byte di un messaggio con parte dati inviato da msgIov
+#define MSG_SIZE(m)  (sizeof(message_hdr_t) + sizeof(message_data_hdr_t) + (m)->data.hdr.len)
+
+/**
+ * @function connGet
+ * @brief Elemento della tabella per fd, senza prendere la sua mutex
+ *
+ * @return puntatore alla connessione (aperta o chiusa), NULL se l'fd non ha
+ *         mai avuto una connessione
+ */
+static inline conn_t *connGet(long fd){
+    if(fd < 0 || fd >= nconns) return NULL;
+    return __atomic_load_n(&conns[fd], __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @function connLock
+ * @brief Prende la mutex della connessione se e' aperta
+ *
+ * @return puntatore alla connessione con la mutex presa, NULL se non e' aperta
+ */
+static conn_t *connLock(long fd){
+    conn_t *c = connGet(fd);
+    if(c == NULL) return NULL;
+    pthread_mutex_lock(&c->lock);
+    if(!c->open){
+        pthread_mutex_unlock(&c->lock);
+        return NULL;
+    }
+    return c;
+}
+
 /**
  * @function initConnection
- * @brief Inizializza le mutex e imposta un flag
+ * @brief Inizializza la tabella delle connessioni e imposta un flag
  * 
  * @return -1 errore, 0 successo
  */
 int initConnection(){
     flag = 1;      // Abilito la mutua esclusione 
-    mtx_conn = calloc (NSECTIONS, sizeof(pthread_mutex_t)); 
-    if(mtx_conn == NULL){
-        return -1;
+
+    // La tabella contiene un elemento per ogni fd che il processo puo' aprire
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur == RLIM_INFINITY){
+        nconns = sysconf(_SC_OPEN_MAX);
+    }else{
+        nconns = rl.rlim_cur;
     }
-    for(int i=0; i < NSECTIONS; i++){
-        pthread_mutex_init( &mtx_conn[i], NULL );
+    conns = calloc(nconns, sizeof(conn_t *));
+    if(conns == NULL){
+        return -1;
     }
     return 0;
 }
@@ -100,10 +267,1191 @@ int initConnection(){
  * @return 0 successo
  */
 void destroyConnection(){
-    for(int i=0; i < NSECTIONS; i++){
-        pthread_mutex_destroy( &mtx_conn[i]);
+    // Chiudo le connessioni ancora aperte e libero gli elementi della tabella
+    for(long fd = 0; fd < nconns; fd++){
+        if(conns[fd] == NULL) continue;
+        if(conns[fd]->open) closeConn(fd);
+        pthread_mutex_destroy(&conns[fd]->lock);
+        free(conns[fd]);
+    }
+    free(conns);
+}
+
+/**
+ * @function txWrite
+ * @brief Scrive senza bloccare la parte non ancora inviata di un messaggio
+ *        (header, header dati e buffer dati) con una writev. Se i dati
+ *        sono in un file vengono inviati con sendfile dopo gli header, al
+ *        piu' fmax byte per chiamata: sendfile legge dal disco i blocchi non
+ *        ancora in memoria e nel reactor fermerebbe le altre connessioni
+ *
+ * @param fmax   byte del file da inviare al piu', 0 nessun limite
+ *
+ * @return 1 messaggio inviato per intero, 0 socket pieno o limite raggiunto,
+ *         -1 errore
+ */
+static int txWrite(conn_t *c, long fd, out_msg_t *m, size_t fmax){
+    struct iovec iov[3], tmp[3];
+    int cnt = msgIov(iov, &(m->hdr), m->has_data ? &(m->dhdr) : NULL, m->buf);
+    size_t hlen = m->size;
+    if(m->file_fd >= 0){
+        // Con la writev solo i due header, il buffer dati e' nel file
+        cnt  = 2;
+        hlen = sizeof(message_hdr_t) + sizeof(message_data_hdr_t);
+    }
+
+    while(m->off < hlen){
+        // Una sola writev per le parti non ancora inviate
+        int n = iovSkip(iov, cnt, m->off, tmp);
+        ssize_t r = writev((int)fd, tmp, n);
+        if(r == -1){
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        m->off += r;
+        c->tx_bytes += r;
+    }
+    size_t fsent = 0;
+    while(m->off < m->size){
+        size_t len = m->size - m->off;
+        if(fmax > 0){
+            // Il resto al prossimo EPOLLOUT, dopo gli eventi delle altre connessioni
+            if(fsent == fmax) return 0;
+            if(len > fmax - fsent) len = fmax - fsent;
+        }
+        off_t foff = m->off - hlen;
+        ssize_t r = sendfile((int)fd, m->file_fd, &foff, len);
+        if(r == -1){
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        // Il file e' piu' corto di quanto dichiarato nell'header
+        if(r == 0){
+            errno = EIO;
+            return -1;
+        }
+        m->off += r;
+        fsent  += r;
+        c->tx_bytes += r;
+    }
+    return 1;
+}
+
+/**
+ * @function txFree
+ * @brief Libera un messaggio della coda di uscita chiudendo l'eventuale file
+ */
+static void txFree(out_msg_t *m){
+    if(m->file_fd >= 0) close(m->file_fd);
+    free(m->buf);
+    free(m);
+}
+
+/**
+ * @function txFlush
+ * @brief Invia senza bloccare i messaggi nella coda di uscita (m.e. presa).
+ *        Viene eseguita anche dal reactor: di un file invia al piu'
+ *        TX_FILE_CHUNK byte
+ *
+ * @return 0 coda vuota, socket pieno o limite raggiunto, -1 errore
+ */
+static int txFlush(conn_t *c, long fd){
+    while(c->tx_head != NULL){
+        out_msg_t *m = c->tx_head;
+        int r = txWrite(c, fd, m, TX_FILE_CHUNK);
+        if(r <= 0) return r;
+        c->tx_head = m->next;
+        if(c->tx_head == NULL) c->tx_tail = NULL;
+        c->tx_n--;
+        txFree(m);
+    }
+    return 0;
+}
+
+/**
+ * @function txArm
+ * @brief Arma nell'epoll gli eventi di cui la connessione ha bisogno (m.e. presa):
+ *        EPOLLIN se il reactor attende richieste e la coda di uscita non e' piena,
+ *        EPOLLOUT se la coda di uscita non e' vuota
+ */
+static void txArm(conn_t *c, long fd){
+    // Durante un evento il riarmo e' a carico del reactor, una connessione
+    // morta non va piu' armata
+    if(c->in_event || c->dead) return;
+    uint32_t ev = 0;
+    if(c->want_in && c->tx_n < TX_MAXMSGS) ev |= EPOLLIN;
+    if(c->tx_head != NULL) ev |= EPOLLOUT;
+    if(ev == 0 || ev == c->armed) return;
+
+    struct epoll_event e;
+    memset(&e, 0, sizeof(struct epoll_event));
+    e.events = ev | EPOLLONESHOT;
+    e.data.fd = fd;
+    if(epoll_ctl(c->epfd, EPOLL_CTL_MOD, (int)fd, &e) == -1){
+        perror("epoll_ctl");
+        return;
+    }
+    c->armed = ev;
+}
+
+/**
+ * @function txMsg
+ * @brief Prepara il messaggio da inviare o accodare (buffer dati del chiamante)
+ */
+static void txMsg(out_msg_t *m, message_hdr_t *hdr, message_data_t *data, int file_fd){
+    memset(m, 0, sizeof(out_msg_t));
+    m->file_fd = file_fd;
+    m->hdr  = *hdr;
+    m->size = sizeof(message_hdr_t);
+    if(data != NULL){
+        m->dhdr     = data->hdr;
+        m->buf      = data->buf;
+        m->has_data = 1;
+        m->size    += sizeof(message_data_hdr_t) + data->hdr.len;
+    }
+}
+
+/**
+ * @function txQueue
+ * @brief Accoda il messaggio preparato con txMsg (m.e. presa): il buffer dati
+ *        appartiene al chiamante e va copiato, il file passa alla coda
+ *
+ * @return 1 successo, -1 errore
+ */
+static int txQueue(conn_t *c, out_msg_t *m){
+    out_msg_t *q = malloc(sizeof(out_msg_t));
+    if(q == NULL) return -1;
+    *q = *m;
+    q->buf = NULL;
+    if(m->has_data && m->dhdr.len > 0 && m->file_fd < 0){
+        q->buf = malloc(m->dhdr.len);
+        if(q->buf == NULL){
+            free(q);
+            return -1;
+        }
+        memcpy(q->buf, m->buf, m->dhdr.len);
+    }
+    if(c->tx_tail == NULL) c->tx_head = q;
+    else c->tx_tail->next = q;
+    c->tx_tail = q;
+    c->tx_n++;
+    return 1;
+}
+
+/**
+ * @function txSend
+ * @brief Invia un messaggio su una connessione del server (m.e. presa). Se la
+ *        coda di uscita e' vuota il messaggio viene scritto subito, altrimenti
+ *        o in caso di scrittura parziale viene accodato copiando il buffer dati
+ *
+ * @param bounded   1 se il messaggio va scartato quando la coda e' piena
+ * @param file_fd   file da cui inviare i dati al posto di data->buf, -1 se
+ *                  assente. Viene chiuso quando il messaggio e' stato inviato
+ *                  o scartato
+ *
+ * @return 1 successo, -1 errore
+ */
+static int txSend(conn_t *c, long fd, message_hdr_t *hdr, message_data_t *data, int bounded, int file_fd){
+    if(c->dead || (bounded && c->tx_n >= TX_MAXMSGS)){
+        errno = c->dead ? EPIPE : ENOBUFS;
+        if(file_fd >= 0) close(file_fd);
+        return -1;
+    }
+
+    out_msg_t m;
+    txMsg(&m, hdr, data, file_fd);
+
+    // Nessun messaggio in attesa: provo a scrivere subito
+    if(c->tx_head == NULL){
+        int r = txWrite(c, fd, &m, 0);
+        if(r != 0){
+            if(file_fd >= 0) close(file_fd);
+            if(r == -1) c->dead = 1;
+            return r;
+        }
+    }
+
+    if(txQueue(c, &m) == -1){
+        if(file_fd >= 0) close(file_fd);
+        return -1;
+    }
+    // Il reactor invia il resto quando il socket torna scrivibile
+    txArm(c, fd);
+    return 1;
+}
+
+/**
+ * @function txSendMany
+ * @brief Invia n messaggi su una connessione del server (m.e. presa) come n
+ *        txSend, ma se la coda di uscita e' vuota con una sola writev per
+ *        ogni TX_GATHER messaggi. Quelli non scritti vengono accodati
+ *
+ * @return 1 successo, -1 errore
+ */
+static int txSendMany(conn_t *c, long fd, message_t **msgs, int n){
+    if(c->dead){
+        errno = EPIPE;
+        return -1;
+    }
+
+    struct iovec iov[3 * TX_GATHER], tmp[3 * TX_GATHER];
+    int i = 0;
+    size_t part = 0;    // Byte gia' scritti di msgs[i]
+    while(c->tx_head == NULL && i < n){
+        int cnt = 0, k;
+        for(k = i; k < n && k < i + TX_GATHER; k++)
+            cnt += msgIov(iov + cnt, &(msgs[k]->hdr), &(msgs[k]->data.hdr), msgs[k]->data.buf);
+        ssize_t r = writev((int)fd, tmp, iovSkip(iov, cnt, part, tmp));
+        if(r == -1){
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            c->dead = 1;
+            return -1;
+        }
+        c->tx_bytes += r;
+        part += r;
+        while(i < k && part >= MSG_SIZE(msgs[i])) part -= MSG_SIZE(msgs[i++]);
+        // Socket pieno a meta' gruppo
+        if(i < k) break;
+    }
+
+    // Il resto in coda, il primo messaggio forse gia' in parte inviato
+    for(; i < n; i++, part = 0){
+        out_msg_t m;
+        txMsg(&m, &(msgs[i]->hdr), &(msgs[i]->data), -1);
+        m.off = part;
+        if(txQueue(c, &m) == -1) return -1;
+    }
+    txArm(c, fd);
+    return 1;
+}
+
+/**
+ * @function newConn
+ * @brief Registra una connessione accettata dal server: imposta il socket
+ *        non bloccante ed inizializza il suo elemento nella tabella. La connessione deve essere poi
+ *        aggiunta all'epoll con EPOLLIN | EPOLLONESHOT
+ *
+ * @param fd     descrittore della connessione
+ * @param epfd   epoll del reactor che possiede la connessione
+ * @param owner  reactor che possiede la connessione (vedi connOwner)
+ *
+ * @return 0 successo, -1 fallimento
+ */
+int newConn(long fd, int epfd, void *owner){
+    if(fd < 0 || fd >= nconns){
+        errno = EINVAL;
+        return -1;
+    }
+    int flags;
+    CHECK_MENO1(flags, fcntl((int)fd, F_GETFL, 0), "fcntl");
+    CHECK_MENO1(flags, fcntl((int)fd, F_SETFL, flags | O_NONBLOCK), "fcntl");
+
+    // Solo il reactor che ha accettato fd puo' crearne l'elemento
+    conn_t *c = connGet(fd);
+    if(c == NULL){
+        if((c = calloc(1, sizeof(conn_t))) == NULL){
+            return -1;
+        }
+        pthread_mutex_init(&c->lock, NULL);
+        __atomic_store_n(&conns[fd], c, __ATOMIC_RELEASE);
     }
-    free(mtx_conn);
+
+    pthread_mutex_lock(&c->lock);
+    // Azzero lo stato lasciato dalla connessione precedente con lo stesso fd
+    memset(&c->rx, 0, sizeof(conn_t) - offsetof(conn_t, rx));
+    c->rx.state = RX_HDR;
+    c->rx.file_fd = -1;
+    c->epfd     = epfd;
+    c->owner    = owner;
+    c->gen++;
+    c->armed    = EPOLLIN;
+    c->want_in  = 1;
+    c->open     = 1;
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+/**
+ * @function closeConn
+ * @brief Tenta un ultimo invio non bloccante della coda di uscita, libera
+ *        lo stato della connessione e chiude il descrittore
+ *
+ * @param fd     descrittore della connessione
+ */
+void closeConn(long fd){
+    conn_t *c = connLock(fd);
+    if(c != NULL){
+        // Es. l'ack di errore inviato prima della chiusura
+        if(!c->dead) txFlush(c, fd);
+        c->open = 0;
+        while(c->tx_head != NULL){
+            out_msg_t *m = c->tx_head;
+            c->tx_head = m->next;
+            txFree(m);
+        }
+        c->tx_tail = NULL;
+        c->tx_n = 0;
+        free(c->rx.msg.data.buf);
+        c->rx.msg.data.buf = NULL;
+        free(c->rx.fbuf);
+        c->rx.fbuf = NULL;
+        if(c->rx.file_fd >= 0) close(c->rx.file_fd);
+        c->rx.file_fd = -1;
+        pthread_mutex_unlock(&c->lock);
+    }
+    // Chiuso solo dopo open = 0: l'fd puo' essere riassegnato da accept
+    if(fd >= 0) close((int)fd);
+}
+
+/**
+ * @function connOwner
+ * @brief Reactor che possiede la connessione
+ *
+ * @param fd     descrittore della connessione
+ *
+ * @return owner passato a newConn, NULL se la connessione non esiste
+ */
+void *connOwner(long fd){
+    conn_t *c = connLock(fd);
+    if(c == NULL) return NULL;
+    void *owner = c->owner;
+    pthread_mutex_unlock(&c->lock);
+    return owner;
+}
+
+/**
+ * @function connSetUser
+ * @brief Associa alla connessione l'utente che vi si e' connesso
+ *
+ * @param fd     descrittore della connessione
+ * @param name   nickname dell'utente, "" per nessuno
+ */
+void connSetUser(long fd, const char *name){
+    conn_t *c = connLock(fd);
+    if(c == NULL) return;
+    strncpy(c->user, name, MAX_NAME_LENGTH);
+    c->user[MAX_NAME_LENGTH] = '\0';
+    pthread_mutex_unlock(&c->lock);
+}
+
+/**
+ * @function connUser
+ * @brief Copia in name l'utente associato alla connessione con connSetUser
+ *
+ * @param fd     descrittore della connessione
+ * @param name   buffer di almeno MAX_NAME_LENGTH+1 caratteri
+ *
+ * @return 1 utente associato, 0 nessun utente o connessione inesistente
+ */
+int connUser(long fd, char *name){
+    name[0] = '\0';
+    conn_t *c = connLock(fd);
+    if(c == NULL) return 0;
+    memcpy(name, c->user, MAX_NAME_LENGTH + 1);
+    pthread_mutex_unlock(&c->lock);
+    return name[0] != '\0';
+}
+
+/**
+ * @function connStats
+ * @brief Byte ricevuti ed inviati sulla connessione dalla sua apertura
+ *
+ * @param fd     descrittore della connessione
+ * @param rx     dove copiare i byte ricevuti
+ * @param tx     dove copiare i byte inviati
+ *
+ * @return 0 successo, -1 connessione inesistente
+ */
+int connStats(long fd, unsigned long *rx, unsigned long *tx){
+    conn_t *c = connLock(fd);
+    if(c == NULL) return -1;
+    *rx = c->rx.nbytes;
+    *tx = c->tx_bytes;
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+/**
+ * @function connExport
+ * @brief Passa ad fn le connessioni aperte ferme tra due richieste, con
+ *        l'utente connesso ed i byte gia' letti dal socket e non ancora
+ *        consumati (compresi quelli di un header letto a meta'). Le altre
+ *        (dati o file di una richiesta a meta', coda di uscita non vuota)
+ *        non sono trasferibili. Va chiamata a reactor e worker terminati
+ *
+ * @param fn     funzione chiamata per ogni connessione trasferibile
+ * @param arg    argomento di fn
+ *
+ * @return numero di connessioni passate con successo
+ */
+int connExport(conn_export_t fn, void *arg){
+    int n = 0;
+    for(long fd = 0; fd < nconns; fd++){
+        conn_t *c = connLock(fd);
+        if(c == NULL) continue;
+        // Ultimo tentativo di svuotare la coda di uscita
+        if(!c->dead && txFlush(c, fd) == -1) c->dead = 1;
+        conn_rx_t *rx = &(c->rx);
+        int idle = !c->dead && c->tx_head == NULL && rx->file_st == 0 && rx->fwait == 0
+                   && rx->file_fd < 0 && !rx->eof && (rx->pend_err == 0 || rx->pend_err == EAGAIN)
+                   && (rx->state == RX_HDR || (rx->state == RX_DATA_HDR && rx->off < sizeof(message_data_hdr_t)));
+        if(idle){
+            // Un header a meta' e' gia' stato tolto dal buffer (che e' quindi
+            // vuoto): i suoi byte vengono rimessi in testa a quelli pendenti
+            char pending[RX_BUFSIZE];
+            size_t len = 0;
+            if(rx->state == RX_DATA_HDR){
+                memcpy(pending, &(rx->msg.hdr), sizeof(message_hdr_t));
+                len = sizeof(message_hdr_t);
+                memcpy(pending + len, &(rx->msg.data.hdr), rx->off);
+            }else{
+                memcpy(pending, &(rx->msg.hdr), rx->off);
+            }
+            len += rx->off;
+            if(len + rx->len - rx->pos <= RX_BUFSIZE){
+                memcpy(pending + len, rx->buf + rx->pos, rx->len - rx->pos);
+                len += rx->len - rx->pos;
+                if(fn(fd, c->user, pending, len, arg) == 0) n++;
+            }
+        }
+        pthread_mutex_unlock(&c->lock);
+    }
+    return n;
+}
+
+/**
+ * @function connImport
+ * @brief Ripristina nel buffer di ricezione di una connessione appena
+ *        registrata con newConn i byte gia' letti da un altro processo
+ *
+ * @param fd       descrittore della connessione
+ * @param pending  byte letti e non consumati
+ * @param len      numero di byte (al piu' RX_BUFSIZE)
+ *
+ * @return 0 successo, -1 fallimento
+ */
+int connImport(long fd, const char *pending, size_t len){
+    if(len > RX_BUFSIZE){
+        errno = EINVAL;
+        return -1;
+    }
+    conn_t *c = connLock(fd);
+    if(c == NULL){
+        errno = EBADF;
+        return -1;
+    }
+    memcpy(c->rx.buf, pending, len);
+    c->rx.pos = 0;
+    c->rx.len = len;
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+/**
+ * @function connFileWriter
+ * @brief Affida la scrittura su disco del contenuto dei file ricevuti a
+ *        writer, a blocchi di FILE_CHUNK byte: mentre un blocco e' in scrittura
+ *        la connessione non e' del reactor ne' di un worker ma di chi completa
+ *        la scrittura. Senza writer i blocchi li scrive un worker con
+ *        connWriteChunk. Va chiamata prima di avviare i reactor
+ *
+ * @param writer  scrittore dei blocchi, NULL per farli scrivere ai worker
+ */
+void connFileWriter(file_writer_t writer){
+    file_writer = writer;
+}
+
+/**
+ *  @struct rx_chunk
+ *  @brief Blocco di file staccato dalla connessione da affidare allo scrittore
+ */
+typedef struct {
+    int    file_fd;
+    char  *buf;
+    size_t len;
+    int    last;
+} rx_chunk_t;
+
+/**
+ * @function rxTake
+ * @brief Stacca dalla connessione il blocco di file pronto (m.e. presa): il
+ *        blocco e, se e' l'ultimo, il file passano al chiamante, che li
+ *        affida allo scrittore con rxSubmit dopo aver rilasciato la m.e.
+ */
+static void rxTake(conn_t *c, rx_chunk_t *ch){
+    conn_rx_t *rx = &(c->rx);
+    ch->file_fd = rx->file_fd;
+    ch->buf     = rx->fbuf;
+    ch->len     = rx->flen;
+    ch->last    = rx->off == rx->file.len;
+    rx->fbuf  = NULL;
+    rx->flen  = 0;
+    rx->fwait = 2;
+    if(ch->last) rx->file_fd = -1;
+}
+
+/**
+ * @function rxSubmit
+ * @brief Affida allo scrittore il blocco staccato con rxTake, senza m.e.:
+ *        lo scrittore puo' bloccarsi (es. coda del pool di I/O piena) e con
+ *        la m.e. presa fermerebbe reactor e worker che consegnano alla connessione
+ *
+ * @return 0 successo, -1 errore
+ */
+static int rxSubmit(long fd, rx_chunk_t *ch){
+    return file_writer(fd, ch->file_fd, ch->buf, ch->len, ch->last);
+}
+
+/**
+ * @function fileWritten
+ * @brief Completamento della scrittura di un blocco affidata allo scrittore:
+ *        la ricezione del file potra' proseguire con recvMsg
+ *
+ * @param fd     descrittore della connessione
+ * @param err    errno della scrittura, 0 successo
+ *
+ * @return 0 successo, -1 la connessione va chiusa
+ */
+int fileWritten(long fd, int err){
+    int ret = -1;
+    conn_t *c = connLock(fd);
+    if(c != NULL){
+        c->rx.fwait = 0;
+        if(err == 0) ret = 0;
+        pthread_mutex_unlock(&c->lock);
+    }
+    if(err != 0){
+        errno = err;
+        perror("write");
+    }
+    return ret;
+}
+
+/**
+ * @function connWriteChunk
+ * @brief Senza scrittore asincrono scrive nel chiamante, un worker, il blocco
+ *        di file su cui si e' fermata la ricezione. La ricezione prosegue
+ *        poi con recvMsg
+ *
+ * @param fd     descrittore della connessione
+ *
+ * @return 1 blocco scritto, 0 nessun blocco da scrivere, -1 errore
+ */
+int connWriteChunk(long fd){
+    rx_chunk_t ch;
+    conn_t *c = connLock(fd);
+    if(c == NULL) return -1;
+    if(c->rx.fwait != 1){
+        pthread_mutex_unlock(&c->lock);
+        return 0;
+    }
+    rxTake(c, &ch);
+    pthread_mutex_unlock(&c->lock);
+
+    int err = 0;
+    if(writen(ch.file_fd, ch.buf, ch.len) <= 0) err = errno != 0 ? errno : EIO;
+    free(ch.buf);
+    if(ch.last) close(ch.file_fd);
+    return fileWritten(fd, err) == 0 ? 1 : -1;
+}
+
+/**
+ * @function connReadBatch
+ * @brief Con una sola io_uring_enter legge nel buffer di ricezione di ogni
+ *        connessione notificata in lettura, al posto delle read che recvMsg
+ *        farebbe una per connessione. Va chiamata dal reactor prima di connEvent
+ *
+ * @param ring     io_uring del reactor
+ * @param events   eventi restituiti da epoll_wait
+ * @param n        numero di eventi
+ *
+ * @return numero di letture sottomesse, -1 errore (le letture sottomesse sono
+ *         comunque completate, le altre connessioni useranno read)
+ */
+int connReadBatch(uring_t *ring, struct epoll_event *events, int n){
+    unsigned nsub = 0;
+    for(int i = 0; i < n; i++){
+        long fd = events[i].data.fd;
+        if(fd < 0 || fd >= nconns || !(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) continue;
+        conn_t *c = connLock(fd);
+        if(c == NULL) continue;
+        // Il socket e' di nuovo leggibile, un EAGAIN di un batch precedente non vale piu'
+        if(c->want_in && c->rx.pend_err == EAGAIN) c->rx.pend_err = 0;
+        // Solo le connessioni possedute dal reactor con il buffer gia' consumato
+        int ok = c->want_in && c->rx.state != RX_DONE && c->rx.pos == c->rx.len 
+                 && !c->rx.eof && !c->rx.pend_err;
+        pthread_mutex_unlock(&c->lock);
+        if(!ok) continue;
+
+        struct io_uring_sqe *sqe = uringGetSqe(ring);
+        if(sqe == NULL) break;
+        sqe->opcode    = IORING_OP_READ;
+        sqe->fd        = (int)fd;
+        sqe->addr      = (unsigned long) c->rx.buf;
+        sqe->len       = RX_BUFSIZE;
+        sqe->user_data = fd;
+        nsub++;
+    }
+    if(nsub == 0) return 0;
+
+    // Sottomissione e attesa di tutte le letture con una system call
+    int ret = uringSubmit(ring, nsub) == -1 ? -1 : (int)nsub;
+    // Anche dopo un errore attendo tutte le letture in volo, che scrivono in
+    // rx.buf: quelle non sottomesse restano alla read di recvMsg
+    while(ring->inflight > 0){
+        struct io_uring_cqe cqe;
+        if(!uringReap(ring, &cqe)){
+            uringWait(ring);
+            continue;
+        }
+        // Il reactor possiede la connessione, nessuno puo' averla chiusa
+        conn_rx_t *rx = &(connGet(cqe.user_data)->rx);
+        if(cqe.res > 0){
+            rx->pos = 0;
+            rx->len = cqe.res;
+            rx->nbytes += cqe.res;
+            // Lettura corta: il socket e' vuoto, la prossima read darebbe EAGAIN
+            if(cqe.res < RX_BUFSIZE) rx->pend_err = EAGAIN;
+        }
+        else if(cqe.res == 0) rx->eof = 1;
+        else rx->pend_err = -cqe.res;
+    }
+    return ret;
+}
+
+/**
+ * @function connEvent
+ * @brief Gestisce un evento epoll della connessione nel reactor: svuota la coda
+ *        di uscita se il socket e' scrivibile e avanza la ricezione della
+ *        richiesta se il reactor la possiede. Infine riarma la connessione
+ *
+ * @param fd       descrittore della connessione
+ * @param events   eventi notificati da epoll_wait
+ *
+ * @return 1 richiesta completa (la connessione passa al worker), 0 nessuna
+ *         richiesta completa, -1 la connessione va chiusa
+ */
+int connEvent(long fd, uint32_t events){
+    int ret = 0, want_in;
+    unsigned long gen;
+
+    conn_t *c = connLock(fd);
+    if(c == NULL) return 0;
+    gen = c->gen;
+    // L'EPOLLONESHOT ha disarmato l'fd
+    c->in_event = 1;
+    c->armed = 0;
+    if(c->tx_head != NULL && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))){
+        if(txFlush(c, fd) == -1) c->dead = 1;
+    }
+    want_in = c->want_in;
+    pthread_mutex_unlock(&c->lock);
+
+    // Se la connessione e' servita da un worker sara' lui a chiuderla
+    if(want_in){
+        if(c->dead) return -1;
+        if(events & (EPOLLIN | EPOLLERR | EPOLLHUP)){
+            int r = recvMsg(fd);
+            if(r > 0) ret = 1;
+            else if(r == 0 || errno != EAGAIN) return -1;
+        }
+    }
+
+    rx_chunk_t ch;
+    int chunk = 0;
+    pthread_mutex_lock(&c->lock);
+    if(!c->open || c->gen != gen){
+        // Chiusa da un worker mentre la mutex era libera (e magari l'fd e'
+        // gia' di una nuova connessione): non c'e' piu' nulla da armare
+        pthread_mutex_unlock(&c->lock);
+        return 0;
+    }
+    c->in_event = 0;
+    if(ret == 1) c->want_in = 0;
+    else if(want_in && c->rx.fwait == 1){
+        // Blocco di file pronto: la connessione passa allo scrittore
+        c->want_in = 0;
+        rxTake(c, &ch);
+        chunk = 1;
+    }
+    txArm(c, fd);
+    pthread_mutex_unlock(&c->lock);
+    if(chunk && rxSubmit(fd, &ch) == -1) ret = -1;
+    return ret;
+}
+
+/**
+ * @function connRearm
+ * @brief Restituisce la connessione al reactor al termine di una richiesta.
+ *        Se la ricezione si e' fermata su un blocco di file da scrivere, la
+ *        connessione passa invece allo scrittore asincrono
+ *
+ * @param fd     descrittore della connessione
+ *
+ * @return 0 successo, -1 la connessione va chiusa
+ */
+int connRearm(long fd){
+    int ret = 0, chunk = 0;
+    rx_chunk_t ch;
+    conn_t *c = connLock(fd);
+    if(c == NULL) return -1;
+    if(c->dead){
+        ret = -1;
+    }else if(c->rx.fwait == 1){
+        // Blocco di file pronto: la connessione passa allo scrittore
+        rxTake(c, &ch);
+        chunk = 1;
+    }else{
+        c->want_in = 1;
+        txArm(c, fd);
+    }
+    pthread_mutex_unlock(&c->lock);
+    if(chunk) ret = rxSubmit(fd, &ch);
+    return ret;
+}
+
+/**
+ * @function deliverMsg
+ * @brief Consegna un messaggio ad una connessione diversa da quella servita:
+ *        il messaggio viene inviato se il socket e' libero, altrimenti accodato
+ *        senza mai bloccare il chiamante
+ *
+ * @param fd     descrittore della connessione destinataria
+ * @param msg    puntatore al messaggio da consegnare
+ *
+ * @return >0 successo, -1 errore (errno == ENOBUFS se la coda e' piena)
+ */
+int deliverMsg(long fd, message_t *msg){
+    if(fd < 0 || fd >= nconns){
+        errno = EINVAL;
+        return -1;
+    }
+    conn_t *c = connLock(fd);
+    if(c == NULL){
+        errno = EBADF;
+        return -1;
+    }
+    int r = txSend(c, fd, &(msg->hdr), &(msg->data), 1, -1);
+    pthread_mutex_unlock(&c->lock);
+    return r;
+}
+
+/**
+ * @function deliverBatch
+ * @brief Consegna msg a piu' connessioni come n deliverMsg. Con ring, le
+ *        connessioni con la mutex libera e la coda di uscita vuota ricevono
+ *        msg con una sola io_uring_enter ogni TX_GATHER: gli invii non
+ *        bloccano (MSG_DONTWAIT) e l'eventuale resto viene accodato. Le altre
+ *        passano per deliverMsg
+ *
+ * @param ring   io_uring del chiamante, NULL per usare solo deliverMsg
+ * @param fds    connessioni destinatarie
+ * @param n      numero di connessioni
+ * @param msg    messaggio da consegnare
+ * @param res    esito di ogni consegna, come deliverMsg
+ *
+ * @return 0 successo, -1 io_uring non utilizzabile (le consegne sono
+ *         comunque avvenute con deliverMsg, il ring va distrutto)
+ */
+int deliverBatch(uring_t *ring, long *fds, int n, message_t *msg, int *res){
+    struct iovec iov[3];
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(struct msghdr));
+    mh.msg_iov    = iov;
+    mh.msg_iovlen = msgIov(iov, &(msg->hdr), &(msg->data.hdr), msg->data.buf);
+    size_t size   = MSG_SIZE(msg);
+    int ret = 0;
+
+    for(int base = 0; base < n; base += TX_GATHER){
+        conn_t *held[TX_GATHER];
+        int m = n - base < TX_GATHER ? n - base : TX_GATHER;
+        unsigned nsub = 0;
+        for(int j = 0; j < m; j++){
+            long fd = fds[base + j];
+            conn_t *c = ring != NULL ? connGet(fd) : NULL;
+            held[j] = NULL;
+            res[base + j] = 0;
+            // Tengo piu' mutex insieme: solo quelle libere, senza mai attendere
+            if(c == NULL || pthread_mutex_trylock(&c->lock) != 0) continue;
+            struct io_uring_sqe *sqe = NULL;
+            if(!c->open || c->dead || c->tx_head != NULL || (sqe = uringGetSqe(ring)) == NULL){
+                pthread_mutex_unlock(&c->lock);
+                continue;
+            }
+            sqe->opcode    = IORING_OP_SENDMSG;
+            sqe->fd        = (int)fd;
+            sqe->addr      = (unsigned long) &mh;
+            sqe->len       = 1;
+            sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+            sqe->user_data = j;
+            held[j] = c;
+            nsub++;
+        }
+
+        // Sottomissione e attesa di tutti gli invii con una system call
+        if(nsub > 0 && uringSubmit(ring, nsub) == -1) ret = -1;
+        while(ring != NULL && ring->inflight > 0){
+            struct io_uring_cqe cqe;
+            if(!uringReap(ring, &cqe)){
+                // Gli invii in volo usano le connessioni di cui ho la mutex:
+                // li attendo bloccandomi
+                uringWait(ring);
+                continue;
+            }
+            long fd = fds[base + cqe.user_data];
+            conn_t *c = held[cqe.user_data];
+            int *r = &res[base + cqe.user_data];
+            if(cqe.res >= 0 || cqe.res == -EAGAIN){
+                // Socket pieno: il resto parte con il reactor
+                size_t sent = cqe.res > 0 ? cqe.res : 0;
+                c->tx_bytes += sent;
+                *r = 1;
+                if(sent < size){
+                    out_msg_t om;
+                    txMsg(&om, &(msg->hdr), &(msg->data), -1);
+                    om.off = sent;
+                    if(txQueue(c, &om) == -1) *r = -1;
+                    else txArm(c, fd);
+                }
+            }else{
+                c->dead = 1;
+                errno = -cqe.res;
+                *r = -1;
+            }
+        }
+        // Gli invii non sottomessi (res 0) passano per deliverMsg
+        if(ret == -1) ring = NULL;
+        for(int j = 0; j < m; j++){
+            if(held[j] != NULL) pthread_mutex_unlock(&held[j]->lock);
+            if(res[base + j] == 0) res[base + j] = deliverMsg(fds[base + j], msg);
+        }
+    }
+    return ret;
+}
+
+/**
+ * @function sendMsgs
+ * @brief Invia n messaggi come n sendRequest, ma sulle connessioni del server
+ *        con una writev ogni TX_GATHER messaggi
+ *
+ * @param fd     descrittore della connessione
+ * @param msgs   messaggi da inviare
+ * @param n      numero di messaggi
+ *
+ * @return <=0 se c'e' stato un errore
+ */
+int sendMsgs(long fd, message_t **msgs, int n){
+    conn_t *c = flag ? connLock(fd) : NULL;
+    if(c != NULL){
+        int r = txSendMany(c, fd, msgs, n);
+        pthread_mutex_unlock(&c->lock);
+        return r;
+    }
+    for(int i = 0; i < n; i++){
+        int r = sendRequest(fd, msgs[i]);
+        if(r <= 0) return r;
+    }
+    return 1;
+}
+
+/**
+ * @function rxRead
+ * @brief Singola read non bloccante, ripetuta solo se interrotta da un segnale.
+ *        Se una lettura in batch ha gia' svuotato il socket ne restituisce l'esito
+ *        senza system call
+ *
+ * @return >0 byte letti, 0 connessione chiusa, -1 errore (EAGAIN se non ci sono dati)
+ */
+static inline int rxRead(long fd, conn_rx_t *rx, char *buf, size_t size){
+    int r;
+    if(rx->eof) return 0;
+    if(rx->pend_err){
+        errno = rx->pend_err;
+        rx->pend_err = 0;
+        return -1;
+    }
+    while((r = read((int)fd, buf, size)) == -1 && errno == EINTR);
+    if(r > 0) rx->nbytes += r;
+    return r;
+}
+
+/**
+ * @function rxFill
+ * @brief Copia in dst al piu' size byte, prima dal buffer della connessione e,
+ *        se vuoto, dal socket
+ *
+ * @return >0 byte copiati, 0 connessione chiusa, -1 errore (EAGAIN se non ci sono dati)
+ */
+static int rxFill(long fd, conn_rx_t *rx, char *dst, size_t size){
+    if(rx->pos == rx->len){
+        // Buffer vuoto: le parti grandi le leggo direttamente nella destinazione
+        if(size >= RX_BUFSIZE) return rxRead(fd, rx, dst, size);
+        int r = rxRead(fd, rx, rx->buf, RX_BUFSIZE);
+        if(r <= 0) return r;
+        rx->pos = 0;
+        rx->len = r;
+    }
+    size_t n = rx->len - rx->pos;
+    if(n > size) n = size;
+    memcpy(dst, rx->buf + rx->pos, n);
+    rx->pos += n;
+    return n;
+}
+
+/**
+ * @function rxPart
+ * @brief Riceve la parte corrente della richiesta (size byte in dst) riprendendo
+ *        da dove si era fermata la chiamata precedente
+ *
+ * @return 1 parte completa, 0 connessione chiusa, -1 errore (EAGAIN se incompleta)
+ */
+static int rxPart(long fd, conn_rx_t *rx, void *dst, size_t size){
+    while(rx->off < size){
+        int r = rxFill(fd, rx, (char *)dst + rx->off, size - rx->off);
+        if(r <= 0) return r;
+        rx->off += r;
+    }
+    rx->off = 0;
+    return 1;
+}
+
+/**
+ * @function rxFile
+ * @brief Riceve il contenuto del file in blocchi di FILE_CHUNK byte e si
+ *        ferma su ognuno finche' non e' stato scritto: dallo scrittore
+ *        asincrono (vedi connFileWriter) o, senza, da un worker con
+ *        connWriteChunk. Il reactor non scrive mai su disco. Senza file di
+ *        destinazione il contenuto viene scartato
+ *
+ * @return 1 contenuto completo, 2 blocco da scrivere in un worker,
+ *         0 connessione chiusa, -1 errore (EAGAIN se incompleto)
+ */
+static int rxFile(long fd, conn_rx_t *rx){
+    if(rx->fwait){
+        errno = EAGAIN;
+        return -1;
+    }
+    while(rx->off < rx->file.len){
+        size_t n;
+        if(rx->file_fd >= 0){
+            if(rx->fbuf == NULL && (rx->fbuf = malloc(FILE_CHUNK)) == NULL) return -1;
+            n = FILE_CHUNK - rx->flen;
+            if(n > rx->file.len - rx->off) n = rx->file.len - rx->off;
+            if(rx->pos < rx->len){
+                // Prima i byte gia' letti insieme all'header
+                if(n > rx->len - rx->pos) n = rx->len - rx->pos;
+                memcpy(rx->fbuf + rx->flen, rx->buf + rx->pos, n);
+                rx->pos += n;
+            }else{
+                int r = rxRead(fd, rx, rx->fbuf + rx->flen, n);
+                if(r <= 0) return r;
+                n = r;
+            }
+            rx->flen += n;
+            rx->off  += n;
+            if(rx->flen == FILE_CHUNK || rx->off == rx->file.len){
+                // Blocco pieno: la ricezione riprende quando e' stato scritto
+                rx->fwait = 1;
+                if(file_writer == NULL) return 2;
+                errno = EAGAIN;
+                return -1;
+            }
+            continue;
+        }
+
+        if(rx->pos == rx->len){
+            int r = rxRead(fd, rx, rx->buf, RX_BUFSIZE);
+            if(r <= 0) return r;
+            rx->pos = 0;
+            rx->len = r;
+        }
+        n = rx->len - rx->pos;
+        if(n > rx->file.len - rx->off) n = rx->file.len - rx->off;
+        rx->pos += n;
+        rx->off += n;
+    }
+    rx->off = 0;
+    // File vuoto: nessun blocco lo ha chiuso
+    if(rx->file_fd >= 0){
+        close(rx->file_fd);
+        rx->file_fd = -1;
+    }
+    return 1;
+}
+
+/**
+ * @function recvMsg
+ * @brief Avanza la ricezione non bloccante della richiesta sulla connessione,
+ *        consumando prima i byte gia' bufferizzati
+ *
+ * @param fd     descrittore della connessione
+ *
+ * @return >0 richiesta completa o, senza scrittore asincrono, blocco di file
+ *         da scrivere con connWriteChunk, 0 connessione chiusa, 
+ *         <0 errore (errno == EAGAIN se la richiesta non e' ancora completa)
+ */
+int recvMsg(long fd){
+    conn_t *c = connGet(fd);
+    if(c == NULL || !c->open){
+        errno = EINVAL;
+        return -1;
+    }
+    conn_rx_t *rx = &(c->rx);
+    int r;
+
+    while(1){
+        switch(rx->state){
+            case RX_HDR:{
+                if((r = rxPart(fd, rx, &(rx->msg.hdr), sizeof(message_hdr_t))) <= 0) return r;
+                rx->state = RX_DATA_HDR;
+                break;
+            }
+            case RX_DATA_HDR:{
+                if((r = rxPart(fd, rx, &(rx->msg.data.hdr), sizeof(message_data_hdr_t))) <= 0) return r;
+                rx->msg.data.buf = NULL;
+                if(rx->msg.data.hdr.len == 0){ // Buffer vuoto
+                    rx->state = (rx->msg.hdr.op == POSTFILE_OP) ? RX_FILE_HDR : RX_DONE;
+                }else{
+                    rx->msg.data.buf = calloc(rx->msg.data.hdr.len, sizeof(char));
+                    if(rx->msg.data.buf == NULL) return -1;
+                    rx->state = RX_DATA_BUF;
+                }
+                break;
+            }
+            case RX_DATA_BUF:{
+                if((r = rxPart(fd, rx, rx->msg.data.buf, rx->msg.data.hdr.len)) <= 0) return r;
+                rx->state = (rx->msg.hdr.op == POSTFILE_OP) ? RX_FILE_HDR : RX_DONE;
+                break;
+            }
+            case RX_FILE_HDR:{
+                if((r = rxPart(fd, rx, &(rx->file), sizeof(message_data_hdr_t))) <= 0) return r;
+                // Il contenuto resta sul socket finche' il worker non ha
+                // controllato la dimensione e scelto dove scriverlo (recvFile)
+                rx->file_st = 1;
+                rx->state = RX_DONE;
+                break;
+            }
+            case RX_FILE_BODY:{
+                if((r = rxFile(fd, rx)) <= 0) return r;
+                // Blocco da scrivere: la connessione passa ad un worker
+                if(r == 2) return 1;
+                rx->file_st = 2;
+                rx->state = RX_DONE;
+                break;
+            }
+            case RX_DONE:{
+                return 1;
+            }
+        }
+    }
+}
+
+/**
+ * @function takeMsg
+ * @brief Estrae la richiesta completa ricevuta sulla connessione e prepara
+ *        la ricezione della successiva
+ *
+ * @param fd     descrittore della connessione
+ * @param msg    puntatore dove copiare la richiesta
+ *
+ * @return 1 successo, -1 nessuna richiesta completa
+ */
+int takeMsg(long fd, message_t *msg){
+    conn_t *c = connGet(fd);
+    if(c == NULL || !c->open || c->rx.state != RX_DONE){
+        errno = EINVAL;
+        return -1;
+    }
+    conn_rx_t *rx = &(c->rx);
+    *msg = rx->msg;
+    memset(&(rx->msg), 0, sizeof(message_t));
+    rx->state = RX_HDR;
+    return 1;
+}
+
+/**
+ * @function connOp
+ * @brief Operazione della richiesta completa ricevuta sulla connessione,
+ *        senza estrarla (il reactor la usa per scegliere la corsia dello scheduler).
+ *        Durante la ricezione del contenuto di un file e' POSTFILE_OP
+ *
+ * @param fd     descrittore della connessione
+ *
+ * @return operazione richiesta, -1 nessuna richiesta completa
+ */
+int connOp(long fd){
+    conn_t *c = connGet(fd);
+    if(c == NULL || !c->open || (c->rx.state != RX_DONE && c->rx.state != RX_FILE_BODY)) return -1;
+    return c->rx.msg.hdr.op;
+}
+
+/**
+ * @function takeFile
+ * @brief Estrae l'header del file dell'ultima POSTFILE_OP. Il contenuto non
+ *        viene mai tenuto in memoria: dopo il primo header il chiamante decide
+ *        con recvFile dove scriverlo, e la richiesta torna ad un worker
+ *        quando il contenuto e' stato ricevuto per intero
+ *
+ * @param fd     descrittore della connessione
+ * @param hdr    puntatore dove copiare l'header del file
+ *
+ * @return 1 header ricevuto (contenuto ancora sul socket), 
+ *         2 contenuto ricevuto, -1 nessun file ricevuto
+ */
+int takeFile(long fd, message_data_hdr_t *hdr){
+    conn_t *c = connGet(fd);
+    if(c == NULL || !c->open || c->rx.file_st == 0){
+        errno = EINVAL;
+        return -1;
+    }
+    conn_rx_t *rx = &(c->rx);
+    int st = rx->file_st;
+    *hdr = rx->file;
+    rx->file_st = 0;
+    return st;
+}
+
+/**
+ * @function recvFile
+ * @brief Fa ricevere alla connessione il contenuto del file della richiesta
+ *        POSTFILE_OP msg e lo scrive in file_fd, in blocchi di FILE_CHUNK byte:
+ *        con lo scrittore asincrono (connFileWriter) i blocchi vengono affidati
+ *        allo scrittore, senza li scrive un worker con connWriteChunk, mai il
+ *        reactor. La ricezione prosegue con recvMsg, che restituisce di nuovo
+ *        msg quando l'intero contenuto e' stato scritto
+ *
+ * @param fd       descrittore della connessione
+ * @param msg      richiesta POSTFILE_OP estratta con takeMsg (viene copiata)
+ * @param file_fd  file di destinazione, chiuso a fine ricezione. -1 per scartare il contenuto
+ *
+ * @return 1 successo, -1 errore
+ */
+int recvFile(long fd, message_t *msg, int file_fd){
+    conn_t *c = connGet(fd);
+    if(c == NULL || !c->open || c->rx.state != RX_HDR){
+        errno = EINVAL;
+        if(file_fd >= 0) close(file_fd);
+        return -1;
+    }
+    conn_rx_t *rx = &(c->rx);
+    // La richiesta torna al worker a ricezione completata
+    rx->msg = *msg;
+    rx->msg.data.buf = NULL;
+    if(msg->data.hdr.len > 0){
+        rx->msg.data.buf = malloc(msg->data.hdr.len);
+        if(rx->msg.data.buf == NULL){
+            if(file_fd >= 0) close(file_fd);
+            return -1;
+        }
+        memcpy(rx->msg.data.buf, msg->data.buf, msg->data.hdr.len);
+    }
+    rx->file_fd = file_fd;
+    rx->off     = 0;
+    rx->state   = RX_FILE_BODY;
+    return 1;
 }
 
 /**
@@ -188,16 +1536,11 @@ int readData(long fd, message_data_t *data){
  *         (se <0 errno deve essere settato, se == 0 connessione chiusa) 
  */
 int readMsg(long fd, message_t *msg){
-    int ind = fd % NSECTIONS;        //Calcolo indice mutex
-    if(flag) pthread_mutex_lock(&mtx_conn[ind]);
+    conn_t *c = flag ? connLock(fd) : NULL;
     memset(msg, 0, sizeof(message_t));
     int r = readHeader(fd, &(msg->hdr));
-    if(r <= 0){
-        if(flag) pthread_mutex_unlock(&mtx_conn[ind]);
-        return r;
-    } 
-    r = readData(fd, &(msg->data)); 
-    if(flag) pthread_mutex_unlock(&mtx_conn[ind]);
+    if(r > 0) r = readData(fd, &(msg->data)); 
+    if(c != NULL) pthread_mutex_unlock(&c->lock);
     return r;
 }
 
@@ -226,10 +1569,11 @@ int sendHeader(long fd, message_hdr_t *hdr){
  *         (se <0 errno deve essere settato, se == 0 connessione chiusa) 
  */
 int sendAck(long fd, message_hdr_t *hdr){
-    int ind = fd % NSECTIONS;
-    if(flag) pthread_mutex_lock(&mtx_conn[ind]);
-    int r = writen(fd, hdr, sizeof(message_hdr_t));
-    if(flag) pthread_mutex_unlock(&mtx_conn[ind]);
+    // Connessione registrata dal server: risposta tramite coda di uscita
+    conn_t *c = flag ? connLock(fd) : NULL;
+    if(c == NULL) return writen(fd, hdr, sizeof(message_hdr_t));
+    int r = txSend(c, fd, hdr, NULL, 0, -1);
+    pthread_mutex_unlock(&c->lock);
     return r;
 }
 
@@ -243,11 +1587,12 @@ int sendAck(long fd, message_hdr_t *hdr){
  * @return <=0 se c'e' stato un errore
  */
 int sendData(long fd, message_data_t *msg) {
-    int r1 = writen(fd, &(msg->hdr), sizeof(message_data_hdr_t));
-    if(r1 <= 0) return r1;
-    int r2 = writen(fd, msg->buf, msg->hdr.len);
-    if(r2 <= 0) return r2;
-    return r1 + r2;
+    struct iovec iov[2];
+    iov[0].iov_base = &(msg->hdr);
+    iov[0].iov_len  = sizeof(message_data_hdr_t);
+    iov[1].iov_base = msg->buf;
+    iov[1].iov_len  = msg->hdr.len;
+    return writevn(fd, iov, 2);
 }
 
 /**
@@ -260,20 +1605,45 @@ int sendData(long fd, message_data_t *msg) {
  * @return <=0 se c'e' stato un errore
  */
 int sendRequest(long fd, message_t *msg){
-    int ind = fd % NSECTIONS;
-    if(flag) pthread_mutex_lock(&mtx_conn[ind]);
-    int r1 = sendHeader(fd, &(msg->hdr));
-    if(r1 <= 0){
-        if(flag) pthread_mutex_unlock(&mtx_conn[ind]);
-        return r1;
-    } 
-    int r2 = sendData(fd, &(msg->data));
-    if(r2 <= 0){
-        if(flag) pthread_mutex_unlock(&mtx_conn[ind]);
-        return r2;
-    } 
-    if(flag) pthread_mutex_unlock(&mtx_conn[ind]);
-    return r1 + r2;
+    // Connessione registrata dal server: risposta tramite coda di uscita
+    conn_t *c = flag ? connLock(fd) : NULL;
+    if(c != NULL){
+        int r = txSend(c, fd, &(msg->hdr), &(msg->data), 0, -1);
+        pthread_mutex_unlock(&c->lock);
+        return r;
+    }
+    // Header, header dati e buffer con una sola writev
+    struct iovec iov[3];
+    int cnt = msgIov(iov, &(msg->hdr), &(msg->data.hdr), msg->data.buf);
+    return writevn(fd, iov, cnt);
+}
+
+/**
+ * @function sendFile
+ * @brief Invia un messaggio il cui buffer dati e' il contenuto di un file: gli
+ *        header vengono scritti con una writev e il file con sendfile, senza
+ *        copiarlo in memoria. Sulle connessioni del server passa per la coda di uscita
+ *
+ * @param fd       descrittore della connessione
+ * @param msg      messaggio da inviare (data.hdr.len e' la dimensione del file, data.buf non usato)
+ * @param file_fd  descrittore del file aperto in lettura, chiuso dalla funzione
+ *
+ * @return <=0 se c'e' stato un errore
+ */
+int sendFile(long fd, message_t *msg, int file_fd){
+    // Connessione registrata dal server: il file resta aperto nella coda di uscita
+    conn_t *c = flag ? connLock(fd) : NULL;
+    if(c != NULL){
+        int r = txSend(c, fd, &(msg->hdr), &(msg->data), 0, file_fd);
+        pthread_mutex_unlock(&c->lock);
+        return r;
+    }
+    struct iovec iov[3];
+    msgIov(iov, &(msg->hdr), &(msg->data.hdr), NULL);
+    int r = writevn(fd, iov, 2);
+    if(r > 0) r = sendfilen(fd, file_fd, msg->data.hdr.len);
+    close(file_fd);
+    return r;
 }
 
 /**
@@ -13,8 +13,19 @@
 #if !defined(UNIX_PATH_MAX)
 #define UNIX_PATH_MAX  64
 #endif
+#define RX_BUFSIZE     4096     // Byte letti dal socket per ogni read non bloccante
+#define TX_MAXMSGS     256      // Messaggi massimi nella coda di uscita di una connessione
+#define TX_GATHER      32       // Messaggi inviati con una sola writev o io_uring_enter
+#define FILE_CHUNK     65536    // Byte del contenuto di un file affidati ad ogni scrittura asincrona
+#define TX_FILE_CHUNK  65536    // Byte di un file inviati con sendfile ad ogni svuotamento della coda di uscita
 
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <message.h>
+#include "uring.h"
+
+struct epoll_event;
 
 /**
  * @file  connection.h
@@ -27,9 +38,134 @@
  */
 
 
+/**
+ *  @enum rx_state
+ *  @brief Parte della richiesta che il server sta ricevendo su una connessione
+ */
+typedef enum {
+    RX_HDR,          // header del messaggio
+    RX_DATA_HDR,     // header della parte dati
+    RX_DATA_BUF,     // buffer della parte dati
+    RX_FILE_HDR,     // header del contenuto del file (solo POSTFILE_OP)
+    RX_FILE_BODY,    // contenuto del file, scritto su disco a blocchi (solo POSTFILE_OP)
+    RX_DONE          // richiesta completa, pronta per un worker
+} rx_state_t;
+
+/**
+ *  @struct conn_rx
+ *  @brief Stato di ricezione di una connessione lato server
+ *
+ *  @var state      parte della richiesta in ricezione
+ *  @var off        byte gia' ricevuti della parte corrente
+ *  @var msg        richiesta in costruzione
+ *  @var file       header del contenuto del file di una POSTFILE_OP
+ *  @var file_fd    file di destinazione del contenuto, -1 per scartarlo
+ *  @var file_st    0 nessun file, 1 header del file ricevuto, 2 contenuto ricevuto
+ *  @var buf        byte letti dal socket e non ancora consumati
+ *  @var pos        primo byte non consumato di buf
+ *  @var len        byte validi in buf
+ *  @var eof        1 se una lettura in batch (io_uring) ha trovato la connessione chiusa
+ *  @var pend_err   errno di una lettura in batch da restituire alla prossima lettura
+ *                  (EAGAIN se il socket e' stato svuotato)
+ *  @var fbuf       blocco del contenuto del file in attesa di essere scritto (vedi connFileWriter)
+ *  @var flen       byte validi in fbuf
+ *  @var fwait      0 nessuna scrittura, 1 fbuf pronto da affidare, 2 scrittura in corso
+ *  @var nbytes     byte ricevuti dal socket dall'apertura della connessione
+ */
+typedef struct {
+    rx_state_t     state;
+    size_t         off;
+    message_t      msg;
+    message_data_hdr_t file;
+    int            file_fd;
+    int            file_st;
+    char           buf[RX_BUFSIZE];
+    size_t         pos;
+    size_t         len;
+    int            eof;
+    int            pend_err;
+    char          *fbuf;
+    size_t         flen;
+    int            fwait;
+    unsigned long  nbytes;
+} conn_rx_t;
+
+/**
+ *  @struct out_msg
+ *  @brief Messaggio nella coda di uscita di una connessione
+ *
+ *  @var hdr        header del messaggio
+ *  @var dhdr       header della parte dati
+ *  @var buf        buffer dati (copia posseduta dal messaggio)
+ *  @var file_fd    file da cui inviare i dati con sendfile, -1 se i dati sono in buf
+ *  @var has_data   0 se il messaggio e' un ack composto dal solo header
+ *  @var size       byte totali da inviare
+ *  @var off        byte gia' inviati
+ *  @var next       messaggio successivo nella coda
+ */
+typedef struct out_msg {
+    message_hdr_t       hdr;
+    message_data_hdr_t  dhdr;
+    char               *buf;
+    int                 file_fd;
+    int                 has_data;
+    size_t              size;
+    size_t              off;
+    struct out_msg     *next;
+} out_msg_t;
+
+/**
+ *  @struct conn
+ *  @brief Connessione di un client lato server. L'elemento della tabella di
+ *        un fd viene allocato alla prima connessione con quel descrittore e
+ *        riusato dalle successive, quindi resta valido anche dopo la chiusura
+ *
+ *  @var lock       mutex della connessione: serializza scritture e cambi di stato
+ *  @var open       1 dalla newConn alla closeConn
+ *  @var gen        incrementato da ogni newConn: distingue le connessioni che
+ *                  riusano l'elemento dello stesso fd
+ *  @var rx         stato di ricezione della richiesta corrente
+ *  @var tx_head    testa della coda di uscita
+ *  @var tx_tail    coda della coda di uscita
+ *  @var tx_n       messaggi nella coda di uscita
+ *  @var epfd       epoll del reactor che possiede la connessione
+ *  @var armed      eventi armati nell'epoll (EPOLLONESHOT)
+ *  @var want_in    1 se il reactor attende richieste, 0 se un worker la sta servendo
+ *  @var in_event   1 mentre il reactor gestisce un evento della connessione
+ *  @var dead       errore in scrittura, la connessione va chiusa da chi la possiede
+ *  @var owner      reactor che possiede la connessione
+ *  @var user       ultimo utente connesso sulla connessione, "" se nessuno
+ *  @var tx_bytes   byte inviati sul socket dall'apertura della connessione
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    int        open;
+    unsigned long gen;
+    conn_rx_t  rx;
+    out_msg_t *tx_head;
+    out_msg_t *tx_tail;
+    int        tx_n;
+    int        epfd;
+    uint32_t   armed;
+    int        want_in;
+    int        in_event;
+    int        dead;
+    void      *owner;
+    char       user[MAX_NAME_LENGTH + 1];
+    unsigned long tx_bytes;
+} conn_t;
+
+/**
+ * @brief Scrittore asincrono dei blocchi del contenuto dei file (vedi connFileWriter).
+ *        Riceve il possesso di buf e, se last, di file_fd. Al termine deve
+ *        chiamare fileWritten e poi riprendere la connessione come un worker.
+ *        Viene chiamato senza la m.e. della connessione e puo' bloccarsi
+ */
+typedef int (*file_writer_t)(long fd, int file_fd, char *buf, size_t len, int last);
+
 /**
  * @function initConnection
- * @brief Inizializza le mutex e imposta un flag
+ * @brief Inizializza la tabella delle connessioni e imposta un flag
  * 
  * @return -1 errore, 0 successo
  */
@@ -42,6 +178,283 @@ int initConnection();
  */
 void destroyConnection();
 
+/**
+ * @function newConn
+ * @brief Registra una connessione accettata dal server: imposta il socket
+ *        non bloccante e alloca il suo stato. La connessione deve essere poi
+ *        aggiunta all'epoll con EPOLLIN | EPOLLONESHOT
+ *
+ * @param fd     descrittore della connessione
+ * @param epfd   epoll del reactor che possiede la connessione
+ * @param owner  reactor che possiede la connessione (vedi connOwner)
+ *
+ * @return 0 successo, -1 fallimento
+ */
+int newConn(long fd, int epfd, void *owner);
+
+/**
+ * @function connOwner
+ * @brief Reactor che possiede la connessione
+ *
+ * @param fd     descrittore della connessione
+ *
+ * @return owner passato a newConn, NULL se la connessione non esiste
+ */
+void *connOwner(long fd);
+
+/**
+ * @function connSetUser
+ * @brief Associa alla connessione l'utente che vi si e' connesso
+ *
+ * @param fd     descrittore della connessione
+ * @param name   nickname dell'utente, "" per nessuno
+ */
+void connSetUser(long fd, const char *name);
+
+/**
+ * @function connUser
+ * @brief Copia in name l'utente associato alla connessione con connSetUser
+ *
+ * @param fd     descrittore della connessione
+ * @param name   buffer di almeno MAX_NAME_LENGTH+1 caratteri
+ *
+ * @return 1 utente associato, 0 nessun utente o connessione inesistente
+ */
+int connUser(long fd, char *name);
+
+/**
+ * @function connStats
+ * @brief Byte ricevuti ed inviati sulla connessione dalla sua apertura
+ *
+ * @param fd     descrittore della connessione
+ * @param rx     dove copiare i byte ricevuti
+ * @param tx     dove copiare i byte inviati
+ *
+ * @return 0 successo, -1 connessione inesistente
+ */
+int connStats(long fd, unsigned long *rx, unsigned long *tx);
+
+/**
+ * @brief Riceve da connExport una connessione da passare ad un altro processo
+ *
+ * @return 0 successo, -1 la connessione non e' stata passata
+ */
+typedef int (*conn_export_t)(long fd, const char *user, const char *pending, size_t len, void *arg);
+
+/**
+ * @function connExport
+ * @brief Passa ad fn le connessioni aperte ferme tra due richieste, con
+ *        l'utente connesso ed i byte gia' letti dal socket e non ancora
+ *        consumati. Le altre (richiesta a meta', coda di uscita non vuota)
+ *        non sono trasferibili. Va chiamata a reactor e worker terminati
+ *
+ * @param fn     funzione chiamata per ogni connessione trasferibile
+ * @param arg    argomento di fn
+ *
+ * @return numero di connessioni passate con successo
+ */
+int connExport(conn_export_t fn, void *arg);
+
+/**
+ * @function connImport
+ * @brief Ripristina nel buffer di ricezione di una connessione appena
+ *        registrata con newConn i byte gia' letti da un altro processo
+ *
+ * @param fd       descrittore della connessione
+ * @param pending  byte letti e non consumati
+ * @param len      numero di byte (al piu' RX_BUFSIZE)
+ *
+ * @return 0 successo, -1 fallimento
+ */
+int connImport(long fd, const char *pending, size_t len);
+
+/**
+ * @function connFileWriter
+ * @brief Affida la scrittura su disco del contenuto dei file ricevuti a
+ *        writer, a blocchi di FILE_CHUNK byte: mentre un blocco e' in scrittura
+ *        la connessione non e' del reactor ne' di un worker ma di chi completa
+ *        la scrittura. Senza writer i blocchi li scrive un worker con
+ *        connWriteChunk. Va chiamata prima di avviare i reactor
+ *
+ * @param writer  scrittore dei blocchi, NULL per farli scrivere ai worker
+ */
+void connFileWriter(file_writer_t writer);
+
+/**
+ * @function fileWritten
+ * @brief Completamento della scrittura di un blocco affidata allo scrittore:
+ *        la ricezione del file potra' proseguire con recvMsg
+ *
+ * @param fd     descrittore della connessione
+ * @param err    errno della scrittura, 0 successo
+ *
+ * @return 0 successo, -1 la connessione va chiusa
+ */
+int fileWritten(long fd, int err);
+
+/**
+ * @function connWriteChunk
+ * @brief Senza scrittore asincrono scrive nel chiamante, un worker, il blocco
+ *        di file su cui si e' fermata la ricezione. La ricezione prosegue
+ *        poi con recvMsg
+ *
+ * @param fd     descrittore della connessione
+ *
+ * @return 1 blocco scritto, 0 nessun blocco da scrivere, -1 errore
+ */
+int connWriteChunk(long fd);
+
+/**
+ * @function closeConn
+ * @brief Tenta un ultimo invio non bloccante della coda di uscita, dealloca
+ *        lo stato della connessione e chiude il descrittore
+ *
+ * @param fd     descrittore della connessione
+ */
+void closeConn(long fd);
+
+/**
+ * @function connReadBatch
+ * @brief Con una sola io_uring_enter legge nel buffer di ricezione di ogni
+ *        connessione notificata in lettura, al posto delle read che recvMsg
+ *        farebbe una per connessione. Va chiamata dal reactor prima di connEvent
+ *
+ * @param ring     io_uring del reactor
+ * @param events   eventi restituiti da epoll_wait
+ * @param n        numero di eventi
+ *
+ * @return numero di letture sottomesse, -1 errore (le letture sottomesse sono
+ *         comunque completate, le altre connessioni useranno read)
+ */
+int connReadBatch(uring_t *ring, struct epoll_event *events, int n);
+
+/**
+ * @function connEvent
+ * @brief Gestisce un evento epoll della connessione nel reactor: svuota la coda
+ *        di uscita se il socket e' scrivibile e avanza la ricezione della
+ *        richiesta se il reactor la possiede. Infine riarma la connessione
+ *
+ * @param fd       descrittore della connessione
+ * @param events   eventi notificati da epoll_wait
+ *
+ * @return 1 richiesta completa (la connessione passa al worker), 0 nessuna
+ *         richiesta completa, -1 la connessione va chiusa
+ */
+int connEvent(long fd, uint32_t events);
+
+/**
+ * @function connRearm
+ * @brief Restituisce la connessione al reactor al termine di una richiesta.
+ *        Se la ricezione si e' fermata su un blocco di file da scrivere, la
+ *        connessione passa invece allo scrittore asincrono
+ *
+ * @param fd     descrittore della connessione
+ *
+ * @return 0 successo, -1 la connessione va chiusa
+ */
+int connRearm(long fd);
+
+/**
+ * @function deliverMsg
+ * @brief Consegna un messaggio ad una connessione diversa da quella servita:
+ *        il messaggio viene inviato se il socket e' libero, altrimenti accodato
+ *        senza mai bloccare il chiamante
+ *
+ * @param fd     descrittore della connessione destinataria
+ * @param msg    puntatore al messaggio da consegnare
+ *
+ * @return >0 successo, -1 errore (errno == ENOBUFS se la coda e' piena)
+ */
+int deliverMsg(long fd, message_t *msg);
+
+/**
+ * @function deliverBatch
+ * @brief Consegna msg a piu' connessioni come n deliverMsg. Con ring, le
+ *        connessioni con la mutex libera e la coda di uscita vuota ricevono
+ *        msg con una sola io_uring_enter ogni TX_GATHER: gli invii non
+ *        bloccano (MSG_DONTWAIT) e l'eventuale resto viene accodato. Le altre
+ *        passano per deliverMsg
+ *
+ * @param ring   io_uring del chiamante, NULL per usare solo deliverMsg
+ * @param fds    connessioni destinatarie
+ * @param n      numero di connessioni
+ * @param msg    messaggio da consegnare
+ * @param res    esito di ogni consegna, come deliverMsg
+ *
+ * @return 0 successo, -1 io_uring non utilizzabile (le consegne sono
+ *         comunque avvenute con deliverMsg, il ring va distrutto)
+ */
+int deliverBatch(uring_t *ring, long *fds, int n, message_t *msg, int *res);
+
+/**
+ * @function recvMsg
+ * @brief Avanza la ricezione non bloccante della richiesta sulla connessione,
+ *        consumando prima i byte gia' bufferizzati
+ *
+ * @param fd     descrittore della connessione
+ *
+ * @return >0 richiesta completa o, senza scrittore asincrono, blocco di file
+ *         da scrivere con connWriteChunk, 0 connessione chiusa, 
+ *         <0 errore (errno == EAGAIN se la richiesta non e' ancora completa)
+ */
+int recvMsg(long fd);
+
+/**
+ * @function takeMsg
+ * @brief Estrae la richiesta completa ricevuta sulla connessione e prepara
+ *        la ricezione della successiva
+ *
+ * @param fd     descrittore della connessione
+ * @param msg    puntatore dove copiare la richiesta
+ *
+ * @return 1 successo, -1 nessuna richiesta completa
+ */
+int takeMsg(long fd, message_t *msg);
+
+/**
+ * @function connOp
+ * @brief Operazione della richiesta completa ricevuta sulla connessione,
+ *        senza estrarla (il reactor la usa per scegliere la corsia dello scheduler).
+ *        Durante la ricezione del contenuto di un file e' POSTFILE_OP
+ *
+ * @param fd     descrittore della connessione
+ *
+ * @return operazione richiesta, -1 nessuna richiesta completa
+ */
+int connOp(long fd);
+
+/**
+ * @function takeFile
+ * @brief Estrae l'header del file dell'ultima POSTFILE_OP. Il contenuto non
+ *        viene mai tenuto in memoria: dopo il primo header il chiamante decide
+ *        con recvFile dove scriverlo, e la richiesta torna ad un worker
+ *        quando il contenuto e' stato ricevuto per intero
+ *
+ * @param fd     descrittore della connessione
+ * @param hdr    puntatore dove copiare l'header del file
+ *
+ * @return 1 header ricevuto (contenuto ancora sul socket), 
+ *         2 contenuto ricevuto, -1 nessun file ricevuto
+ */
+int takeFile(long fd, message_data_hdr_t *hdr);
+
+/**
+ * @function recvFile
+ * @brief Fa ricevere alla connessione il contenuto del file della richiesta
+ *        POSTFILE_OP msg e lo scrive in file_fd, in blocchi di FILE_CHUNK byte:
+ *        con lo scrittore asincrono (connFileWriter) i blocchi vengono affidati
+ *        allo scrittore, senza li scrive un worker con connWriteChunk, mai il
+ *        reactor. La ricezione prosegue con recvMsg, che restituisce di nuovo
+ *        msg quando l'intero contenuto e' stato scritto
+ *
+ * @param fd       descrittore della connessione
+ * @param msg      richiesta POSTFILE_OP estratta con takeMsg (viene copiata)
+ * @param file_fd  file di destinazione, chiuso a fine ricezione. -1 per scartare il contenuto
+ *
+ * @return 1 successo, -1 errore
+ */
+int recvFile(long fd, message_t *msg, int file_fd);
+
 /**
  * @function openConnection
  * @brief Apre una connessione AF_UNIX verso il server 
@@ -104,8 +517,9 @@ int readMsg(long fd, message_t *msg);
 int sendHeader(long fd, message_hdr_t *hdr);
 
 /**
- * @function sendHeader
- * @brief Invia l'header del messaggio in mutua esclusione se il flag è settato
+ * @function sendAck
+ * @brief Invia l'header del messaggio in mutua esclusione se il flag è settato.
+ *        Sulle connessioni del server passa per la coda di uscita
  *
  * @param fd     descrittore della connessione
  * @param hdr    puntatore all'header del messaggio da inviare
@@ -128,7 +542,8 @@ int sendData(long fd, message_data_t *msg);
 
 /**
  * @function sendRequest
- * @brief Invia un messaggio di richiesta al server in mutua esclusione se il flag è settato
+ * @brief Invia un messaggio di richiesta al server in mutua esclusione se il flag è settato.
+ *        Sulle connessioni del server passa per la coda di uscita
  *
  * @param fd     descrittore della connessione
  * @param msg    puntatore al messaggio da inviare
@@ -137,6 +552,33 @@ int sendData(long fd, message_data_t *msg);
  */
 int sendRequest(long fd, message_t *msg);
 
+/**
+ * @function sendMsgs
+ * @brief Invia n messaggi come n sendRequest, ma sulle connessioni del server
+ *        con una writev ogni TX_GATHER messaggi
+ *
+ * @param fd     descrittore della connessione
+ * @param msgs   messaggi da inviare
+ * @param n      numero di messaggi
+ *
+ * @return <=0 se c'e' stato un errore
+ */
+int sendMsgs(long fd, message_t **msgs, int n);
+
+/**
+ * @function sendFile
+ * @brief Invia un messaggio il cui buffer dati e' il contenuto di un file: gli
+ *        header vengono scritti con una writev e il file con sendfile, senza
+ *        copiarlo in memoria. Sulle connessioni del server passa per la coda di uscita
+ *
+ * @param fd       descrittore della connessione
+ * @param msg      messaggio da inviare (data.hdr.len e' la dimensione del file, data.buf non usato)
+ * @param file_fd  descrittore del file aperto in lettura, chiuso dalla funzione
+ *
+ * @return <=0 se c'e' stato un errore
+ */
+int sendFile(long fd, message_t *msg, int file_fd);
+
 /**
  * @function setSendAck
  * @brief Scrive l'header del messaggio e lo invia al client 
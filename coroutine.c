@@ -0,0 +1,144 @@
+/**
+ * @file  coroutine.c
+ * @author Federico Germinario 545081
+ *
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ *
+ */
+
+#define _XOPEN_SOURCE 700
+#include <stdlib.h>
+#include <pthread.h>
+#include "coroutine.h"
+
+static __thread coro_t *current = NULL;   // Coroutine in esecuzione nel thread
+
+static pthread_mutex_t cache_mtx = PTHREAD_MUTEX_INITIALIZER;
+static coro_t *cache = NULL;              // Coroutine terminate con lo stack da riusare
+static int ncached = 0;
+
+/**
+ * @function coEntry
+ * @brief Punto di ingresso di ogni coroutine: al termine di fn torna a chi
+ *        l'ha ripresa per ultimo, che puo' essere un thread diverso dal primo
+ */
+static void coEntry(void){
+    coro_t *co = current;
+    co->ret  = co->fn(co->arg);
+    co->done = 1;
+    // La coroutine non verra' piu' ripresa, il suo contesto va perso
+    setcontext(co->back);
+}
+
+/**
+ * @function coCreate
+ * @brief Crea una coroutine che eseguira' fn(arg) alla prima coResume
+ *
+ * @return puntatore alla coroutine, NULL in caso di fallimento
+ */
+coro_t *coCreate(int (*fn)(void *arg), void *arg){
+    pthread_mutex_lock(&cache_mtx);
+    coro_t *co = cache;
+    if(co != NULL){
+        cache = co->next;
+        ncached--;
+    }
+    pthread_mutex_unlock(&cache_mtx);
+
+    if(co == NULL){
+        if((co = malloc(sizeof(coro_t))) == NULL) return NULL;
+        if((co->stack = malloc(CO_STACK)) == NULL){
+            free(co);
+            return NULL;
+        }
+    }
+    if(getcontext(&co->ctx) == -1){
+        coDestroy(co);
+        return NULL;
+    }
+    co->ctx.uc_stack.ss_sp   = co->stack;
+    co->ctx.uc_stack.ss_size = CO_STACK;
+    co->ctx.uc_link          = NULL;
+    makecontext(&co->ctx, coEntry, 0);
+    co->back     = NULL;
+    co->fn       = fn;
+    co->arg      = arg;
+    co->ret      = 0;
+    co->done     = 0;
+    co->then     = NULL;
+    co->then_arg = NULL;
+    co->next     = NULL;
+    return co;
+}
+
+/**
+ * @function coDestroy
+ * @brief Libera una coroutine terminata (o mai avviata)
+ */
+void coDestroy(coro_t *co){
+    if(co == NULL) return;
+    pthread_mutex_lock(&cache_mtx);
+    if(ncached < CO_CACHED){
+        co->next = cache;
+        cache = co;
+        ncached++;
+        co = NULL;
+    }
+    pthread_mutex_unlock(&cache_mtx);
+    if(co != NULL){
+        free(co->stack);
+        free(co);
+    }
+}
+
+/**
+ * @function coResume
+ * @brief Esegue la coroutine nel thread chiamante fino alla sua prossima
+ *        sospensione o alla sua terminazione
+ *
+ * @return 1 coroutine sospesa, 0 coroutine terminata (esito in co->ret)
+ */
+int coResume(coro_t *co){
+    ucontext_t here;
+    coro_t *prev = current;
+    current  = co;
+    co->back = &here;
+    swapcontext(&here, &co->ctx);
+    current = prev;
+
+    if(co->done) return 0;
+    // Da qui un altro thread puo' riprendere la coroutine: non va piu' toccata
+    void (*then)(void *) = co->then;
+    void *arg = co->then_arg;
+    co->then = NULL;
+    if(then != NULL) then(arg);
+    return 1;
+}
+
+/**
+ * @function coYieldThen
+ * @brief Sospende la coroutine corrente. Dopo la sospensione chi l'ha ripresa
+ *        esegue then(arg), che puo' quindi consegnare la coroutine a chi la
+ *        riprendera' senza che questa stia ancora girando
+ *
+ * @param then   funzione da eseguire dopo la sospensione, NULL per nessuna
+ * @param arg    argomento di then
+ */
+void coYieldThen(void (*then)(void *arg), void *arg){
+    coro_t *co = current;
+    if(co == NULL) return;
+    co->then     = then;
+    co->then_arg = arg;
+    swapcontext(&co->ctx, co->back);
+}
+
+/**
+ * @function coSelf
+ * @brief Coroutine in esecuzione nel thread chiamante
+ *
+ * @return puntatore alla coroutine, NULL se il thread non ne sta eseguendo una
+ */
+coro_t *coSelf(void){
+    return current;
+}
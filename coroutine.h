@@ -0,0 +1,104 @@
+/**
+ * @file  coroutine.h
+ * @brief Coroutine con stack proprio (ucontext) per gli handler che attendono
+ *        operazioni su disco: la coroutine si sospende, il thread che la
+ *        eseguiva torna libero e la coroutine viene ripresa, anche da un
+ *        altro thread, quando l'operazione e' completata
+ *
+ *  Poiche' una coroutine puo' riprendere su un thread diverso, il codice
+ *  che gira in una coroutine non deve:
+ *   - usare variabili __thread (o funzioni che le usano) a cavallo di una
+ *     sospensione: dopo la ripresa sono quelle dell'altro thread;
+ *   - leggere errno dopo una sospensione contando sul valore di prima: e'
+ *     anch'esso del thread, va riletto da cio' che l'operazione restituisce
+ *     (es. fioOpen lo reimposta dopo la ripresa);
+ *   - tenere una mutex presa attraverso una sospensione: verrebbe rilasciata
+ *     da un thread diverso da quello che l'ha presa (comportamento non
+ *     definito) e bloccherebbe chi la attende per tutta la durata dell'I/O
+ * @author Federico Germinario 545081
+ *
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ *
+ */
+#ifndef COROUTINE_H_
+#define COROUTINE_H_
+
+#include <stddef.h>
+#include <ucontext.h>
+
+#define CO_STACK     65536    // Byte dello stack di ogni coroutine
+#define CO_CACHED    64       // Coroutine terminate tenute per essere riusate
+
+/**
+ *  @struct coro
+ *  @brief Coroutine: va ripresa da un solo thread alla volta
+ *
+ *  @var ctx        contesto della coroutine sospesa
+ *  @var back       contesto del thread che l'ha ripresa, ripristinato dalla sospensione
+ *  @var stack      stack della coroutine (CO_STACK byte)
+ *  @var fn         funzione eseguita dalla coroutine
+ *  @var arg        argomento di fn
+ *  @var ret        valore restituito da fn
+ *  @var done       1 quando fn e' terminata
+ *  @var then       eseguita da chi l'ha ripresa dopo la sospensione (vedi coYieldThen)
+ *  @var then_arg   argomento di then
+ *  @var next       coroutine successiva nella lista di quelle riusabili
+ */
+typedef struct coro {
+    ucontext_t    ctx;
+    ucontext_t   *back;
+    char         *stack;
+    int         (*fn)(void *arg);
+    void         *arg;
+    int           ret;
+    int           done;
+    void        (*then)(void *arg);
+    void         *then_arg;
+    struct coro  *next;
+} coro_t;
+
+/**
+ * @function coCreate
+ * @brief Crea una coroutine che eseguira' fn(arg) alla prima coResume
+ *
+ * @return puntatore alla coroutine, NULL in caso di fallimento
+ */
+coro_t *coCreate(int (*fn)(void *arg), void *arg);
+
+/**
+ * @function coDestroy
+ * @brief Libera una coroutine terminata (o mai avviata)
+ */
+void coDestroy(coro_t *co);
+
+/**
+ * @function coResume
+ * @brief Esegue la coroutine nel thread chiamante fino alla sua prossima
+ *        sospensione o alla sua terminazione
+ *
+ * @return 1 coroutine sospesa, 0 coroutine terminata (esito in co->ret)
+ */
+int coResume(coro_t *co);
+
+/**
+ * @function coYieldThen
+ * @brief Sospende la coroutine corrente. Dopo la sospensione chi l'ha ripresa
+ *        esegue then(arg), che puo' quindi consegnare la coroutine a chi la
+ *        riprendera' senza che questa stia ancora girando. Il chiamante non
+ *        deve avere mutex prese (vedi l'inizio del file)
+ *
+ * @param then   funzione da eseguire dopo la sospensione, NULL per nessuna
+ * @param arg    argomento di then
+ */
+void coYieldThen(void (*then)(void *arg), void *arg);
+
+/**
+ * @function coSelf
+ * @brief Coroutine in esecuzione nel thread chiamante
+ *
+ * @return puntatore alla coroutine, NULL se il thread non ne sta eseguendo una
+ */
+coro_t *coSelf(void);
+
+#endif /* COROUTINE_H_ */
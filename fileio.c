@@ -0,0 +1,431 @@
+/**
+ * @file  fileio.c
+ * @author Federico Germinario 545081
+ *
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <linux/stat.h>
+#include "fileio.h"
+#include "uring.h"
+
+#ifndef AT_EMPTY_PATH
+#define AT_EMPTY_PATH 0x1000
+#endif
+
+/**
+ * @function fioFree
+ * @brief Dealloca una richiesta con i buffer che possiede
+ */
+static void fioFree(fio_req_t *req){
+    free(req->path);
+    free(req->buf);
+    free(req);
+}
+
+/**
+ * @function fioWrite
+ * @brief Scrive il blocco della richiesta a partire dal byte off di buf,
+ *        l'esito va in req->err
+ */
+static void fioWrite(fio_req_t *req, size_t off){
+    while(off < req->len){
+        ssize_t r = write(req->file_fd, req->buf + off, req->len - off);
+        if(r == -1){
+            if(errno == EINTR) continue;
+            req->err = errno;
+            break;
+        }
+        off += r;
+    }
+}
+
+/**
+ * @function fioExec
+ * @brief Esegue l'operazione su disco della richiesta, l'esito va in req->err
+ */
+static void fioExec(fio_req_t *req){
+    req->err = 0;
+    switch(req->op){
+        case FIO_OPEN:{
+            if((req->file_fd = open(req->path, req->flags, 0666)) == -1){
+                req->err = errno;
+                break;
+            }
+            struct stat st;
+            if(fstat(req->file_fd, &st) == -1){
+                req->err = errno;
+                close(req->file_fd);
+                req->file_fd = -1;
+                break;
+            }
+            req->size = st.st_size;
+            // Il contenuto verra' inviato con sendfile: ne anticipo la lettura
+            // cosi' chi scrive sul socket lo trova gia' in memoria
+            if((req->flags & O_ACCMODE) == O_RDONLY) posix_fadvise(req->file_fd, 0, 0, POSIX_FADV_WILLNEED);
+            break;
+        }
+        case FIO_WRITE:{
+            fioWrite(req, 0);
+            if(req->last) close(req->file_fd);
+            break;
+        }
+    }
+}
+
+/**
+ * @function ringRun
+ * @brief Sottomette le richieste preparate e ne attende tutti i completamenti,
+ *        copiando in res l'esito di ciascuna all'indice user_data. Le richieste
+ *        che il kernel non ha accettato restano con esito -EINVAL, come le
+ *        operazioni non supportate: il chiamante le esegue con le system call
+ *
+ * @param nres     elementi di res
+ *
+ * @return 0 successo, -1 io_uring_enter fallita
+ */
+static int ringRun(uring_t *ring, int *res, int nres){
+    for(int i = 0; i < nres; i++) res[i] = -EINVAL;
+    if(ring->pending == 0) return 0;
+    int ret = uringSubmit(ring, ring->pending) == -1 ? -1 : 0;
+    // Le richieste in volo usano la memoria del chiamante: le attendo tutte
+    while(ring->inflight > 0){
+        struct io_uring_cqe cqe;
+        if(uringReap(ring, &cqe)) res[cqe.user_data] = cqe.res;
+        else uringWait(ring);
+    }
+    return ret;
+}
+
+/**
+ * @function fioExecRing
+ * @brief Esegue le n richieste come fioExec con due sole io_uring_enter: la
+ *        prima apre i file e scrive i blocchi, la seconda legge la dimensione
+ *        dei file aperti (anticipandone la lettura) e chiude quelli scritti per
+ *        intero. Le operazioni che il kernel non supporta (EINVAL) e il resto
+ *        delle scritture corte vengono eseguiti con le system call
+ *
+ *        Se io_uring_enter fallisce porta a termine le richieste con le system
+ *        call e dealloca io_uring (*ringp NULL)
+ */
+static void fioExecRing(uring_t **ringp, fio_req_t **reqs, int n){
+    uring_t *ring = *ringp;
+    int res[FIO_BATCH], res2[2 * FIO_BATCH];
+    struct statx stx[FIO_BATCH];
+    struct io_uring_sqe *sqe;
+    int failed;
+
+    for(int i = 0; i < n; i++){
+        fio_req_t *req = reqs[i];
+        sqe = uringGetSqe(ring);
+        sqe->user_data = i;
+        if(req->op == FIO_OPEN){
+            sqe->opcode     = IORING_OP_OPENAT;
+            sqe->fd         = AT_FDCWD;
+            sqe->addr       = (unsigned long) req->path;
+            sqe->len        = 0666;
+            sqe->open_flags = req->flags;
+        }else{
+            // Posizione corrente del file: i blocchi di un file arrivano in ordine
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd     = req->file_fd;
+            sqe->addr   = (unsigned long) req->buf;
+            sqe->len    = req->len;
+            sqe->off    = (unsigned long long) -1;
+        }
+    }
+    failed = ringRun(ring, res, FIO_BATCH) == -1;
+
+    for(int i = 0; i < n; i++){
+        fio_req_t *req = reqs[i];
+        req->err = 0;
+        if(res[i] == -EINVAL){
+            // Operazione non supportata dal kernel
+            fioExec(req);
+            continue;
+        }
+        if(req->op == FIO_OPEN){
+            if(res[i] < 0){
+                req->err = -res[i];
+                req->file_fd = -1;
+                continue;
+            }
+            req->file_fd = res[i];
+            // Senza io_uring la dimensione arriva da fstat (esito -EINVAL)
+            if(failed) continue;
+            sqe = uringGetSqe(ring);
+            sqe->opcode      = IORING_OP_STATX;
+            sqe->fd          = req->file_fd;
+            sqe->addr        = (unsigned long) "";
+            sqe->len         = STATX_SIZE;
+            sqe->addr2       = (unsigned long) &stx[i];
+            sqe->statx_flags = AT_EMPTY_PATH;
+            sqe->user_data   = i;
+            // Come in fioExec: il contenuto verra' inviato con sendfile
+            if((req->flags & O_ACCMODE) == O_RDONLY){
+                sqe = uringGetSqe(ring);
+                sqe->opcode         = IORING_OP_FADVISE;
+                sqe->fd             = req->file_fd;
+                sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+                sqe->user_data      = FIO_BATCH + i;
+            }
+        }else{
+            if(res[i] < 0) req->err = -res[i];
+            else fioWrite(req, res[i]);
+            if(req->last && !failed){
+                sqe = uringGetSqe(ring);
+                sqe->opcode    = IORING_OP_CLOSE;
+                sqe->fd        = req->file_fd;
+                sqe->user_data = i;
+            }
+        }
+    }
+    // Quello che non e' stato eseguito qui (-EINVAL) si completa con fstat e close
+    if(ringRun(ring, res2, 2 * FIO_BATCH) == -1) failed = 1;
+    if(failed){
+        fprintf(stderr, "io_uring del pool di I/O disabilitato\n");
+        uringDestroy(ring);
+        *ringp = NULL;
+    }
+
+    for(int i = 0; i < n; i++){
+        fio_req_t *req = reqs[i];
+        if(res[i] == -EINVAL || (res[i] < 0 && req->op == FIO_OPEN)) continue;
+        if(req->op == FIO_WRITE){
+            if(req->last && res2[i] == -EINVAL) close(req->file_fd);
+            continue;
+        }
+        if(res2[i] == 0){
+            req->size = stx[i].stx_size;
+            continue;
+        }
+        struct stat st;
+        if(fstat(req->file_fd, &st) == -1){
+            req->err = errno;
+            close(req->file_fd);
+            req->file_fd = -1;
+        }else{
+            req->size = st.st_size;
+        }
+    }
+}
+
+/**
+ * @function fioFinish
+ * @brief Prosegue la richiesta eseguita: riprende la coroutine sospesa o
+ *        esegue la callback, poi restituisce la connessione
+ */
+static void fioFinish(fio_pool_t *p, fio_req_t *req){
+    long conn = req->conn;
+    if(req->co != NULL){
+        // La richiesta sta sullo stack della coroutine, che prosegue qui
+        coro_t *co = req->co;
+        if(coResume(co) == 0){
+            int ret = co->ret;
+            coDestroy(co);
+            p->complete(conn, ret);
+        }
+        return;
+    }
+    int ret = req->done(req);
+    fioFree(req);
+    p->complete(conn, ret);
+}
+
+/**
+ * @function fioThread
+ * @brief Thread del pool: esegue le richieste in ordine di arrivo fino alla
+ *        richiesta NULL di terminazione. Con io_uring estrae insieme alla
+ *        prima le richieste gia' in coda (al piu' FIO_BATCH) e le esegue
+ *        con fioExecRing
+ */
+static void *fioThread(void *arg){
+    fio_pool_t *p = (fio_pool_t *) arg;
+    fio_req_t *reqs[FIO_BATCH];
+    int stop = 0;
+    // Se il kernel non supporta io_uring resto sulle system call
+    uring_t *ring = p->uring ? uringCreate(2 * FIO_BATCH) : NULL;
+
+    while(!stop){
+        int n = 0;
+        long item = pop(p->q);
+        while(1){
+            // Una sola richiesta di terminazione per thread
+            if(item == 0){
+                stop = 1;
+                break;
+            }
+            reqs[n++] = (fio_req_t *) item;
+            if(ring == NULL || n == FIO_BATCH || tryPop(p->q, &item) == -1) break;
+        }
+        if(ring != NULL) fioExecRing(&ring, reqs, n);
+        else for(int i = 0; i < n; i++) fioExec(reqs[i]);
+        for(int i = 0; i < n; i++) fioFinish(p, reqs[i]);
+    }
+    uringDestroy(ring);
+    return NULL;
+}
+
+/**
+ * @function fioCreate
+ * @brief Avvia un pool di n thread di I/O
+ *
+ * @param n          numero di thread
+ * @param complete   funzione che riprende la connessione dopo la callback
+ *                   della richiesta (ret e' l'esito di done)
+ * @param uring      1 per eseguire le richieste in coda a gruppi con io_uring
+ *
+ * @return puntatore al pool, NULL in caso di fallimento
+ */
+fio_pool_t *fioCreate(int n, void (*complete)(long conn, int ret), int uring){
+    if(n < 1) return NULL;
+    fio_pool_t *p = calloc(1, sizeof(fio_pool_t));
+    if(p == NULL) return NULL;
+    p->complete = complete;
+    p->uring = uring;
+    p->tids = calloc(n, sizeof(pthread_t));
+    if(p->tids == NULL || (p->q = initQueue()) == NULL){
+        free(p->tids);
+        free(p);
+        return NULL;
+    }
+    for(p->n = 0; p->n < n; p->n++){
+        if(pthread_create(&p->tids[p->n], NULL, fioThread, p) != 0) break;
+    }
+    if(p->n == 0){
+        fioDestroy(p);
+        return NULL;
+    }
+    return p;
+}
+
+/**
+ * @function fioDestroy
+ * @brief Esegue le richieste gia' in coda, termina i thread e dealloca il pool.
+ *        Le richieste inviate durante la terminazione vengono scartate
+ *
+ * @param p          puntatore al pool
+ */
+void fioDestroy(fio_pool_t *p){
+    if(p == NULL) return;
+    for(int i = 0; i < p->n; i++) push(p->q, 0);
+    for(int i = 0; i < p->n; i++) pthread_join(p->tids[i], NULL);
+
+    // Richieste inviate dalle ultime callback, dopo le richieste di terminazione
+    long item;
+    while(tryPop(p->q, &item) == 0){
+        fio_req_t *req = (fio_req_t *) item;
+        if(req == NULL) continue;
+        if(req->co != NULL){
+            // La coroutine sospesa riprende con l'operazione annullata: l'handler
+            // fallisce liberando le proprie risorse, poi ne libero lo stack.
+            // Se si sospende di nuovo la sua richiesta torna in questa coda
+            coro_t *co = req->co;
+            long conn = req->conn;
+            req->err     = ECANCELED;
+            req->file_fd = -1;
+            if(coResume(co) == 0){
+                coDestroy(co);
+                p->complete(conn, -1);
+            }
+            continue;
+        }
+        if(req->op == FIO_WRITE && req->last) close(req->file_fd);
+        fioFree(req);
+    }
+    deleteQueue(p->q);
+    free(p->tids);
+    free(p);
+}
+
+/**
+ * @function fioAlloc
+ * @brief Alloca una richiesta vuota per la connessione conn
+ *
+ * @return puntatore alla richiesta, NULL in caso di fallimento
+ */
+fio_req_t *fioAlloc(fio_op_t op, long conn, int (*done)(fio_req_t *req)){
+    fio_req_t *req = calloc(1, sizeof(fio_req_t));
+    if(req == NULL) return NULL;
+    req->op      = op;
+    req->conn    = conn;
+    req->file_fd = -1;
+    req->done    = done;
+    return req;
+}
+
+/**
+ * @function fioSubmit
+ * @brief Affida la richiesta al pool, che la dealloca dopo la callback.
+ *        Senza pool la esegue subito nel thread chiamante
+ *
+ * @param p          puntatore al pool, NULL per eseguire nel chiamante
+ * @param req        richiesta allocata con fioAlloc
+ *
+ * @return FIO_PENDING richiesta nel pool, altrimenti l'esito della callback done
+ */
+int fioSubmit(fio_pool_t *p, fio_req_t *req){
+    if(p != NULL){
+        push(p->q, (long) req);
+        return FIO_PENDING;
+    }
+    fioExec(req);
+    int ret = req->done(req);
+    fioFree(req);
+    return ret;
+}
+
+/**
+ * @function fioPush
+ * @brief Accoda al pool la richiesta di una coroutine gia' sospesa
+ */
+static void fioPush(void *arg){
+    fio_req_t *req = (fio_req_t *) arg;
+    push(req->pool->q, (long) req);
+}
+
+/**
+ * @function fioOpen
+ * @brief Apre un file per conto della connessione conn. Dentro una coroutine
+ *        con il pool la coroutine si sospende e viene ripresa dal thread di I/O
+ *        dopo l'apertura, altrimenti il file viene aperto nel chiamante
+ *
+ * @param p          puntatore al pool, NULL per aprire nel chiamante
+ * @param conn       connessione che attende l'apertura
+ * @param path       path del file
+ * @param flags      flag di open
+ * @param size       dove copiare la dimensione del file
+ *
+ * @return descrittore del file aperto, -1 errore
+ */
+int fioOpen(fio_pool_t *p, long conn, char *path, int flags, off_t *size){
+    fio_req_t req;
+    memset(&req, 0, sizeof(fio_req_t));
+    req.op      = FIO_OPEN;
+    req.conn    = conn;
+    req.path    = path;
+    req.flags   = flags;
+    req.file_fd = -1;
+    req.co      = coSelf();
+    req.pool    = p;
+    if(p != NULL && req.co != NULL){
+        // Il thread di I/O riprende la coroutine dopo l'apertura
+        coYieldThen(fioPush, &req);
+    }else{
+        fioExec(&req);
+    }
+    // errno e' del thread: dopo la ripresa e' quello del thread di I/O
+    if(req.err != 0) errno = req.err;
+    *size = req.size;
+    return req.file_fd;
+}
@@ -0,0 +1,148 @@
+/**
+ * @file  fileio.h
+ * @brief Pool di thread dedicato alle operazioni su disco delle richieste
+ *        POSTFILE_OP e GETFILE_OP: i worker e i reactor affidano al pool
+ *        l'apertura e la scrittura dei file, e la richiesta prosegue nella
+ *        callback di completamento o nella coroutine ripresa dal thread di I/O
+ * @author Federico Germinario 545081
+ *
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ *
+ */
+#ifndef FILEIO_H_
+#define FILEIO_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+#include "queue.h"
+#include "coroutine.h"
+
+#define FIO_PENDING  1     // Restituito da fioSubmit: la richiesta prosegue nel pool
+#define FIO_BATCH    16    // Richieste eseguite con le stesse io_uring_enter da un thread di I/O
+
+/**
+ *  @enum fio_op
+ *  @brief Operazione su disco richiesta al pool
+ */
+typedef enum {
+    FIO_OPEN,        // apertura del file (e dimensione, per la lettura)
+    FIO_WRITE        // scrittura di un blocco del contenuto di un file
+} fio_op_t;
+
+/**
+ *  @struct fio_req
+ *  @brief Richiesta di I/O su disco per conto di una connessione
+ *
+ *  @var op         operazione da eseguire
+ *  @var conn       connessione che attende il completamento
+ *  @var path       FIO_OPEN: path del file da aprire
+ *  @var flags      FIO_OPEN: flag di open
+ *  @var file_fd    FIO_OPEN: file aperto (-1 errore); FIO_WRITE: file di destinazione
+ *  @var size       FIO_OPEN: dimensione del file aperto
+ *  @var buf        FIO_WRITE: blocco da scrivere (posseduto dalla richiesta)
+ *  @var len        FIO_WRITE: byte in buf
+ *  @var last       FIO_WRITE: 1 se e' l'ultimo blocco, il file viene chiuso
+ *  @var err        errno dell'operazione, 0 successo
+ *  @var done       callback di completamento: 0 successo, -1 la connessione va chiusa
+ *  @var co         coroutine sospesa sulla richiesta (vedi fioOpen), NULL per usare done
+ *  @var pool       pool in cui accodare la richiesta dopo la sospensione della coroutine
+ */
+typedef struct fio_req {
+    fio_op_t    op;
+    long        conn;
+    char       *path;
+    int         flags;
+    int         file_fd;
+    off_t       size;
+    char       *buf;
+    size_t      len;
+    int         last;
+    int         err;
+    int       (*done)(struct fio_req *req);
+    coro_t     *co;
+    struct fio_pool *pool;
+} fio_req_t;
+
+/**
+ *  @struct fio_pool
+ *  @brief Thread di I/O con la relativa coda delle richieste
+ *
+ *  @var q          coda delle richieste (puntatori a fio_req_t)
+ *  @var tids       thread del pool
+ *  @var n          numero di thread
+ *  @var complete   eseguita dopo done o dopo la fine della coroutine con il
+ *                  suo esito, restituisce la connessione
+ *  @var uring      1 se i thread eseguono le richieste a gruppi con io_uring
+ */
+typedef struct fio_pool {
+    Queue_t    *q;
+    pthread_t  *tids;
+    int         n;
+    void      (*complete)(long conn, int ret);
+    int         uring;
+} fio_pool_t;
+
+/**
+ * @function fioCreate
+ * @brief Avvia un pool di n thread di I/O
+ *
+ * @param n          numero di thread
+ * @param complete   funzione che riprende la connessione dopo la callback
+ *                   della richiesta o la fine della coroutine (ret e' l'esito
+ *                   di done o della coroutine)
+ * @param uring      1 per eseguire le richieste in coda a gruppi di FIO_BATCH
+ *                   con io_uring (system call se il kernel non lo supporta)
+ *
+ * @return puntatore al pool, NULL in caso di fallimento
+ */
+fio_pool_t *fioCreate(int n, void (*complete)(long conn, int ret), int uring);
+
+/**
+ * @function fioDestroy
+ * @brief Esegue le richieste gia' in coda, termina i thread e dealloca il pool.
+ *        Le richieste inviate durante la terminazione vengono scartate, le
+ *        coroutine sospese riprese con ECANCELED e deallocate
+ *
+ * @param p          puntatore al pool
+ */
+void fioDestroy(fio_pool_t *p);
+
+/**
+ * @function fioAlloc
+ * @brief Alloca una richiesta vuota per la connessione conn
+ *
+ * @return puntatore alla richiesta, NULL in caso di fallimento
+ */
+fio_req_t *fioAlloc(fio_op_t op, long conn, int (*done)(fio_req_t *req));
+
+/**
+ * @function fioSubmit
+ * @brief Affida la richiesta al pool, che la dealloca dopo la callback.
+ *        Senza pool la esegue subito nel thread chiamante
+ *
+ * @param p          puntatore al pool, NULL per eseguire nel chiamante
+ * @param req        richiesta allocata con fioAlloc
+ *
+ * @return FIO_PENDING richiesta nel pool, altrimenti l'esito della callback done
+ */
+int fioSubmit(fio_pool_t *p, fio_req_t *req);
+
+/**
+ * @function fioOpen
+ * @brief Apre un file per conto della connessione conn. Dentro una coroutine
+ *        con il pool la coroutine si sospende e viene ripresa dal thread di I/O
+ *        dopo l'apertura, altrimenti il file viene aperto nel chiamante
+ *
+ * @param p          puntatore al pool, NULL per aprire nel chiamante
+ * @param conn       connessione che attende l'apertura
+ * @param path       path del file
+ * @param flags      flag di open
+ * @param size       dove copiare la dimensione del file
+ *
+ * @return descrittore del file aperto, -1 errore (errno impostato, ECANCELED
+ *         se il pool e' stato distrutto prima dell'apertura)
+ */
+int fioOpen(fio_pool_t *p, long conn, char *path, int flags, off_t *size);
+
+#endif /* FILEIO_H_ */
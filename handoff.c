@@ -0,0 +1,429 @@
+/**
+ * @file  handoff.c
+ * @author Federico Germinario 545081
+ *
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "handoff.h"
+
+#define HO_MAGIC  0x43484f31u      // Versione del formato dello stato
+
+/**
+ *  @struct ho_hello
+ *  @brief Primo record, inviato insieme al socket di ascolto
+ */
+typedef struct {
+    uint32_t           magic;
+    struct statistics  stats;
+} ho_hello_t;
+
+/**
+ *  @struct ho_user
+ *  @brief Utente registrato, seguito dai messaggi della sua history.
+ *         Il nome vuoto chiude la lista degli utenti
+ */
+typedef struct {
+    char  name[MAX_NAME_LENGTH + 1];
+    int   nmsgs;
+} ho_user_t;
+
+/**
+ *  @struct ho_crec
+ *  @brief Connessione, inviata insieme al suo descrittore e seguita dai byte
+ *         gia' letti. Il record con fd == -1, senza descrittore, chiude la
+ *         lista delle connessioni
+ */
+typedef struct {
+    char      user[MAX_NAME_LENGTH + 1];
+    uint32_t  len;
+    int       fd;
+} ho_crec_t;
+
+/**
+ * @function hoWrite
+ * @brief Scrive esattamente size byte
+ *
+ * @return 0 successo, -1 errore
+ */
+static int hoWrite(int sock, const void *buf, size_t size){
+    const char *p = (const char *) buf;
+    while(size > 0){
+        ssize_t r = write(sock, p, size);
+        if(r == -1){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        p    += r;
+        size -= r;
+    }
+    return 0;
+}
+
+/**
+ * @function hoRead
+ * @brief Legge esattamente size byte
+ *
+ * @return 0 successo, -1 errore o socket chiuso
+ */
+static int hoRead(int sock, void *buf, size_t size){
+    char *p = (char *) buf;
+    while(size > 0){
+        ssize_t r = read(sock, p, size);
+        if(r == -1){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        if(r == 0){
+            errno = ECONNRESET;
+            return -1;
+        }
+        p    += r;
+        size -= r;
+    }
+    return 0;
+}
+
+/**
+ * @function hoSendFd
+ * @brief Invia il record buf con il descrittore fd allegato (SCM_RIGHTS)
+ *
+ * @return 0 successo, -1 errore
+ */
+static int hoSendFd(int sock, int fd, const void *buf, size_t size){
+    struct iovec iov;
+    iov.iov_base = (void *) buf;
+    iov.iov_len  = size;
+    union {
+        struct cmsghdr  hdr;
+        char            space[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    memset(&ctl, 0, sizeof(ctl));
+
+    struct msghdr m;
+    memset(&m, 0, sizeof(struct msghdr));
+    m.msg_iov        = &iov;
+    m.msg_iovlen     = 1;
+    m.msg_control    = ctl.space;
+    m.msg_controllen = sizeof(ctl.space);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&m);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type  = SCM_RIGHTS;
+    cm->cmsg_len   = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+
+    ssize_t r;
+    while((r = sendmsg(sock, &m, 0)) == -1 && errno == EINTR);
+    if(r == -1) return -1;
+    // Il descrittore viaggia con il primo byte, il resto del record senza
+    return hoWrite(sock, (const char *) buf + r, size - r);
+}
+
+/**
+ * @function hoRecvFd
+ * @brief Riceve un record inviato con hoSendFd o con hoWrite
+ *
+ * @param fd     dove copiare il descrittore allegato, -1 se il record non ne ha
+ *
+ * @return 0 successo, -1 errore
+ */
+static int hoRecvFd(int sock, void *buf, size_t size, int *fd){
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len  = size;
+    union {
+        struct cmsghdr  hdr;
+        char            space[CMSG_SPACE(sizeof(int))];
+    } ctl;
+
+    struct msghdr m;
+    memset(&m, 0, sizeof(struct msghdr));
+    m.msg_iov        = &iov;
+    m.msg_iovlen     = 1;
+    m.msg_control    = ctl.space;
+    m.msg_controllen = sizeof(ctl.space);
+
+    ssize_t r;
+    while((r = recvmsg(sock, &m, 0)) == -1 && errno == EINTR);
+    if(r <= 0){
+        if(r == 0) errno = ECONNRESET;
+        return -1;
+    }
+    *fd = -1;
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&m);
+    if(cm != NULL && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS){
+        memcpy(fd, CMSG_DATA(cm), sizeof(int));
+    }
+    if(hoRead(sock, (char *) buf + r, size - r) == -1){
+        if(*fd >= 0) close(*fd);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @function hoAddr
+ * @brief Indirizzo del socket path
+ *
+ * @return 0 successo, -1 path troppo lungo
+ */
+static int hoAddr(const char *path, struct sockaddr_un *sa){
+    memset(sa, 0, sizeof(struct sockaddr_un));
+    if(strlen(path) >= sizeof(sa->sun_path)){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    sa->sun_family = AF_UNIX;
+    strncpy(sa->sun_path, path, sizeof(sa->sun_path) - 1);
+    return 0;
+}
+
+/**
+ * @function handoffAccept
+ * @brief Lato nuovo processo: crea il socket path ed attende la connessione
+ *        del server in esecuzione
+ *
+ * @param path     path del socket (HandoffPath)
+ *
+ * @return socket connesso al server in esecuzione, -1 errore
+ */
+int handoffAccept(const char *path){
+    struct sockaddr_un sa;
+    if(hoAddr(path, &sa) == -1) return -1;
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(lfd == -1) return -1;
+    unlink(path);
+    // Solo i processi dello stesso utente possono consegnare lo stato
+    if(bind(lfd, (struct sockaddr *) &sa, sizeof(sa)) == -1 || chmod(path, S_IRUSR | S_IWUSR) == -1
+       || listen(lfd, 1) == -1){
+        close(lfd);
+        return -1;
+    }
+    int sock;
+    while((sock = accept(lfd, NULL, NULL)) == -1 && errno == EINTR);
+    close(lfd);
+    unlink(path);
+    return sock;
+}
+
+/**
+ * @function handoffConnect
+ * @brief Lato server in esecuzione: si connette al nuovo processo in attesa su path
+ *
+ * @param path     path del socket (HandoffPath)
+ *
+ * @return socket connesso al nuovo processo, -1 errore
+ */
+int handoffConnect(const char *path){
+    struct sockaddr_un sa;
+    if(hoAddr(path, &sa) == -1) return -1;
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(sock == -1) return -1;
+    if(connect(sock, (struct sockaddr *) &sa, sizeof(sa)) == -1){
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * @function sendConn
+ * @brief Invia una connessione con il suo descrittore (vedi connExport)
+ */
+static int sendConn(long fd, const char *user, const char *pending, size_t len, void *arg){
+    int sock = *(int *) arg;
+    ho_crec_t rec;
+    memset(&rec, 0, sizeof(ho_crec_t));
+    strncpy(rec.user, user, MAX_NAME_LENGTH);
+    rec.len = len;
+    rec.fd  = (int) fd;
+    if(hoSendFd(sock, (int) fd, &rec, sizeof(ho_crec_t)) == -1) return -1;
+    return hoWrite(sock, pending, len);
+}
+
+/**
+ * @function sendUser
+ * @brief Invia un utente con i messaggi della sua history, dal piu' vecchio
+ */
+static int sendUser(int sock, user_t *user){
+    history_t *h = user->history;
+    ho_user_t rec;
+    memset(&rec, 0, sizeof(ho_user_t));
+    strncpy(rec.name, user->name, MAX_NAME_LENGTH);
+
+    pthread_mutex_lock(&(h->mtx));
+    rec.nmsgs = h->dim;
+    int r = hoWrite(sock, &rec, sizeof(ho_user_t));
+    for(int i = 0; r == 0 && i < h->dim; i++){
+        message_t *msg = h->msgs[(i + h->head) % h->dimMax];
+        r = hoWrite(sock, &(msg->hdr), sizeof(message_hdr_t));
+        if(r == 0) r = hoWrite(sock, &(msg->data.hdr), sizeof(message_data_hdr_t));
+        if(r == 0 && msg->data.hdr.len > 0) r = hoWrite(sock, msg->data.buf, msg->data.hdr.len);
+    }
+    pthread_mutex_unlock(&(h->mtx));
+    return r;
+}
+
+/**
+ * @function handoffSend
+ * @brief Invia al nuovo processo statistiche, socket di ascolto, utenti con
+ *        le history e le connessioni ferme tra due richieste. Va chiamata a
+ *        reactor, worker e pool di I/O terminati
+ *
+ * @param sock       socket restituito da handoffConnect
+ * @param listen_fd  socket di ascolto del server
+ * @param users_db   utenti registrati
+ * @param stats      statistiche del server
+ *
+ * @return numero di connessioni passate, -1 errore
+ */
+int handoffSend(int sock, int listen_fd, users_db_t *users_db, struct statistics *stats){
+    ho_hello_t hello;
+    memset(&hello, 0, sizeof(ho_hello_t));
+    hello.magic = HO_MAGIC;
+    hello.stats = *stats;
+    if(hoSendFd(sock, listen_fd, &hello, sizeof(ho_hello_t)) == -1) return -1;
+
+    // Nessun altro thread e' attivo: la tabella si scorre senza mutua esclusione
+    user_t *user;
+    int err = 0;
+    usertab_foreach(users_db->db, user, {
+        if(!err && sendUser(sock, user) == -1) err = 1;
+    });
+    ho_user_t end_users;
+    memset(&end_users, 0, sizeof(ho_user_t));
+    if(err || hoWrite(sock, &end_users, sizeof(ho_user_t)) == -1) return -1;
+
+    int n = connExport(sendConn, &sock);
+    ho_crec_t end_conns;
+    memset(&end_conns, 0, sizeof(ho_crec_t));
+    end_conns.fd = -1;
+    if(hoWrite(sock, &end_conns, sizeof(ho_crec_t)) == -1) return -1;
+    return n;
+}
+
+/**
+ * @function recvUser
+ * @brief Registra un utente ricevuto e ne ricostruisce la history
+ *
+ * @return 0 successo, -1 errore
+ */
+static int recvUser(int sock, users_db_t *users_db, ho_user_t *rec){
+    history_t *h = NULL;
+    if(register_user(users_db, rec->name) == 0) h = history_sender(users_db, rec->name);
+    for(int i = 0; i < rec->nmsgs; i++){
+        message_t *msg = calloc(1, sizeof(message_t));
+        if(msg == NULL) return -1;
+        if(hoRead(sock, &(msg->hdr), sizeof(message_hdr_t)) == -1
+           || hoRead(sock, &(msg->data.hdr), sizeof(message_data_hdr_t)) == -1){
+            free(msg);
+            return -1;
+        }
+        if(msg->data.hdr.len > 0){
+            if((msg->data.buf = malloc(msg->data.hdr.len)) == NULL
+               || hoRead(sock, msg->data.buf, msg->data.hdr.len) == -1){
+                free(msg->data.buf);
+                free(msg);
+                return -1;
+            }
+        }
+        // Utente non registrato: il messaggio va letto comunque
+        if(h == NULL || insertMsg(h, msg) == -1){
+            free(msg->data.buf);
+            free(msg);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @function handoffRecv
+ * @brief Riceve lo stato inviato da handoffSend: registra gli utenti con le
+ *        loro history e restituisce le connessioni da adottare
+ *
+ * @param sock       socket restituito da handoffAccept
+ * @param listen_fd  dove copiare il socket di ascolto ricevuto
+ * @param users_db   struttura dati vuota in cui registrare gli utenti
+ * @param stats      dove copiare le statistiche ricevute
+ * @param conns      dove copiare l'array (allocato) delle connessioni ricevute
+ *
+ * @return numero di connessioni in conns, -1 errore
+ */
+int handoffRecv(int sock, int *listen_fd, users_db_t *users_db, struct statistics *stats, ho_conn_t **conns){
+    ho_hello_t hello;
+    if(hoRecvFd(sock, &hello, sizeof(ho_hello_t), listen_fd) == -1) return -1;
+    if(*listen_fd < 0 || hello.magic != HO_MAGIC){
+        errno = EPROTO;
+        if(*listen_fd >= 0) close(*listen_fd);
+        return -1;
+    }
+    *stats = hello.stats;
+
+    ho_user_t urec;
+    while(1){
+        if(hoRead(sock, &urec, sizeof(ho_user_t)) == -1) goto fail;
+        if(urec.name[0] == '\0') break;
+        urec.name[MAX_NAME_LENGTH] = '\0';
+        if(recvUser(sock, users_db, &urec) == -1) goto fail;
+    }
+
+    // Le connessioni sono tante quanti i record ricevuti prima di quello finale
+    int n = 0, size = 0;
+    *conns = NULL;
+    while(1){
+        ho_crec_t rec;
+        int fd;
+        if(hoRecvFd(sock, &rec, sizeof(ho_crec_t), &fd) == -1) goto fail_conns;
+        if(fd < 0){
+            if(rec.fd == -1) break;
+            errno = EBADMSG;
+            goto fail_conns;
+        }
+        if(rec.len > RX_BUFSIZE){
+            close(fd);
+            errno = EBADMSG;
+            goto fail_conns;
+        }
+        if(n == size){
+            size = size == 0 ? 64 : size * 2;
+            ho_conn_t *tmp = realloc(*conns, size * sizeof(ho_conn_t));
+            if(tmp == NULL){
+                close(fd);
+                goto fail_conns;
+            }
+            *conns = tmp;
+        }
+        ho_conn_t *c = &(*conns)[n];
+        c->fd  = fd;
+        c->len = rec.len;
+        memcpy(c->user, rec.user, MAX_NAME_LENGTH + 1);
+        c->user[MAX_NAME_LENGTH] = '\0';
+        if(hoRead(sock, c->pending, c->len) == -1){
+            close(fd);
+            goto fail_conns;
+        }
+        n++;
+    }
+    return n;
+
+fail_conns:
+    for(int i = 0; i < n; i++) close((*conns)[i].fd);
+    free(*conns);
+    *conns = NULL;
+fail:
+    close(*listen_fd);
+    return -1;
+}
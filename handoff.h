@@ -0,0 +1,87 @@
+/**
+ * @file  handoff.h
+ * @brief Passaggio dello stato del server ad un nuovo processo senza
+ *        disconnettere i client: il socket di ascolto e le connessioni
+ *        aperte viaggiano con SCM_RIGHTS, utenti registrati e history
+ *        vengono copiati sullo stesso socket
+ * @author Federico Germinario 545081
+ *
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ *
+ */
+#ifndef HANDOFF_H_
+#define HANDOFF_H_
+
+#include "connections.h"
+#include "user.h"
+#include "stats.h"
+
+/**
+ *  @struct ho_conn
+ *  @brief Connessione ricevuta dal processo precedente
+ *
+ *  @var fd         descrittore della connessione
+ *  @var user       utente connesso sulla connessione, "" se nessuno
+ *  @var len        byte in pending
+ *  @var pending    byte gia' letti dal socket e non ancora consumati
+ */
+typedef struct {
+    int     fd;
+    char    user[MAX_NAME_LENGTH + 1];
+    size_t  len;
+    char    pending[RX_BUFSIZE];
+} ho_conn_t;
+
+/**
+ * @function handoffAccept
+ * @brief Lato nuovo processo: crea il socket path ed attende la connessione
+ *        del server in esecuzione
+ *
+ * @param path     path del socket (HandoffPath)
+ *
+ * @return socket connesso al server in esecuzione, -1 errore
+ */
+int handoffAccept(const char *path);
+
+/**
+ * @function handoffConnect
+ * @brief Lato server in esecuzione: si connette al nuovo processo in attesa su path
+ *
+ * @param path     path del socket (HandoffPath)
+ *
+ * @return socket connesso al nuovo processo, -1 errore
+ */
+int handoffConnect(const char *path);
+
+/**
+ * @function handoffSend
+ * @brief Invia al nuovo processo statistiche, socket di ascolto, utenti con
+ *        le history e le connessioni ferme tra due richieste. Va chiamata a
+ *        reactor, worker e pool di I/O terminati
+ *
+ * @param sock       socket restituito da handoffConnect
+ * @param listen_fd  socket di ascolto del server
+ * @param users_db   utenti registrati
+ * @param stats      statistiche del server
+ *
+ * @return numero di connessioni passate, -1 errore
+ */
+int handoffSend(int sock, int listen_fd, users_db_t *users_db, struct statistics *stats);
+
+/**
+ * @function handoffRecv
+ * @brief Riceve lo stato inviato da handoffSend: registra gli utenti con le
+ *        loro history e restituisce le connessioni da adottare
+ *
+ * @param sock       socket restituito da handoffAccept
+ * @param listen_fd  dove copiare il socket di ascolto ricevuto
+ * @param users_db   struttura dati vuota in cui registrare gli utenti
+ * @param stats      dove copiare le statistiche ricevute
+ * @param conns      dove copiare l'array (allocato) delle connessioni ricevute
+ *
+ * @return numero di connessioni in conns, -1 errore
+ */
+int handoffRecv(int sock, int *listen_fd, users_db_t *users_db, struct statistics *stats, ho_conn_t **conns);
+
+#endif /* HANDOFF_H_ */
@@ -7,6 +7,8 @@
  *  originale dell'autore
  * 
  */
+#ifndef HISTORY_H_
+#define HISTORY_H_
 
 #include "message.h"
 #include <stdio.h>
@@ -72,4 +74,4 @@ int insertMsg(history_t *history, message_t *msg);
  */
 int outMsg(history_t *history, message_t ***msg_list);
 
-
+#endif /* HISTORY_H_ */
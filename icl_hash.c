@@ -14,39 +14,49 @@
 #include <assert.h>
 #include <limits.h>
 #include <math.h>
+#include <stdint.h>
 #include "icl_hash.h"
 
 
 
-#define BITS_IN_int     ( sizeof(int) * CHAR_BIT )
-#define THREE_QUARTERS  ((int) ((BITS_IN_int * 3) / 4))
-#define ONE_EIGHTH      ((int) (BITS_IN_int / 8))
-#define HIGH_BITS       ( ~((unsigned int)(~0) >> ONE_EIGHTH ))
+#define HASH_K1  0x9E3779B97F4A7C15ULL
+#define HASH_K2  0xC2B2AE3D27D4EB4FULL
+
+static inline uint64_t rotl64(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
 /**
- * A simple string hash.
- *
- * An adaptation of Peter Weinberger's (PJW) generic hashing
- * algorithm based on Allen Holub's version. Accepts a pointer
- * to a datum to be hashed and returns an unsigned integer.
- * From: Keith Seymour's proxy library code
+ * @function hash_words
+ * @brief Hash di una stringa letta 8 byte alla volta (i nomi utente sono al
+ *        piu' 32 byte, quindi 4 giri): ogni parola viene mescolata con
+ *        moltiplicazioni e rotazioni e il risultato finale rimescolato, cosi'
+ *        anche i bit bassi usati per bucket e sezione dipendono da tutta la
+ *        chiave. L'ultima parola, incompleta, viene completata con zeri
  *
- * @param[in] key -- the string to be hashed
+ * @param key  stringa da cui calcolare l'hash
  *
- * @returns the hash index
+ * @return valore hash
  */
-static unsigned int
-hash_pjw(void* key){
-    char *datum = (char *)key;
-    unsigned int hash_value, i;
-
-    if(!datum) return 0;
-
-    for (hash_value = 0; *datum; ++datum) {
-        hash_value = (hash_value << ONE_EIGHTH) + *datum;
-        if ((i = hash_value & HIGH_BITS) != 0)
-            hash_value = (hash_value ^ (i >> THREE_QUARTERS)) & ~HIGH_BITS;
+static unsigned int hash_words(void *key){
+    const unsigned char *p = key;
+    if(!p) return 0;
+
+    size_t len = strlen((const char *)p);
+    uint64_t h = len * HASH_K1, w;
+    for(; len >= sizeof(w); len -= sizeof(w), p += sizeof(w)){
+        memcpy(&w, p, sizeof(w));
+        h = rotl64(h ^ (w * HASH_K2), 31) * HASH_K1;
     }
-    return (hash_value);
+    if(len > 0){
+        w = 0;
+        memcpy(&w, p, len);
+        h = rotl64(h ^ (w * HASH_K2), 31) * HASH_K1;
+    }
+    h ^= h >> 33;
+    h *= HASH_K2;
+    h ^= h >> 29;
+    return (unsigned int)(h ^ (h >> 32));
 }
 
 static int string_compare(void* a, void* b) 
@@ -54,9 +64,217 @@ static int string_compare(void* a, void* b)
     return (strcmp( (char*)a, (char*)b ) == 0);
 }
 
+/**
+ * @function locksCreate
+ * @brief Crea un array di n mutex di sezione
+ */
+static icl_locks_t *locksCreate(int n){
+    icl_locks_t *l = malloc(sizeof(icl_locks_t) + n * sizeof(pthread_mutex_t));
+    if(!l) return NULL;
+    l->nsections = n;
+    l->retired = NULL;
+    for(int i = 0; i < n; i++) pthread_mutex_init(&(l->mutexes[i]), NULL);
+    return l;
+}
+
+/**
+ * @function sectionsFor
+ * @brief Numero di sezioni per una tabella di nbuckets bucket (potenza di 2)
+ */
+static int sectionsFor(int nbuckets){
+    return nbuckets >= ICL_SECTION_BUCKETS ? nbuckets / ICL_SECTION_BUCKETS : 1;
+}
+
+/**
+ * @function moveBucket
+ * @brief Sposta le chiavi del bucket b del vecchio array in quello nuovo
+ *        (m.e. della sezione di b presa)
+ */
+static void moveBucket(icl_hash_t *ht, int b){
+    icl_entry_t *curr = ht->old[b];
+    while(curr != NULL){
+        icl_entry_t *next = curr->next;
+        unsigned int nb = curr->hash & (ht->nbuckets - 1);
+        curr->next = ht->buckets[nb];
+        ht->buckets[nb] = curr;
+        curr = next;
+    }
+    ht->old[b] = NULL;
+}
+
+/**
+ * @function migrate
+ * @brief Migra al piu' steps bucket della sezione s (m.e. della sezione presa).
+ *        La sezione s del vecchio array sono i bucket s, s + nsections, ...
+ *
+ * @return 1 sezione completamente migrata, 0 altrimenti
+ */
+static int migrate(icl_hash_t *ht, int s, int steps){
+    int nsec = ht->locks->nsections;
+    int per = ht->nold / nsec;
+    while(steps-- > 0 && ht->cursor[s] < per){
+        moveBucket(ht, s + ht->cursor[s] * nsec);
+        if(++ht->cursor[s] == per && __atomic_add_fetch(&ht->ndone, 1, __ATOMIC_ACQ_REL) == nsec){
+            // Ultima sezione: il vecchio array va liberato
+            __atomic_store_n(&ht->maintain, 1, __ATOMIC_RELEASE);
+        }
+    }
+    return ht->cursor[s] == per;
+}
+
+/**
+ * @function settle
+ * @brief Durante un raddoppio migra il vecchio bucket della chiave con hash
+ *        h, cosi' la chiave si cerca solo nel nuovo array, e qualche altro
+ *        bucket della sua sezione. Se la sezione e' gia' migrata aiuta,
+ *        senza attendere, un'altra sezione (m.e. della sezione di h presa)
+ */
+static void settle(icl_hash_t *ht, unsigned int h){
+    if(ht->old == NULL) return;
+    unsigned int b = h & (ht->nold - 1);
+    if(ht->old[b] != NULL) moveBucket(ht, b);
+
+    icl_locks_t *l = ht->locks;
+    int s = h & (l->nsections - 1);
+    if(!migrate(ht, s, ICL_REHASH_STEP)) return;
+
+    int o = __atomic_fetch_add(&ht->help, 1, __ATOMIC_RELAXED) & (l->nsections - 1);
+    if(o != s && pthread_mutex_trylock(&(l->mutexes[o])) == 0){
+        migrate(ht, o, ICL_REHASH_STEP);
+        pthread_mutex_unlock(&(l->mutexes[o]));
+    }
+}
+
+/**
+ * @function maintain
+ * @brief Libera il vecchio array a migrazione completata e avvia un nuovo
+ *        raddoppio se la tabella e' troppo piena. Prende la m.e. di tutte
+ *        le sezioni per il solo scambio degli array: va chiamata senza
+ *        nessuna sezione presa
+ */
+static void maintain(icl_hash_t *ht){
+    if(!__atomic_exchange_n(&ht->maintain, 0, __ATOMIC_ACQ_REL)) return;
+
+    pthread_mutex_lock(&(ht->resize_mtx));
+    icl_locks_t *l = ht->locks;
+    for(int i = 0; i < l->nsections; i++) pthread_mutex_lock(&(l->mutexes[i]));
+
+    if(ht->old != NULL && ht->ndone == l->nsections){
+        free(ht->old);
+        free(ht->cursor);
+        ht->old = NULL;
+        ht->cursor = NULL;
+        ht->nold = 0;
+    }
+
+    int n = ht->nbuckets;
+    if(ht->old == NULL && __atomic_load_n(&ht->nentries, __ATOMIC_RELAXED) > n * ICL_MAX_LOAD && n <= INT_MAX / 2){
+        int nsec = sectionsFor(2 * n);
+        icl_entry_t **nb = calloc(2 * n, sizeof(icl_entry_t *));
+        int *cursor = calloc(nsec, sizeof(int));
+        icl_locks_t *nl = (nsec != l->nsections) ? locksCreate(nsec) : l;
+        if(nb && cursor && nl){
+            ht->old    = ht->buckets;
+            ht->nold   = n;
+            ht->cursor = cursor;
+            ht->ndone  = 0;
+            ht->buckets = nb;
+            __atomic_store_n(&ht->nbuckets, 2 * n, __ATOMIC_RELEASE);
+            if(nl != l){
+                // Chi attende su una mutex del vecchio array se ne accorge e riprova
+                nl->retired = l;
+                __atomic_store_n(&ht->locks, nl, __ATOMIC_RELEASE);
+            }
+        }else{
+            free(nb);
+            free(cursor);
+            if(nl && nl != l) free(nl);
+        }
+    }
+
+    for(int i = 0; i < l->nsections; i++) pthread_mutex_unlock(&(l->mutexes[i]));
+    pthread_mutex_unlock(&(ht->resize_mtx));
+}
+
+/**
+ * @function lockSection
+ * @brief Prende la m.e. della sezione dell'hash h
+ *
+ * @return mutex presa
+ */
+static pthread_mutex_t *lockSection(icl_hash_t *ht, unsigned int h){
+    while(1){
+        // Indice della mutex
+        icl_locks_t *l = __atomic_load_n(&ht->locks, __ATOMIC_ACQUIRE);
+        pthread_mutex_t *m = &(l->mutexes[h & (l->nsections - 1)]);
+        pthread_mutex_lock (m);
+        // Le sezioni sono state ridistribuite mentre attendevo
+        if(__atomic_load_n(&ht->locks, __ATOMIC_ACQUIRE) == l) return m;
+        pthread_mutex_unlock (m);
+    }
+}
+
+/**
+ * @function lookup
+ * @brief Cerca key nel bucket b confrontando prima gli hash memorizzati e
+ *        solo a hash uguali le chiavi (m.e. della sezione presa)
+ *
+ * @return puntatore al collegamento che punta all'elemento di key, o a
+ *         quello finale (NULL) del bucket se key non c'e'
+ */
+static icl_entry_t **lookup(icl_hash_t *ht, int b, unsigned int h, void *key){
+    icl_entry_t **link = &(ht->buckets[b]);
+    while(*link != NULL && ((*link)->hash != h || !ht->hash_key_compare((*link)->key, key)))
+        link = &((*link)->next);
+    return link;
+}
+
+/**
+ * @function insertAt
+ * @brief Inserisce key nel bucket b se non c'e' gia' (m.e. della sezione presa)
+ *
+ * @returns 0 successo, -1 chiave gia presente, -2 inserimento fallito
+ */
+static int insertAt(icl_hash_t *ht, int b, unsigned int h, void *key, void *data){
+    if(*lookup(ht, b, h, key) != NULL) return -1;
+
+    icl_entry_t *curr = (icl_entry_t*)malloc(sizeof(icl_entry_t));
+    if(!curr) return -2;
+    curr->key  = key;
+    curr->data = data;
+    curr->hash = h;
+    curr->next = ht->buckets[b]; /* add at start */
+    ht->buckets[b] = curr;
+
+    // Troppo piena: il raddoppio parte al rilascio della sezione
+    if(__atomic_add_fetch(&ht->nentries, 1, __ATOMIC_RELAXED) > ht->nbuckets * ICL_MAX_LOAD && ht->old == NULL)
+        __atomic_store_n(&ht->maintain, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * @function deleteAt
+ * @brief Elimina key dal bucket b (m.e. della sezione presa)
+ *
+ * @returns 0 successo, -1 chiave non presente
+ */
+static int deleteAt(icl_hash_t *ht, int b, unsigned int h, void *key, void (*free_key)(void*), void (*free_data)(void*)){
+    icl_entry_t **link = lookup(ht, b, h, key);
+    icl_entry_t *curr = *link;
+    if(curr == NULL) return -1;
+
+    *link = curr->next;
+    if (*free_key && curr->key) (*free_key)(curr->key);
+    if (*free_data && curr->data) (*free_data)(curr->data);
+    __atomic_sub_fetch(&ht->nentries, 1, __ATOMIC_RELAXED);
+    free(curr);
+    return 0;
+}
+
 /**
  * @function lock_hash_section
- * @brief Prende la m.e. della sezione della tabella relativa a key
+ * @brief Prende la m.e. della sezione della tabella relativa a key. Se la
+ *        tabella sta raddoppiando migra qualche bucket della sezione
  *
  * @param ht      tabella hash
  * @param key     chiave appartenente alla sezione su cui prendere la
@@ -67,16 +285,16 @@ static int string_compare(void* a, void* b)
 int lock_hash_section(icl_hash_t *ht, void* key){
     if(!ht || !key) return -1;
 
-    int hash_val = (* ht->hash_function)(key) % ht->nbuckets;
-    // Indice della mutex
-    unsigned int ind_mutex = hash_val % ht->nsections;
-    pthread_mutex_lock (&(ht->mutexes[ind_mutex]));
+    unsigned int hash_val = (* ht->hash_function)(key);
+    lockSection(ht, hash_val);
+    settle(ht, hash_val);
     return 0;
 }
 
 /**
  * @function unlock_hash_section
- * @brief Rilascia la m.e. della sezione della tabella relativa a key
+ * @brief Rilascia la m.e. della sezione della tabella relativa a key. Se
+ *        serve, libera il vecchio array o avvia un raddoppio della tabella
  *
  * @param ht      tabella hash
  * @param key     chiave appartenente alla sezione su cui rilasciare la
@@ -87,10 +305,79 @@ int lock_hash_section(icl_hash_t *ht, void* key){
 int unlock_hash_section(icl_hash_t *ht, void* key){
     if(!ht || !key) return -1;
 
-    int hash_val = (* ht->hash_function)(key) % ht->nbuckets;
-    // Calcolo indice della mutex
-    unsigned int ind_mutex = hash_val % ht->nsections;
-    pthread_mutex_unlock (&(ht->mutexes[ind_mutex]));
+    unsigned int hash_val = (* ht->hash_function)(key);
+    // Calcolo indice della mutex: con una sezione presa l'array non cambia
+    icl_locks_t *l = ht->locks;
+    pthread_mutex_unlock (&(l->mutexes[hash_val & (l->nsections - 1)]));
+    if(__atomic_load_n(&ht->maintain, __ATOMIC_ACQUIRE)) maintain(ht);
+    return 0;
+}
+
+/**
+ * @function icl_hash_lock_find
+ * @brief Calcola una sola volta l'hash di key, prende la m.e. della sua
+ *        sezione e cerca key. In ref restano hash, bucket e mutex della
+ *        sezione per le operazioni *_ref successive sulla stessa chiave e per
+ *        icl_hash_unlock_ref
+ *
+ * @param ht      tabella hash
+ * @param key     chiave da cercare
+ * @param ref     dove memorizzare hash, bucket e sezione di key
+ *
+ * @return dati associati a key, NULL se key non c'e' o in caso di errore
+ *         (ref->mutex NULL, nessuna m.e. presa)
+ */
+void *icl_hash_lock_find(icl_hash_t *ht, void *key, icl_ref_t *ref){
+    if(!ref) return NULL;
+    ref->mutex = NULL;
+    if(!ht || !key) return NULL;
+
+    ref->hash  = (* ht->hash_function)(key);
+    ref->mutex = lockSection(ht, ref->hash);
+    settle(ht, ref->hash);
+    // Con la sezione presa la tabella non raddoppia: il bucket resta valido
+    ref->bucket = ref->hash & (ht->nbuckets - 1);
+
+    icl_entry_t *curr = *lookup(ht, ref->bucket, ref->hash, key);
+    return curr != NULL ? curr->data : NULL;
+}
+
+/**
+ * @function icl_hash_insert_ref
+ * @brief Inserisce key nella sezione presa con icl_hash_lock_find sulla
+ *        stessa chiave (key puo' esserne una copia)
+ *
+ * @returns 0 successo, -1 utente gia registrato, -2 inserimento fallito
+ */
+int icl_hash_insert_ref(icl_hash_t *ht, icl_ref_t *ref, void *key, void *data){
+    if(!ht || !ref || !ref->mutex || !key) return -2;
+    return insertAt(ht, ref->bucket, ref->hash, key, data);
+}
+
+/**
+ * @function icl_hash_delete_ref
+ * @brief Elimina key dalla sezione presa con icl_hash_lock_find sulla
+ *        stessa chiave (key e data liberati con le funzioni date)
+ *
+ * @returns 0 successo, -1 fallimento
+ */
+int icl_hash_delete_ref(icl_hash_t *ht, icl_ref_t *ref, void *key, void (*free_key)(void*), void (*free_data)(void*)){
+    if(!ht || !ref || !ref->mutex || !key) return -1;
+    return deleteAt(ht, ref->bucket, ref->hash, key, free_key, free_data);
+}
+
+/**
+ * @function icl_hash_unlock_ref
+ * @brief Rilascia la sezione presa con icl_hash_lock_find. Se serve, libera
+ *        il vecchio array o avvia un raddoppio della tabella
+ *
+ * @return -1 fallimento, 0 successo
+ */
+int icl_hash_unlock_ref(icl_hash_t *ht, icl_ref_t *ref){
+    if(!ht || !ref || !ref->mutex) return -1;
+    pthread_mutex_unlock (ref->mutex);
+    ref->mutex = NULL;
+    if(__atomic_load_n(&ht->maintain, __ATOMIC_ACQUIRE)) maintain(ht);
     return 0;
 }
 
@@ -104,8 +391,9 @@ int unlock_hash_section(icl_hash_t *ht, void* key){
  */
 int lock_hash(icl_hash_t *ht){
     if(!ht) return -1;
-    for(int i = 0; i < ht->nsections; i++){
-        pthread_mutex_lock (&(ht->mutexes[i]));
+    pthread_mutex_lock(&(ht->resize_mtx));
+    for(int i = 0; i < ht->locks->nsections; i++){
+        pthread_mutex_lock (&(ht->locks->mutexes[i]));
     }
     return 0;
 }
@@ -120,9 +408,10 @@ int lock_hash(icl_hash_t *ht){
  */
 int unlock_hash(icl_hash_t *ht){
     if(!ht) return -1;
-    for(int i = 0; i < ht->nsections; i++){
-        pthread_mutex_unlock (&(ht->mutexes[i]));
+    for(int i = 0; i < ht->locks->nsections; i++){
+        pthread_mutex_unlock (&(ht->locks->mutexes[i]));
     }
+    pthread_mutex_unlock(&(ht->resize_mtx));
     return 0;
 }
 
@@ -130,7 +419,7 @@ int unlock_hash(icl_hash_t *ht){
  * @function icl_hash_create
  * @brief Create a new hash table.
  *
- * @param[in] nbuckets -- number of buckets to create
+ * @param[in] nbuckets -- initial number of buckets (rounded up to a power of 2)
  * @param[in] hash_function -- pointer to the hashing function to be used
  * @param[in] hash_key_compare -- pointer to the hash key comparison function to be used
  *
@@ -140,32 +429,27 @@ int unlock_hash(icl_hash_t *ht){
 icl_hash_t * icl_hash_create( int nbuckets, unsigned int (*hash_function)(void*), int (*hash_key_compare)(void*, void*) ){
     icl_hash_t *ht;
     int i;
-    ht = (icl_hash_t*) malloc(sizeof(icl_hash_t));
+    ht = (icl_hash_t*) calloc(1, sizeof(icl_hash_t));
     if(!ht) return NULL;
+
+    // Bucket e sezioni potenze di 2: l'indice e' una maschera dell'hash
+    int n = 1;
+    while(n < nbuckets && n <= INT_MAX / 2) n <<= 1;
     
     ht->nentries = 0;
-    ht->nbuckets = nbuckets;
-    if(nbuckets >= 64) ht->nsections = nbuckets / 64;
-    else {
-        ht->nsections = 1;
-    }
-    
-    ht->mutexes = (pthread_mutex_t*)malloc(ht->nsections * sizeof(pthread_mutex_t));
-    ht->buckets = (icl_entry_t**)malloc(nbuckets * sizeof(icl_entry_t*));
-    if(!ht->mutexes) return NULL; 
+    ht->nbuckets = n;
+    ht->locks = locksCreate(sectionsFor(n));
+    ht->buckets = (icl_entry_t**)malloc(n * sizeof(icl_entry_t*));
+    if(!ht->locks) return NULL; 
     if(!ht->buckets) return NULL; 
 
     for(i=0;i<ht->nbuckets;i++)
         ht->buckets[i] = NULL;
 
-    ht->hash_function = hash_function ? hash_function : hash_pjw;
+    ht->hash_function = hash_function ? hash_function : hash_words;
     ht->hash_key_compare = hash_key_compare ? hash_key_compare : string_compare;
 
-    // Inizializzazione mutex 
-    for(int i=0; i < ht->nsections; i++){
-        pthread_mutex_init( &(ht->mutexes[i]), NULL );
-    }
-
+    pthread_mutex_init(&(ht->resize_mtx), NULL);
     return ht;
 }
 
@@ -187,14 +471,11 @@ void * icl_hash_find(icl_hash_t *ht, void* key){
     if(!ht || !key) return NULL;
 
     // Calcolo valore hash
-    hash_val = (* ht->hash_function)(key) % ht->nbuckets;
-    
-    for (curr=ht->buckets[hash_val]; curr != NULL; curr=curr->next)
-        if ( ht->hash_key_compare(curr->key, key)){
-            return(curr->data);
-        }
+    hash_val = (* ht->hash_function)(key);
+    settle(ht, hash_val);
 
-    return NULL;
+    curr = *lookup(ht, hash_val & (ht->nbuckets - 1), hash_val, key);
+    return curr != NULL ? curr->data : NULL;
 }
 
 /**
@@ -209,30 +490,13 @@ void * icl_hash_find(icl_hash_t *ht, void* key){
  */
 
 int icl_hash_insert(icl_hash_t *ht, void* key, void *data){
-    icl_entry_t *curr;
     unsigned int hash_val;
 
     if(!ht || !key) return -2;
 
-    hash_val = (* ht->hash_function)(key) % ht->nbuckets;
-
-    for (curr=ht->buckets[hash_val]; curr != NULL; curr=curr->next)
-        if ( ht->hash_key_compare(curr->key, key)){
-            return -1; /* key already exists */
-    }
-    /* if key was not found */
-    curr = (icl_entry_t*)malloc(sizeof(icl_entry_t));
-    if(!curr){
-        return -2;
-    }
-
-    curr->key = key;
-    curr->data = data;
-    curr->next = ht->buckets[hash_val]; /* add at start */
-
-    ht->buckets[hash_val] = curr;
-    ht->nentries++;
-    return 0;
+    hash_val = (* ht->hash_function)(key);
+    settle(ht, hash_val);
+    return insertAt(ht, hash_val & (ht->nbuckets - 1), hash_val, key, data);
 }
 
 /**
@@ -247,31 +511,12 @@ int icl_hash_insert(icl_hash_t *ht, void* key, void *data){
  * @returns 0 on success, -1 on failure.
  */
 int icl_hash_delete(icl_hash_t *ht, void* key, void (*free_key)(void*), void (*free_data)(void*)){
-    icl_entry_t *curr, *prev;
     unsigned int hash_val;
 
     if(!ht || !key) return -1;
-    hash_val = (* ht->hash_function)(key) % ht->nbuckets;
-
-    prev = NULL;
-    for (curr=ht->buckets[hash_val]; curr != NULL; )  {
-        if ( ht->hash_key_compare(curr->key, key)) {
-            if (prev == NULL) {
-                ht->buckets[hash_val] = curr->next;
-            } else {
-                prev->next = curr->next;
-            }
-            if (*free_key && curr->key) (*free_key)(curr->key);
-            if (*free_data && curr->data) (*free_data)(curr->data);
-            ht->nentries--;
-            free(curr);
-    
-            return 0;
-        }
-        prev = curr;
-        curr = curr->next;
-    }
-    return -1;
+    hash_val = (* ht->hash_function)(key);
+    settle(ht, hash_val);
+    return deleteAt(ht, hash_val & (ht->nbuckets - 1), hash_val, key, free_key, free_data);
 }
 
 /**
@@ -290,10 +535,23 @@ int icl_hash_destroy(icl_hash_t *ht, void (*free_key)(void*), void (*free_data)(
 
     if(!ht) return -1;
 
-    // Distriggo le lock
-    for(i=0; i < ht->nsections; i++)
-        pthread_mutex_destroy (&(ht->mutexes[i]));
-    free(ht->mutexes);
+    // Distriggo le lock, anche quelle degli array sostituiti
+    icl_locks_t *l = ht->locks;
+    while(l != NULL){
+        icl_locks_t *next = l->retired;
+        for(i=0; i < l->nsections; i++)
+            pthread_mutex_destroy (&(l->mutexes[i]));
+        free(l);
+        l = next;
+    }
+    pthread_mutex_destroy(&(ht->resize_mtx));
+
+    // Chiavi non ancora migrate
+    for (i=0; ht->old != NULL && i<ht->nold; i++) {
+        if(ht->old[i] != NULL) moveBucket(ht, i);
+    }
+    free(ht->old);
+    free(ht->cursor);
 
     for (i=0; i<ht->nbuckets; i++) {
         bucket = ht->buckets[i];
@@ -311,3 +569,20 @@ int icl_hash_destroy(icl_hash_t *ht, void (*free_key)(void*), void (*free_data)(
 
     return 0;
 }
+
+/**
+ * @function icl_hash_load
+ * @brief Dimensione e riempimento della tabella, letti senza mutua esclusione
+ *
+ * @param ht        tabella hash
+ * @param nbuckets  dove scrivere il numero di bucket
+ *
+ * @return elementi per 100 bucket (fattore di carico in centesimi)
+ */
+unsigned long icl_hash_load(icl_hash_t *ht, unsigned long *nbuckets){
+    if(!ht) return 0;
+    unsigned long n = __atomic_load_n(&ht->nbuckets, __ATOMIC_ACQUIRE);
+    unsigned long e = __atomic_load_n(&ht->nentries, __ATOMIC_RELAXED);
+    if(nbuckets) *nbuckets = n;
+    return n > 0 ? e * 100 / n : 0;
+}
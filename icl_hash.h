@@ -22,19 +22,83 @@ extern "C" {
 typedef struct icl_entry_s {
     void* key;
     void *data;
+    unsigned int hash;      // Hash di key: evita di ricalcolarlo migrando e di confrontare chiavi con hash diverso
     struct icl_entry_s* next;
 } icl_entry_t;
 
+/*
+ * Chiave cercata con icl_hash_lock_find: hash calcolato una volta sola,
+ * bucket e mutex della sezione presa
+ */
+typedef struct icl_ref_s {
+    unsigned int hash;
+    int bucket;
+    pthread_mutex_t *mutex;
+} icl_ref_t;
+
+#define ICL_SECTION_BUCKETS  64   // Bucket per sezione (mutex)
+#define ICL_MAX_LOAD         1    // Elementi per bucket oltre cui la tabella raddoppia
+#define ICL_REHASH_STEP      4    // Bucket migrati ad ogni operazione durante il raddoppio
+
+/*
+ * Mutex delle sezioni: la sezione di un bucket sono i suoi bit bassi, cosi'
+ * un bucket e i due in cui si divide raddoppiando la tabella stanno nella
+ * stessa sezione. Un array sostituito da uno piu' grande resta allocato
+ * (retired) fino alla distruzione della tabella perche' qualche thread
+ * potrebbe ancora essere in attesa su una delle sue mutex
+ */
+typedef struct icl_locks_s {
+    int nsections;
+    struct icl_locks_s *retired;
+    pthread_mutex_t mutexes[];
+} icl_locks_t;
+
+/*
+ * Durante un raddoppio le chiavi sono divise tra old (nold bucket) e
+ * buckets: ogni operazione su una chiave ne migra prima il vecchio bucket
+ * e poi qualche altro bucket della stessa sezione (cursor), quindi trova la
+ * chiave sempre in buckets. Il vecchio array viene liberato quando tutte le
+ * sezioni sono state migrate (ndone)
+ */
 typedef struct icl_hash_s {
-    pthread_mutex_t *mutexes;
+    icl_locks_t *locks;
     int nbuckets;
     int nentries;
-    int nsections;
     icl_entry_t **buckets;
+    icl_entry_t **old;
+    int nold;
+    int *cursor;
+    int ndone;
+    int help;
+    int maintain;
+    pthread_mutex_t resize_mtx;
     unsigned int (*hash_function)(void*);
     int (*hash_key_compare)(void*, void*);
 } icl_hash_t;
 
+/**
+ * @function icl_hash_group
+ * @brief Catene di un gruppo di bucket: durante un raddoppio il bucket g del
+ *        vecchio array e i due (g e g + nold) in cui si divide, altrimenti il
+ *        solo bucket g. Le chiavi di un gruppo non ne escono durante la
+ *        migrazione, quindi scorrere i gruppi non salta ne' ripete elementi
+ *
+ * @param ht      tabella hash
+ * @param g       gruppo (0 .. icl_hash_ngroups-1)
+ * @param k       catena del gruppo (0 .. 2)
+ *
+ * @return testa della catena, NULL se vuota o inesistente
+ */
+static inline icl_entry_t *icl_hash_group(icl_hash_t *ht, int g, int k){
+    if(ht->old == NULL) return k == 0 ? ht->buckets[g] : NULL;
+    if(k == 0) return ht->old[g];
+    return ht->buckets[k == 1 ? g : g + ht->nold];
+}
+
+static inline int icl_hash_ngroups(icl_hash_t *ht){
+    return ht->old != NULL ? ht->nold : ht->nbuckets;
+}
+
 /**
  * @function lock_hash_section
  * @brief Prende la m.e. della sezione della tabella relativa a key
@@ -79,6 +143,27 @@ int lock_hash(icl_hash_t *ht);
  */
 int unlock_hash(icl_hash_t *ht);
 
+/**
+ * @function icl_hash_lock_find
+ * @brief Prende la m.e. della sezione di key e cerca key calcolandone
+ *        l'hash una sola volta. Le operazioni successive sulla stessa chiave
+ *        usano ref e la sezione si rilascia con icl_hash_unlock_ref
+ *
+ * @param ht      tabella hash
+ * @param key     chiave da cercare
+ * @param ref     dove memorizzare hash, bucket e sezione di key
+ *
+ * @return dati associati a key, NULL se key non c'e' o in caso di errore
+ *         (ref->mutex NULL, nessuna m.e. presa)
+ */
+void *icl_hash_lock_find(icl_hash_t *ht, void *key, icl_ref_t *ref);
+
+int icl_hash_insert_ref(icl_hash_t *ht, icl_ref_t *ref, void *key, void *data);
+
+int icl_hash_delete_ref(icl_hash_t *ht, icl_ref_t *ref, void *key, void (*free_key)(void*), void (*free_data)(void*));
+
+int icl_hash_unlock_ref(icl_hash_t *ht, icl_ref_t *ref);
+
 icl_hash_t * icl_hash_create( int nbuckets, unsigned int (*hash_function)(void*), int (*hash_key_compare)(void*, void*) );
 
 void * icl_hash_find(icl_hash_t *, void* );
@@ -89,35 +174,55 @@ int icl_hash_destroy(icl_hash_t *, void (*)(void*), void (*)(void*));
 
 int icl_hash_delete( icl_hash_t *ht, void* key, void (*free_key)(void*), void (*free_data)(void*) );
 
+/**
+ * @function icl_hash_load
+ * @brief Dimensione e riempimento della tabella, letti senza mutua esclusione
+ *
+ * @param ht        tabella hash
+ * @param nbuckets  dove scrivere il numero di bucket
+ *
+ * @return elementi per 100 bucket (fattore di carico in centesimi)
+ */
+unsigned long icl_hash_load(icl_hash_t *ht, unsigned long *nbuckets);
+
 
 //Permette di scorrere la tabella 
 #define icl_hash_foreach(ht, dp, code)                                           \
-    int tmpint;                                                                  \
+    int tmpint, tmpk;                                                            \
     icl_entry_t *tmpent;                                                         \
     char *kp;                                                                    \
-    for (tmpint=0;tmpint<ht->nbuckets; tmpint++){                                \
-        for (tmpent=ht->buckets[tmpint];                                         \
-             tmpent!=NULL&&((kp=tmpent->key)!=NULL)&&((dp=tmpent->data)!=NULL);  \
-             tmpent=tmpent->next){                                               \
-                code                                                             \
-            };                   \
+    for (tmpint=0;tmpint<icl_hash_ngroups(ht); tmpint++){                        \
+        for (tmpk=0; tmpk<3; tmpk++){                                            \
+            for (tmpent=icl_hash_group(ht, tmpint, tmpk);                        \
+                 tmpent!=NULL&&((kp=tmpent->key)!=NULL)&&((dp=tmpent->data)!=NULL); \
+                 tmpent=tmpent->next){                                           \
+                    code                                                         \
+                };                                                               \
+        }                                                                        \
     }
 
 
-//Permette di scorrere la tabella in mutua esclusione 
+//Permette di scorrere la tabella in mutua esclusione, un gruppo di bucket
+//alla volta. Per tutto lo scorrimento la tabella non viene ridimensionata
 #define icl_hash_foreach_mutex(ht, dp, code)                                     \
-    int tmpint;                                                                  \
+    int tmpint, tmpk;                                                            \
     icl_entry_t *tmpent;                                                         \
     char *kp;                                                                    \
-    for (tmpint=0;tmpint<ht->nbuckets; tmpint++){                                \
-        unsigned int ind_mutex = tmpint % ht->nsections;                         \
-        pthread_mutex_lock (&(ht->mutexes[ind_mutex]));                          \
-        for (tmpent=ht->buckets[tmpint];                                         \
-             tmpent!=NULL&&((kp=tmpent->key)!=NULL)&&((dp=tmpent->data)!=NULL);  \
-             tmpent=tmpent->next){                                               \
-                code                                                             \
-            }pthread_mutex_unlock (&(ht->mutexes[ind_mutex]));                   \
-    }
+    pthread_mutex_lock(&(ht->resize_mtx));                                       \
+    for (tmpint=0;tmpint<icl_hash_ngroups(ht); tmpint++){                        \
+        pthread_mutex_t *tmpmtx =                                                \
+            &(ht->locks->mutexes[tmpint & (ht->locks->nsections - 1)]);          \
+        pthread_mutex_lock (tmpmtx);                                             \
+        for (tmpk=0; tmpk<3; tmpk++){                                            \
+            for (tmpent=icl_hash_group(ht, tmpint, tmpk);                        \
+                 tmpent!=NULL&&((kp=tmpent->key)!=NULL)&&((dp=tmpent->data)!=NULL); \
+                 tmpent=tmpent->next){                                           \
+                    code                                                         \
+                }                                                                \
+        }                                                                        \
+        pthread_mutex_unlock (tmpmtx);                                           \
+    }                                                                            \
+    pthread_mutex_unlock(&(ht->resize_mtx));
 
 #if defined(c_plusplus) || defined(__cplusplus)
 }
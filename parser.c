@@ -72,6 +72,33 @@ int parsing(char* path, struct serverConf *conf){
             else if(strncmp(param, "MaxHistMsgs", strlen("MaxHistMsgs")) == 0){
                 conf->MaxHistMsgs = strtol(val, NULL, 10);
             }
+            else if(strncmp(param, "ReactorThreads", strlen("ReactorThreads")) == 0){
+                conf->ReactorThreads = strtol(val, NULL, 10);
+            }
+            else if(strncmp(param, "IoUring", strlen("IoUring")) == 0){
+                conf->IoUring = strtol(val, NULL, 10);
+            }
+            else if(strncmp(param, "WorkStealing", strlen("WorkStealing")) == 0){
+                conf->WorkStealing = strtol(val, NULL, 10);
+            }
+            else if(strncmp(param, "MinThreads", strlen("MinThreads")) == 0){
+                conf->MinThreads = strtol(val, NULL, 10);
+            }
+            else if(strncmp(param, "MaxThreads", strlen("MaxThreads")) == 0){
+                conf->MaxThreads = strtol(val, NULL, 10);
+            }
+            else if(strncmp(param, "BulkShare", strlen("BulkShare")) == 0){
+                conf->BulkShare = strtol(val, NULL, 10);
+            }
+            else if(strncmp(param, "IoThreads", strlen("IoThreads")) == 0){
+                conf->IoThreads = strtol(val, NULL, 10);
+            }
+            else if(strncmp(param, "SpinWaitUs", strlen("SpinWaitUs")) == 0){
+                conf->SpinWaitUs = strtol(val, NULL, 10);
+            }
+            else if(strncmp(param, "HandoffPath", strlen("HandoffPath")) == 0){
+                strncpy(conf->HandoffPath, val, valSize + 1);
+            }
         }
     }
     fclose(fd);
@@ -23,6 +23,15 @@
 * @var MaxMsgSize           Dimensione massima di un messaggio testuale (numero di caratteri)
 * @var MaxFileSize          Dimensione massima di un file accettato dal server (kilobytes)
 * @var MaxHistMsgs;         Numero massimo di messaggi che il server ’ricorda’ per ogni client
+* @var ReactorThreads       Numero di event loop tra cui vengono ripartite le connessioni
+* @var IoUring              1 per raggruppare con io_uring letture dei reactor, consegne e I/O su disco
+* @var WorkStealing         1 per una coda per worker con furto del lavoro, 0 per la coda FIFO condivisa
+* @var MinThreads           Numero minimo di thread nel pool (0 = ThreadsInPool)
+* @var MaxThreads           Numero massimo di thread nel pool (0 = ThreadsInPool)
+* @var BulkShare            Percentuale dei worker che serve insieme POSTFILE, GETFILE e GETPREVMSGS (0 = nessuna corsia)
+* @var IoThreads            Numero di thread per l'apertura e la scrittura dei file (0 = eseguite dai worker)
+* @var SpinWaitUs           Microsecondi di attesa attiva di un worker senza lavoro prima di sospendersi (0 = nessuna)
+* @var HandoffPath          Socket su cui un nuovo server (avviato con -u) riceve lo stato di quello in esecuzione
 */
 struct serverConf {
     char UnixPath[MAX_LINESIZE];      
@@ -33,6 +42,15 @@ struct serverConf {
     int MaxMsgSize;                    
     int MaxFileSize;                   
     int MaxHistMsgs;                  
+    int ReactorThreads;
+    int IoUring;
+    int WorkStealing;
+    int MinThreads;
+    int MaxThreads;
+    int BulkShare;
+    int IoThreads;
+    int SpinWaitUs;
+    char HandoffPath[MAX_LINESIZE];
 };
 
 /**
@@ -3,85 +3,199 @@
  * @brief File di implementazione dell'interfaccia per la coda
  */
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <queue.h>
 
-static pthread_mutex_t qlock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  qcond = PTHREAD_COND_INITIALIZER;
-
-static Node_t *allocNode()         { return malloc(sizeof(Node_t));  }
-static Queue_t *allocQueue()       { return malloc(sizeof(Queue_t)); }
-static void freeNode(Node_t *node) { free((void*)node); }
-static void LockQueue()            { pthread_mutex_lock(&qlock);   }
-static void UnlockQueue()          { pthread_mutex_unlock(&qlock); }
-static void UnlockQueueAndWait()   { pthread_cond_wait(&qcond, &qlock); }
-static void UnlockQueueAndSignal() {
-    pthread_cond_signal(&qcond);
-    pthread_mutex_unlock(&qlock);
+#define LOAD(p)         __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v)     __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define CAS(p, e, v)    __atomic_compare_exchange_n((p), (e), (v), 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+
+static void LockQueue(Queue_t *q)            { pthread_mutex_lock(&q->qlock);   }
+static void UnlockQueue(Queue_t *q)          { pthread_mutex_unlock(&q->qlock); }
+static void UnlockQueueAndWait(Queue_t *q)   { pthread_cond_wait(&q->qcond, &q->qlock); }
+static void UnlockQueueAndSignal(Queue_t *q) {
+    pthread_cond_signal(&q->qcond);
+    pthread_mutex_unlock(&q->qlock);
 }
 
 /* ------------------- interfaccia della coda ------------------ */
 
+/* Tenta un inserimento senza bloccarsi: 0 successo, -1 coda piena */
+int tryPush(Queue_t *q, long data) {
+    unsigned long pos = __atomic_load_n(&q->enq, __ATOMIC_RELAXED);
+    Cell_t *c;
+    while(1) {
+        c = &q->buf[pos & q->mask];
+        long dif = (long)LOAD(&c->seq) - (long)pos;
+        if (dif == 0) {
+            // Cella libera: la prenoto spostando l'indice di inserimento
+            if (CAS(&q->enq, &pos, pos + 1)) break;
+        }
+        else if (dif < 0) return -1;
+        else pos = __atomic_load_n(&q->enq, __ATOMIC_RELAXED);
+    }
+    c->data = data;
+    STORE(&c->seq, pos + 1);
+    return 0;
+}
+
+/* Tenta un'estrazione senza bloccarsi: 0 successo, -1 coda vuota */
+int tryPop(Queue_t *q, long *data) {
+    unsigned long pos = __atomic_load_n(&q->deq, __ATOMIC_RELAXED);
+    Cell_t *c;
+    while(1) {
+        c = &q->buf[pos & q->mask];
+        long dif = (long)LOAD(&c->seq) - (long)(pos + 1);
+        if (dif == 0) {
+            if (CAS(&q->deq, &pos, pos + 1)) break;
+        }
+        else if (dif < 0) return -1;
+        else pos = __atomic_load_n(&q->deq, __ATOMIC_RELAXED);
+    }
+    *data = c->data;
+    // La cella torna libera per il giro successivo del buffer
+    STORE(&c->seq, pos + q->mask + 1);
+    return 0;
+}
+
+/* Inserisce senza bloccarsi fino a n dati in celle consecutive, prenotate
+ * con un solo CAS sull'indice di inserimento: ritorna quanti ne ha inseriti */
+int tryPushMany(Queue_t *q, long *data, int n) {
+    unsigned long pos = __atomic_load_n(&q->enq, __ATOMIC_RELAXED);
+    long k;
+    do {
+        // Celle libere: quelle gia' prenotate dai consumatori del giro precedente
+        k = (long)(LOAD(&q->deq) + q->mask + 1 - pos);
+        if (k <= 0) return 0;
+        if (k > n) k = n;
+    } while (!CAS(&q->enq, &pos, pos + k));
+
+    for (long i = 0; i < k; i++) {
+        Cell_t *c = &q->buf[(pos + i) & q->mask];
+        // Il consumatore che ha prenotato la cella sta finendo di leggerla
+        while (LOAD(&c->seq) != pos + i) sched_yield();
+        c->data = data[i];
+        STORE(&c->seq, pos + i + 1);
+    }
+    return (int)k;
+}
+
+/* Estrae senza bloccarsi fino a n dati da celle consecutive, prenotate
+ * con un solo CAS sull'indice di estrazione: ritorna quanti ne ha estratti */
+int tryPopMany(Queue_t *q, long *data, int n) {
+    unsigned long pos = __atomic_load_n(&q->deq, __ATOMIC_RELAXED);
+    long k;
+    do {
+        k = (long)(LOAD(&q->enq) - pos);
+        if (k <= 0) return 0;
+        if (k > n) k = n;
+    } while (!CAS(&q->deq, &pos, pos + k));
+
+    for (long i = 0; i < k; i++) {
+        Cell_t *c = &q->buf[(pos + i) & q->mask];
+        // Il produttore che ha prenotato la cella sta finendo di scriverla
+        while (LOAD(&c->seq) != pos + i + 1) sched_yield();
+        data[i] = c->data;
+        STORE(&c->seq, pos + i + q->mask + 1);
+    }
+    return (int)k;
+}
+
 Queue_t *initQueue() {
-    Queue_t *q = allocQueue();
+    Queue_t *q = calloc(1, sizeof(Queue_t));
     if (!q) return NULL;
-    q->head = allocNode();
-    if (!q->head) return NULL;
-    q->head->data = NULL; 
-    q->head->next = NULL;
-    q->tail = q->head;    
-    q->qlen = 0;
+    q->buf = malloc(QUEUE_SIZE * sizeof(Cell_t));
+    if (!q->buf) {
+        free(q);
+        return NULL;
+    }
+    for(unsigned long i = 0; i < QUEUE_SIZE; i++) q->buf[i].seq = i;
+    q->mask = QUEUE_SIZE - 1;
+    if (pthread_mutex_init(&q->qlock, NULL) != 0) return NULL;
+    if (pthread_cond_init(&q->qcond, NULL) != 0) return NULL;
     return q;
 }
 
 void deleteQueue(Queue_t *q) {
-    while(q->head != q->tail) {
-	    Node_t *p = (Node_t*)q->head;
-	    q->head = q->head->next;
-        freeNode(p);
-    }
-    if (q->head) freeNode((void*)q->head);
+    pthread_mutex_destroy(&q->qlock);
+    pthread_cond_destroy(&q->qcond);
+    free(q->buf);
     free(q);
 }
 
-int push(Queue_t *q, void *data) {
-    assert(data != NULL);
-    Node_t *n = allocNode();
-    n->data = data; 
-    n->next = NULL;
-    LockQueue();
-    q->tail->next = n;
-    q->tail       = n;
-    q->qlen      += 1;
-    UnlockQueueAndSignal();
+int push(Queue_t *q, long data) {
+    // Coda piena: ogni fd e' in coda al piu' una volta, capita solo con
+    // piu' di QUEUE_SIZE connessioni pronte insieme
+    while (tryPush(q, data) == -1) sched_yield();
+
+    // Il dato e' pubblicato prima di controllare se ci sono consumatori sospesi
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->waiters, __ATOMIC_RELAXED) > 0) {
+        LockQueue(q);
+        UnlockQueueAndSignal(q);
+    }
     return 0;
 }
 
-void *pop(Queue_t *q) {        
-    LockQueue();
-    while(q->head == q->tail) {
-	    UnlockQueueAndWait();
+int pushMany(Queue_t *q, long *data, int n) {
+    int done = 0;
+    while (done < n) {
+        int k = tryPushMany(q, data + done, n - done);
+        if (k == 0) sched_yield();
+        done += k;
+    }
+
+    // Un solo controllo dei consumatori sospesi per tutto il gruppo
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->waiters, __ATOMIC_RELAXED) > 0) {
+        LockQueue(q);
+        if (n > 1) pthread_cond_broadcast(&q->qcond);
+        else pthread_cond_signal(&q->qcond);
+        UnlockQueue(q);
     }
-    // locked
-    assert(q->head->next);
-    Node_t *n  = (Node_t *)q->head;
-    void *data = (q->head->next)->data;
-    q->head    = q->head->next;
-    q->qlen   -= 1;
-    assert(q->qlen>=0);
-    UnlockQueue();
-    freeNode(n);
+    return 0;
+}
+
+long pop(Queue_t *q) {
+    long data;
+    if (tryPop(q, &data) == 0) return data;
+
+    // Coda vuota: mi registro come consumatore sospeso e ricontrollo,
+    // un push concorrente mi vede oppure io vedo il suo dato
+    LockQueue(q);
+    __atomic_add_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (tryPop(q, &data) == -1) {
+	    UnlockQueueAndWait(q);
+    }
+    __atomic_sub_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+    UnlockQueue(q);
     return data;
-} 
+}
+
+int popMany(Queue_t *q, long *data, int n) {
+    int k = tryPopMany(q, data, n);
+    if (k > 0) return k;
+
+    LockQueue(q);
+    __atomic_add_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while ((k = tryPopMany(q, data, n)) == 0) {
+	    UnlockQueueAndWait(q);
+    }
+    __atomic_sub_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+    UnlockQueue(q);
+    return k;
+}
 
 // accesso in sola lettura non in mutua esclusione
 unsigned long length(Queue_t *q) {
-    unsigned long len = q->qlen;
+    unsigned long len = LOAD(&q->enq) - LOAD(&q->deq);
     return len;
 }
-
-
@@ -1,28 +1,42 @@
 #ifndef QUEUE_H_
 #define QUEUE_H_
 
-/** Elemento della coda.
+#include <pthread.h>
+
+#define QUEUE_SIZE  4096    // Elementi della coda (potenza di 2)
+#define CACHE_LINE  64
+
+/** Elemento della coda: il numero di sequenza dice se la cella e'
+ *  libera per il prossimo push o piena per il prossimo pop.
  *
  */
-typedef struct Node {
-    void        * data;
-    struct Node * next;
-} Node_t;
+typedef struct Cell {
+    unsigned long  seq;
+    long           data;
+} Cell_t;
 
-/** Struttura dati coda.
+/** Struttura dati coda: buffer circolare limitato senza lock per piu'
+ *  produttori e piu' consumatori. Gli indici di inserimento ed estrazione
+ *  stanno su linee di cache diverse. I consumatori si sospendono sulla
+ *  condition variable solo quando la coda e' vuota.
  *
  */
 typedef struct Queue {
-    Node_t        *head;
-    Node_t        *tail;
-    unsigned long  qlen;
+    unsigned long    enq;
+    char             pad0[CACHE_LINE - sizeof(unsigned long)];
+    unsigned long    deq;
+    char             pad1[CACHE_LINE - sizeof(unsigned long)];
+    int              waiters;
+    char             pad2[CACHE_LINE - sizeof(int)];
+    Cell_t          *buf;
+    unsigned long    mask;
+    pthread_mutex_t  qlock;
+    pthread_cond_t   qcond;
 } Queue_t;
 
 
-/** Alloca ed inizializza una coda. Deve essere chiamata da un solo 
- *  thread (tipicamente il thread main).
- *   \param nrow numero righe
- *   \param numero colonne
+/** Alloca ed inizializza una coda di QUEUE_SIZE elementi. Deve essere
+ *  chiamata da un solo thread (tipicamente il thread main).
  *
  *   \retval NULL se si sono verificati problemi nell'allocazione (errno settato)
  *   \retval q puntatore alla coda allocata
@@ -31,26 +45,79 @@ Queue_t *initQueue();
 
 /** Cancella una coda allocata con initQueue. Deve essere chiamata da
  *  da un solo thread (tipicamente il thread main).
- *  
+ *
  *   \param q puntatore alla coda da cancellare
  */
 void deleteQueue(Queue_t *q);
 
-/** Inserisce un dato nella coda.
- *   \param data puntatore al dato da inserire
- *  
+/** Inserisce un dato nella coda. Se la coda e' piena attende che
+ *  si liberi una cella.
+ *   \param data dato da inserire (es. un descrittore)
+ *
+ *   \retval 0 se successo
+ */
+int    push(Queue_t *q, long data);
+
+/** Estrae un dato dalla coda, sospendendosi se e' vuota.
+ *
+ *  \retval data dato estratto.
+ */
+long   pop(Queue_t *q);
+
+/** Inserisce un dato nella coda senza mai bloccarsi e senza
+ *  risvegliare i consumatori sospesi in pop.
+ *   \param data dato da inserire
+ *
+ *   \retval 0 se successo
+ *   \retval -1 se la coda e' piena
+ */
+int    tryPush(Queue_t *q, long data);
+
+/** Estrae un dato dalla coda senza mai bloccarsi.
+ *   \param data dove copiare il dato estratto
+ *
+ *   \retval 0 se successo
+ *   \retval -1 se la coda e' vuota
+ */
+int    tryPop(Queue_t *q, long *data);
+
+/** Inserisce fino a n dati nella coda con un'unica prenotazione delle
+ *  celle, senza mai bloccarsi e senza risvegliare i consumatori sospesi.
+ *   \param data dati da inserire
+ *   \param n numero di dati
+ *
+ *   \retval k numero di dati inseriti (0 se la coda e' piena)
+ */
+int    tryPushMany(Queue_t *q, long *data, int n);
+
+/** Estrae fino a n dati dalla coda con un'unica prenotazione delle
+ *  celle, senza mai bloccarsi.
+ *   \param data dove copiare i dati estratti
+ *   \param n numero massimo di dati
+ *
+ *   \retval k numero di dati estratti (0 se la coda e' vuota)
+ */
+int    tryPopMany(Queue_t *q, long *data, int n);
+
+/** Inserisce n dati nella coda attendendo se e' piena, e risveglia i
+ *  consumatori sospesi una sola volta per tutto il gruppo.
+ *   \param data dati da inserire
+ *   \param n numero di dati
+ *
  *   \retval 0 se successo
- *   \retval -1 se errore (errno settato opportunamente)
  */
-int    push(Queue_t *q, void *data);
+int    pushMany(Queue_t *q, long *data, int n);
 
-/** Estrae un dato dalla coda.
+/** Estrae fino a n dati dalla coda, sospendendosi se e' vuota.
+ *   \param data dove copiare i dati estratti
+ *   \param n numero massimo di dati
  *
- *  \retval data puntatore al dato estratto.
+ *   \retval k numero di dati estratti (almeno 1)
  */
-void  *pop(Queue_t *q);
+int    popMany(Queue_t *q, long *data, int n);
 
-/** Ritorna la lunghezza della coda. L'accesso non è in mutua esclusione !
+/** Ritorna la lunghezza della coda. Il valore e' indicativo se
+ *  la coda e' usata in modo concorrente !
  *
  *  \retval lunghezza della coda.
  */
@@ -0,0 +1,204 @@
+/**
+ * @file  queue_bench.c
+ * @brief Microbenchmark della coda dei reactor: confronta il buffer circolare
+ *        senza lock di queue.c, usato un elemento alla volta o a gruppi
+ *        (pushMany/popMany), con la precedente coda a lista protetta da
+ *        un'unica mutex (riportata qui sotto), al variare di produttori e
+ *        consumatori
+ * @author Federico Germinario 545081
+ *
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ *
+ *  Uso: ./queue_bench [operazioni per produttore]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "queue.h"
+
+#define NOPS     1000000
+#define STOP     -2
+#define BATCH    16      // Elementi per pushMany/popMany
+
+/* ------------- coda precedente: lista + mutex + condvar -------------- */
+
+typedef struct MNode {
+    void         *data;
+    struct MNode *next;
+} MNode_t;
+
+typedef struct {
+    MNode_t         *head;
+    MNode_t         *tail;
+    unsigned long    qlen;
+    pthread_mutex_t  qlock;
+    pthread_cond_t   qcond;
+} MQueue_t;
+
+static MQueue_t *mInit() {
+    MQueue_t *q = malloc(sizeof(MQueue_t));
+    q->head = malloc(sizeof(MNode_t));
+    q->head->data = NULL;
+    q->head->next = NULL;
+    q->tail = q->head;
+    q->qlen = 0;
+    pthread_mutex_init(&q->qlock, NULL);
+    pthread_cond_init(&q->qcond, NULL);
+    return q;
+}
+
+static void mDelete(MQueue_t *q) {
+    while(q->head != q->tail) {
+        MNode_t *p = q->head;
+        q->head = q->head->next;
+        free(p);
+    }
+    free(q->head);
+    pthread_mutex_destroy(&q->qlock);
+    pthread_cond_destroy(&q->qcond);
+    free(q);
+}
+
+static void mPush(MQueue_t *q, void *data) {
+    MNode_t *n = malloc(sizeof(MNode_t));
+    n->data = data;
+    n->next = NULL;
+    pthread_mutex_lock(&q->qlock);
+    q->tail->next = n;
+    q->tail       = n;
+    q->qlen      += 1;
+    pthread_cond_signal(&q->qcond);
+    pthread_mutex_unlock(&q->qlock);
+}
+
+static void *mPop(MQueue_t *q) {
+    pthread_mutex_lock(&q->qlock);
+    while(q->head == q->tail) pthread_cond_wait(&q->qcond, &q->qlock);
+    MNode_t *n  = q->head;
+    void *data  = q->head->next->data;
+    q->head     = q->head->next;
+    q->qlen    -= 1;
+    pthread_mutex_unlock(&q->qlock);
+    free(n);
+    return data;
+}
+
+/* --------------------------- benchmark ------------------------------- */
+
+static long nops = NOPS;
+static int use_ring;     // 0 mutex, 1 ring, 2 ring a gruppi
+static Queue_t *ring;
+static MQueue_t *mq;
+
+static void *producer(void *arg) {
+    if(use_ring == 2) {
+        long buf[BATCH];
+        for(long i = 0; i < nops; i += BATCH) {
+            int n = 0;
+            for(long j = i; j < nops && n < BATCH; j++) buf[n++] = j;
+            pushMany(ring, buf, n);
+        }
+        return NULL;
+    }
+    for(long i = 0; i < nops; i++) {
+        if(use_ring) {
+            push(ring, i);
+        } else {
+            // Come il vecchio chatty.c: un int allocato per ogni fd pronto
+            int *fd = malloc(sizeof(int));
+            *fd = (int)i;
+            mPush(mq, fd);
+        }
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg) {
+    long sum = 0;
+    if(use_ring == 2) {
+        long buf[BATCH];
+        int stops = 0;
+        while(stops == 0) {
+            int n = popMany(ring, buf, BATCH);
+            for(int i = 0; i < n; i++) {
+                if(buf[i] == STOP) stops++;
+                else sum += buf[i];
+            }
+        }
+        // Un solo STOP per consumatore: gli altri tornano in coda
+        while(--stops > 0) push(ring, STOP);
+        *(long *)arg = sum;
+        return NULL;
+    }
+    while(1) {
+        long v;
+        if(use_ring) {
+            v = pop(ring);
+        } else {
+            int *fd = mPop(mq);
+            v = *fd;
+            free(fd);
+        }
+        if(v == STOP) break;
+        sum += v;
+    }
+    *(long *)arg = sum;
+    return NULL;
+}
+
+static double run(int nprod, int ncons) {
+    pthread_t prod[nprod], cons[ncons];
+    long sums[ncons];
+    struct timespec t0, t1;
+
+    if(use_ring) ring = initQueue();
+    else mq = mInit();
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(int i = 0; i < ncons; i++) pthread_create(&cons[i], NULL, consumer, &sums[i]);
+    for(int i = 0; i < nprod; i++) pthread_create(&prod[i], NULL, producer, NULL);
+    for(int i = 0; i < nprod; i++) pthread_join(prod[i], NULL);
+    for(int i = 0; i < ncons; i++) {
+        if(use_ring) {
+            push(ring, STOP);
+        } else {
+            int *fd = malloc(sizeof(int));
+            *fd = STOP;
+            mPush(mq, fd);
+        }
+    }
+    for(int i = 0; i < ncons; i++) pthread_join(cons[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    // Controllo che ogni elemento sia stato estratto una sola volta
+    long sum = 0;
+    for(int i = 0; i < ncons; i++) sum += sums[i];
+    if(sum != nprod * (nops * (nops - 1) / 2)) fprintf(stderr, "ERRORE: somma errata\n");
+
+    if(use_ring) deleteQueue(ring);
+    else mDelete(mq);
+
+    double sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    return (nprod * nops) / sec / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    if(argc > 1) nops = strtol(argv[1], NULL, 10);
+    int conf[][2] = { {1, 1}, {1, 4}, {1, 8}, {2, 8}, {4, 4}, {4, 16} };
+
+    printf("%-12s %14s %14s %14s\n", "prod/cons", "mutex Mop/s", "ring Mop/s", "ring x16 Mop/s");
+    for(size_t i = 0; i < sizeof(conf) / sizeof(conf[0]); i++) {
+        use_ring = 0;
+        double m = run(conf[i][0], conf[i][1]);
+        use_ring = 1;
+        double r = run(conf[i][0], conf[i][1]);
+        use_ring = 2;
+        double b = run(conf[i][0], conf[i][1]);
+        printf("%4d/%-7d %14.2f %14.2f %14.2f\n", conf[i][0], conf[i][1], m, r, b);
+    }
+    return 0;
+}
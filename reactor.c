@@ -0,0 +1,130 @@
+/**
+ * @file  reactor.c
+ * @author Federico Germinario 545081
+ * 
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "reactor.h"
+#include "util.h"
+
+/**
+ * @function createReactor
+ * @brief Crea un reactor con la relativa epoll, eventfd e scheduler
+ *
+ * @param id        indice del reactor
+ * @param mode      politica dello scheduler dei worker
+ * @param nworkers  numero di worker del reactor
+ * @param bulkshare percentuale di worker che servono le richieste pesanti (vedi createSched)
+ * @param spin_us   attesa attiva dei worker senza lavoro in microsecondi (vedi createSched)
+ * @param uring     numero di letture in batch per io_uring, 0 per usare read
+ *
+ * @return puntatore al nuovo reactor, NULL in caso di fallimento
+ */
+reactor_t *createReactor(int id, sched_mode_t mode, int nworkers, int bulkshare, int spin_us, unsigned uring){
+    reactor_t *r = (reactor_t *) Calloc(1, sizeof(reactor_t));
+    r->id = id;
+
+    if((r->epfd = epoll_create1(0)) == -1){
+        perror("epoll_create1");
+        free(r);
+        return NULL;
+    }
+
+    // Registro l'eventfd per le notifiche esplicite al reactor
+    if((r->evfd = eventfd(0, EFD_NONBLOCK)) == -1){
+        perror("eventfd");
+        close(r->epfd);
+        free(r);
+        return NULL;
+    }
+    if(reactorAdd(r, r->evfd, EPOLLIN) == -1){
+        close(r->evfd);
+        close(r->epfd);
+        free(r);
+        return NULL;
+    }
+
+    if((r->sched = createSched(mode, nworkers, bulkshare, spin_us)) == NULL){
+        close(r->evfd);
+        close(r->epfd);
+        free(r);
+        return NULL;
+    }
+
+    // Se il kernel non supporta io_uring resto su read
+    if(uring > 0 && (r->ring = uringCreate(uring)) == NULL){
+        fprintf(stderr, "[Reactor %d] io_uring non disponibile, uso read\n", id);
+    }
+    return r;
+}
+
+/**
+ * @function destroyReactor
+ * @brief Dealloca le risorse del reactor
+ *
+ * @param r         puntatore al reactor
+ */
+void destroyReactor(reactor_t *r){
+    if(r == NULL) return;
+    destroySched(r->sched);
+    uringDestroy(r->ring);
+    close(r->evfd);
+    close(r->epfd);
+    free(r);
+}
+
+/**
+ * @function reactorAdd
+ * @brief Registra un fd nell'epoll del reactor
+ *
+ * @param r         puntatore al reactor
+ * @param fd        descrittore da registrare
+ * @param events    eventi epoll da notificare
+ *
+ * @return 0 successo, -1 fallimento
+ */
+int reactorAdd(reactor_t *r, int fd, uint32_t events){
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.events = events;
+    ev.data.fd = fd;
+    int ret;
+    CHECK_MENO1(ret, epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev), "epoll_ctl");
+    return ret;
+}
+
+/**
+ * @function reactorWakeup
+ * @brief Risveglia il reactor bloccato in epoll_wait scrivendo sull'eventfd
+ *
+ * @param r         puntatore al reactor
+ */
+void reactorWakeup(reactor_t *r){
+    uint64_t one = 1;
+    if(write(r->evfd, &one, sizeof(uint64_t)) == -1 && errno != EAGAIN){
+        perror("write eventfd");
+    }
+}
+
+/**
+ * @function reactorDrain
+ * @brief Svuota il contatore dell'eventfd dopo una notifica
+ *
+ * @param r         puntatore al reactor
+ */
+void reactorDrain(reactor_t *r){
+    uint64_t cnt;
+    if(read(r->evfd, &cnt, sizeof(uint64_t)) == -1 && errno != EAGAIN){
+        perror("read eventfd");
+    }
+}
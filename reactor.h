@@ -0,0 +1,90 @@
+/**
+ * @file  reactor.h
+ * @brief Event loop basato su epoll. Ogni reactor possiede un sottoinsieme
+ *        delle connessioni accettate e alimenta la coda dei propri worker
+ * @author Federico Germinario 545081
+ * 
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ * 
+ */
+#ifndef REACTOR_H_
+#define REACTOR_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "scheduler.h"
+#include "uring.h"
+
+/**
+ *  @struct reactor
+ *  @brief Event loop
+ *
+ *  @var id         indice del reactor
+ *  @var epfd       descrittore epoll
+ *  @var evfd       eventfd utilizzato per risvegliare il reactor
+ *  @var sched      scheduler delle richieste servite dai worker del reactor
+ *  @var ring       io_uring per le letture in batch, NULL se si usa read
+ *  @var tid        thread che esegue il reactor
+ */
+typedef struct {
+    int id;
+    int epfd;
+    int evfd;
+    sched_t *sched;
+    uring_t *ring;
+    pthread_t tid;
+} reactor_t;
+
+/**
+ * @function createReactor
+ * @brief Crea un reactor con la relativa epoll, eventfd e scheduler
+ *
+ * @param id        indice del reactor
+ * @param mode      politica dello scheduler dei worker
+ * @param nworkers  numero di worker del reactor
+ * @param bulkshare percentuale di worker che servono le richieste pesanti (vedi createSched)
+ * @param spin_us   attesa attiva dei worker senza lavoro in microsecondi (vedi createSched)
+ * @param uring     numero di letture in batch per io_uring, 0 per usare read
+ *
+ * @return puntatore al nuovo reactor, NULL in caso di fallimento
+ */
+reactor_t *createReactor(int id, sched_mode_t mode, int nworkers, int bulkshare, int spin_us, unsigned uring);
+
+/**
+ * @function destroyReactor
+ * @brief Dealloca le risorse del reactor
+ *
+ * @param r         puntatore al reactor
+ */
+void destroyReactor(reactor_t *r);
+
+/**
+ * @function reactorAdd
+ * @brief Registra un fd nell'epoll del reactor
+ *
+ * @param r         puntatore al reactor
+ * @param fd        descrittore da registrare
+ * @param events    eventi epoll da notificare
+ *
+ * @return 0 successo, -1 fallimento
+ */
+int reactorAdd(reactor_t *r, int fd, uint32_t events);
+
+/**
+ * @function reactorWakeup
+ * @brief Risveglia il reactor bloccato in epoll_wait scrivendo sull'eventfd
+ *
+ * @param r         puntatore al reactor
+ */
+void reactorWakeup(reactor_t *r);
+
+/**
+ * @function reactorDrain
+ * @brief Svuota il contatore dell'eventfd dopo una notifica
+ *
+ * @param r         puntatore al reactor
+ */
+void reactorDrain(reactor_t *r);
+
+#endif /* REACTOR_H_ */
@@ -0,0 +1,659 @@
+/**
+ * @file  scheduler.c
+ * @author Federico Germinario 545081
+ *
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "scheduler.h"
+
+#define LOAD(p)         __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ADD(p, v)       __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+#define XCHG(p, v)      __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+
+// Pausa tra due controlli delle code durante l'attesa attiva: lascia le
+// risorse del core all'altro hyperthread e non satura il bus di coerenza
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX()     __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX()     __asm__ __volatile__("yield" ::: "memory")
+#else
+#define CPU_RELAX()     __atomic_signal_fence(__ATOMIC_SEQ_CST)
+#endif
+
+#define SPIN_CHECK      64   // Pause tra due letture dell'orologio durante l'attesa attiva
+
+/**
+ * @function nowUs
+ * @brief Tempo monotono in microsecondi
+ */
+static inline unsigned long nowUs(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Un elemento in coda e' il descrittore nei 32 bit bassi e l'istante
+ * di inserimento (us, modulo 2^32) in quelli alti
+ */
+static inline long mkItemAt(long fd, unsigned long now){
+    return (long)(((unsigned long)(uint32_t)now << 32) | (uint32_t)fd);
+}
+static inline long mkItem(long fd)            { return mkItemAt(fd, nowUs()); }
+static inline long itemFd(long item)          { return (int32_t)(uint32_t)item; }
+static inline uint32_t itemTime(long item)    { return (uint32_t)((unsigned long)item >> 32); }
+
+/**
+ * @function home
+ * @brief Worker a cui appartiene una connessione
+ */
+static inline int home(sched_t *s, long fd){
+    return (int)((unsigned long)fd % LOAD(&s->nactive));
+}
+
+/**
+ * @function bulkLimit
+ * @brief Worker che possono servire insieme richieste della corsia SCH_BULK:
+ *        bulkshare% dei worker attivi, almeno 1, lasciandone sempre uno
+ *        libero per la corsia SCH_CTRL se il reactor ha piu' di un worker
+ */
+static inline int bulkLimit(sched_t *s){
+    int n = LOAD(&s->nactive);
+    int lim = n * s->bulkshare / 100;
+    if(lim > n - 1) lim = n - 1;
+    return lim < 1 ? 1 : lim;
+}
+
+/**
+ * @function grabBulk
+ * @brief Estrae senza bloccarsi dalla corsia SCH_BULK se il worker w rientra
+ *        nella quota di worker riservata alle richieste pesanti
+ *
+ * @return 0 successo, -1 nessun lavoro o quota esaurita
+ */
+static int grabBulk(sched_t *s, int w, long *item){
+    if(s->bulk == NULL || length(s->bulk) == 0) return -1;
+    int n = __atomic_load_n(&s->nbulk, __ATOMIC_RELAXED);
+    do{
+        if(n >= bulkLimit(s)) return -1;
+    }while(!__atomic_compare_exchange_n(&s->nbulk, &n, n + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    if(tryPop(s->bulk, item) == 0){
+        s->inbulk[w] = 1;
+        ADD(&s->nbulkpops, 1);
+        return 0;
+    }
+    __atomic_sub_fetch(&s->nbulk, 1, __ATOMIC_SEQ_CST);
+    return -1;
+}
+
+/**
+ * @function grab
+ * @brief Estrae senza bloccarsi dalla corsia SCH_CTRL (coda condivisa o
+ *        coda del worker w, poi quella di un altro worker anche terminato)
+ *        e, solo se e' vuota, dalla corsia SCH_BULK
+ *
+ * @return 0 successo, -1 nessun lavoro
+ */
+static int grab(sched_t *s, int w, long *item){
+    if(s->mode == SCH_FIFO){
+        if(tryPop(s->fifo, item) == 0) return 0;
+        return grabBulk(s, w, item);
+    }
+
+    if(tryPop(s->local[w], item) == 0) return 0;
+    for(int i = 1; i < s->maxworkers; i++){
+        if(tryPop(s->local[(w + i) % s->maxworkers], item) == 0){
+            ADD(&s->nsteals, 1);
+            return 0;
+        }
+    }
+    return grabBulk(s, w, item);
+}
+
+/**
+ * @function wakeLocked
+ * @brief Risveglia il primo worker sospeso a partire da w. Richiede s->lock
+ *
+ * @return 1 worker risvegliato, 0 nessun worker sospeso
+ */
+static int wakeLocked(sched_t *s, int w){
+    for(int i = 0; i < s->maxworkers; i++){
+        int v = (w + i) % s->maxworkers;
+        if(s->parked[v]){
+            s->parked[v] = 0;
+            pthread_cond_signal(&s->cond[v]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @function toSpinner
+ * @brief Affida al worker in attesa attiva l'elemento appena pubblicato:
+ *        solo il primo dall'inizio dell'attesa (spinning da 1 a 2), gli
+ *        altri devono risvegliare un worker sospeso
+ *
+ * @return 1 elemento affidato, 0 il chiamante deve risvegliare un worker
+ */
+static int toSpinner(sched_t *s){
+    int one = 1;
+    return __atomic_compare_exchange_n(&s->spinning, &one, 2, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+/**
+ * @function wake
+ * @brief Dopo aver pubblicato un elemento risveglia un worker sospeso, se
+ *        c'e', preferendo w
+ */
+static void wake(sched_t *s, int w){
+    // L'elemento e' pubblicato prima di controllare se ci sono worker sospesi.
+    // Se un worker sta attendendo attivamente e non ha gia' un elemento
+    // affidato lo prendera' lui
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(toSpinner(s)) return;
+    if(__atomic_load_n(&s->waiters, __ATOMIC_RELAXED) == 0) return;
+    pthread_mutex_lock(&s->lock);
+    wakeLocked(s, w);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * @function wakeMany
+ * @brief Dopo aver pubblicato n elementi risveglia fino a n worker sospesi,
+ *        con un'unica acquisizione della mutex (pref[i] worker preferito)
+ */
+static void wakeMany(sched_t *s, int *pref, int n){
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int i = toSpinner(s);
+    if(i >= n || __atomic_load_n(&s->waiters, __ATOMIC_RELAXED) == 0) return;
+    pthread_mutex_lock(&s->lock);
+    for(; i < n && wakeLocked(s, pref[i]); i++);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * @function pending
+ * @brief Controlla se in una delle code c'e' lavoro
+ *
+ * @return 1 almeno un elemento in coda, 0 code vuote
+ */
+static int pending(sched_t *s){
+    if(s->bulk != NULL && length(s->bulk) > 0) return 1;
+    if(s->mode == SCH_FIFO) return length(s->fifo) > 0;
+    for(int i = 0; i < s->maxworkers; i++){
+        if(length(s->local[i]) > 0) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @function spin
+ * @brief Attesa attiva del worker w: ricontrolla le code fino a spin_us
+ *        microsecondi, senza prendere la mutex ne' dichiararsi sospeso.
+ *        Attende attivamente un solo worker alla volta: gli altri si
+ *        sospendono subito
+ *
+ * @return 0 lavoro trovato, -1 tempo scaduto, worker da terminare o
+ *         un altro worker gia' in attesa attiva
+ */
+static int spin(sched_t *s, int w, long *item){
+    int zero = 0;
+    if(!__atomic_compare_exchange_n(&s->spinning, &zero, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return -1;
+    ADD(&s->nspins, 1);
+
+    int r = -1;
+    unsigned long end = nowUs() + s->spin_us;
+    for(unsigned i = 1; ; i++){
+        CPU_RELAX();
+        if(s->mode == SCH_STEAL && w >= LOAD(&s->nactive)) break;
+        if(grab(s, w, item) == 0){
+            r = 0;
+            break;
+        }
+        if(i % SPIN_CHECK == 0 && nowUs() >= end) break;
+    }
+
+    // Il primo che ha pubblicato lavoro mentre attendevo non ha svegliato
+    // nessuno (vedi wake): se ne resta dopo il mio, o se esco senza averlo
+    // preso (worker da terminare), lo passo ad un worker sospeso
+    int handed = __atomic_exchange_n(&s->spinning, 0, __ATOMIC_SEQ_CST);
+    if(r == 0) ADD(&s->nspinhits, 1);
+    if(r == 0 || handed == 2){
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(pending(s)) wake(s, w + 1);
+    }
+    return r;
+}
+
+/**
+ * @function pushItem
+ * @brief Inserisce un elemento nella corsia indicata (per SCH_CTRL con
+ *        SCH_STEAL nella coda di casa) e risveglia un worker sospeso
+ */
+static void pushItem(sched_t *s, long item, sched_lane_t lane){
+    Queue_t *q;
+    int w = 0;
+    if(lane == SCH_BULK && s->bulk != NULL){
+        q = s->bulk;
+    }else if(s->mode == SCH_FIFO){
+        q = s->fifo;
+    }else{
+        // Risveglio il worker di casa se sospeso, altrimenti un altro che lo rubera'
+        w = home(s, itemFd(item));
+        q = s->local[w];
+    }
+    // I worker non si sospendono nella pop delle code ma sullo scheduler:
+    // push non trova consumatori da svegliare, il risveglio e' wake
+    push(q, item);
+    wake(s, w);
+}
+
+/**
+ * @function bulkDone
+ * @brief Il worker w ha finito una richiesta SCH_BULK: libera il suo posto
+ *        nella quota e, se ci sono altre richieste pesanti in attesa,
+ *        risveglia un worker che possa prenderle
+ */
+static void bulkDone(sched_t *s, int w){
+    if(!s->inbulk[w]) return;
+    s->inbulk[w] = 0;
+    __atomic_sub_fetch(&s->nbulk, 1, __ATOMIC_SEQ_CST);
+    if(length(s->bulk) > 0) wake(s, w + 1);
+}
+
+/**
+ * @function retire
+ * @brief Termina il worker w se e' oltre il numero di worker richiesti,
+ *        ridistribuendo le connessioni rimaste nella sua coda (SCH_STEAL)
+ *
+ * @return 1 il worker deve terminare, 0 altrimenti
+ */
+static int retire(sched_t *s, int w){
+    pthread_mutex_lock(&s->lock);
+    if(w < s->nactive){
+        pthread_mutex_unlock(&s->lock);
+        return 0;
+    }
+    s->alive[w] = 0;
+    s->nalive--;
+    pthread_mutex_unlock(&s->lock);
+
+    long item;
+    while(tryPop(s->local[w], &item) == 0) pushItem(s, item, SCH_CTRL);
+    return 1;
+}
+
+/**
+ * @function createSched
+ * @brief Crea uno scheduler senza worker attivi (vedi schedResize)
+ *
+ * @param mode         politica di distribuzione
+ * @param maxworkers   numero massimo di worker che estraggono dallo scheduler
+ * @param bulkshare    percentuale di worker che servono la corsia SCH_BULK, 0 per una sola corsia
+ * @param spin_us      microsecondi di attesa attiva di un worker senza lavoro, 0 per sospenderlo subito
+ *
+ * @return puntatore al nuovo scheduler, NULL in caso di fallimento
+ */
+sched_t *createSched(sched_mode_t mode, int maxworkers, int bulkshare, int spin_us){
+    if(maxworkers < 1) maxworkers = 1;
+    if(bulkshare > 100) bulkshare = 100;
+    sched_t *s = calloc(1, sizeof(sched_t));
+    if(s == NULL) return NULL;
+    s->mode = mode;
+    s->maxworkers = maxworkers;
+    s->nactive = 1;
+    s->bulkshare = bulkshare;
+    // Con un solo core l'attesa attiva toglie solo tempo a chi produce il lavoro
+    s->spin_us = (spin_us > 0 && sysconf(_SC_NPROCESSORS_ONLN) > 1) ? spin_us : 0;
+    s->sample_us = nowUs();
+    pthread_mutex_init(&s->lock, NULL);
+
+    s->alive      = calloc(maxworkers, sizeof(int));
+    s->inbulk     = calloc(maxworkers, sizeof(int));
+    s->parked     = calloc(maxworkers, sizeof(int));
+    s->busy_since = calloc(maxworkers, sizeof(unsigned long));
+    s->cond       = calloc(maxworkers, sizeof(pthread_cond_t));
+    if(s->cond != NULL){
+        for(int i = 0; i < maxworkers; i++) pthread_cond_init(&s->cond[i], NULL);
+    }
+    if(s->alive == NULL || s->inbulk == NULL || s->parked == NULL || s->busy_since == NULL || s->cond == NULL){
+        destroySched(s);
+        return NULL;
+    }
+
+    // Con bulkshare a 0 tutte le richieste passano dalla corsia SCH_CTRL
+    if(bulkshare > 0 && (s->bulk = initQueue()) == NULL){
+        destroySched(s);
+        return NULL;
+    }
+
+    if(mode == SCH_FIFO){
+        if((s->fifo = initQueue()) == NULL){
+            destroySched(s);
+            return NULL;
+        }
+        return s;
+    }
+
+    s->local = calloc(maxworkers, sizeof(Queue_t *));
+    if(s->local == NULL){
+        destroySched(s);
+        return NULL;
+    }
+    for(int i = 0; i < maxworkers; i++){
+        if((s->local[i] = initQueue()) == NULL){
+            destroySched(s);
+            return NULL;
+        }
+    }
+    return s;
+}
+
+/**
+ * @function destroySched
+ * @brief Dealloca lo scheduler
+ *
+ * @param s          puntatore allo scheduler
+ */
+void destroySched(sched_t *s){
+    if(s == NULL) return;
+    if(s->fifo != NULL) deleteQueue(s->fifo);
+    if(s->bulk != NULL) deleteQueue(s->bulk);
+    if(s->local != NULL){
+        for(int i = 0; i < s->maxworkers; i++){
+            if(s->local[i] != NULL) deleteQueue(s->local[i]);
+        }
+    }
+    if(s->cond != NULL){
+        for(int i = 0; i < s->maxworkers; i++) pthread_cond_destroy(&s->cond[i]);
+    }
+    pthread_mutex_destroy(&s->lock);
+    free(s->local);
+    free(s->parked);
+    free(s->cond);
+    free(s->alive);
+    free(s->inbulk);
+    free(s->busy_since);
+    free(s);
+}
+
+/**
+ * @function schedPush
+ * @brief Affida una connessione ai worker nella corsia della sua richiesta.
+ *        Con SCH_STEAL una connessione SCH_CTRL va sempre nella coda dello
+ *        stesso worker (fd % nactive), cosi' torna dove il suo stato e'
+ *        ancora in cache. La corsia SCH_BULK e' una coda condivisa
+ *
+ * @param s          puntatore allo scheduler
+ * @param fd         descrittore della connessione (-2 per la terminazione)
+ * @param lane       corsia della richiesta pronta sulla connessione
+ *
+ * @return 0 successo
+ */
+int schedPush(sched_t *s, long fd, sched_lane_t lane){
+    pushItem(s, mkItem(fd), lane);
+    return 0;
+}
+
+/**
+ * @function schedPushMany
+ * @brief Affida ai worker le n connessioni pronte dopo una stessa epoll_wait:
+ *        ogni corsia condivisa riceve tutte le sue connessioni con un'unica
+ *        prenotazione delle celle ed i worker sospesi vengono risvegliati
+ *        con un'unica acquisizione della mutex
+ *
+ * @param s          puntatore allo scheduler
+ * @param fds        descrittori delle connessioni
+ * @param lanes      corsia di ogni connessione
+ * @param n          numero di connessioni (al piu' SCH_MAXBATCH)
+ *
+ * @return 0 successo
+ */
+int schedPushMany(sched_t *s, long *fds, sched_lane_t *lanes, int n){
+    long ctrl[SCH_MAXBATCH], bulk[SCH_MAXBATCH];
+    int pref[SCH_MAXBATCH];
+    int nctrl = 0, nbulk = 0;
+    if(n > SCH_MAXBATCH) n = SCH_MAXBATCH;
+    unsigned long now = nowUs();
+
+    for(int i = 0; i < n; i++){
+        long item = mkItemAt(fds[i], now);
+        pref[i] = 0;
+        if(lanes[i] == SCH_BULK && s->bulk != NULL){
+            bulk[nbulk++] = item;
+        }else if(s->mode == SCH_FIFO){
+            ctrl[nctrl++] = item;
+        }else{
+            // Ogni connessione nella coda del proprio worker di casa
+            pref[i] = home(s, fds[i]);
+            push(s->local[pref[i]], item);
+        }
+    }
+    if(nctrl > 0) pushMany(s->fifo, ctrl, nctrl);
+    if(nbulk > 0) pushMany(s->bulk, bulk, nbulk);
+    wakeMany(s, pref, n);
+    return 0;
+}
+
+/**
+ * @function schedPop
+ * @brief Estrae la prossima connessione per il worker w, sospendendolo se
+ *        non c'e' lavoro (dopo al piu' spin_us di attesa attiva). La corsia SCH_CTRL ha sempre la precedenza: con
+ *        SCH_STEAL prova prima la propria coda e poi quelle degli altri
+ *        worker, la corsia SCH_BULK solo entro la quota di worker bulkshare
+ *
+ * @param s          puntatore allo scheduler
+ * @param w          slot del worker (0 .. maxworkers-1)
+ *
+ * @return descrittore estratto, SCH_EXIT se il worker deve terminare
+ */
+long schedPop(sched_t *s, int w){
+    long item, fd;
+
+    // Fine della richiesta precedente: il tempo di servizio conta nell'utilizzo
+    unsigned long since = XCHG(&s->busy_since[w], 0);
+    if(since != 0){
+        unsigned long now = nowUs();
+        if(now > since) ADD(&s->busy_us, now - since);
+    }
+    bulkDone(s, w);
+
+    while(1){
+        if(s->mode == SCH_STEAL && w >= LOAD(&s->nactive) && retire(s, w)) return SCH_EXIT;
+        if(grab(s, w, &item) == 0) break;
+
+        // Una richiesta che arriva durante l'attesa attiva non paga ne' il
+        // risveglio del worker ne' il cambio di contesto
+        if(s->spin_us > 0 && spin(s, w, &item) == 0) break;
+
+        // Nessun lavoro: mi dichiaro sospeso e ricontrollo, un push
+        // concorrente vede il flag oppure io vedo il suo descrittore.
+        // Con SCH_STEAL uno slot oltre nactive non si sospende ma termina
+        pthread_mutex_lock(&s->lock);
+        int active = s->mode == SCH_FIFO || w < s->nactive;
+        s->parked[w] = 1;
+        __atomic_add_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int found = active && grab(s, w, &item) == 0;
+        if(!found && active){
+            while(s->parked[w]) pthread_cond_wait(&s->cond[w], &s->lock);
+        }
+        s->parked[w] = 0;
+        __atomic_sub_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&s->lock);
+        if(found) break;
+    }
+
+    fd = itemFd(item);
+    if(fd == SCH_EXIT){
+        // Nella coda condivisa termina il primo worker che estrae la richiesta
+        pthread_mutex_lock(&s->lock);
+        s->nexit--;
+        s->alive[w] = 0;
+        s->nalive--;
+        pthread_mutex_unlock(&s->lock);
+        return SCH_EXIT;
+    }
+    if(fd >= 0){
+        unsigned long now = nowUs();
+        ADD(&s->wait_us, (uint32_t)((uint32_t)now - itemTime(item)));
+        ADD(&s->npops, 1);
+        __atomic_store_n(&s->busy_since[w], now, __ATOMIC_RELEASE);
+    }
+    return fd;
+}
+
+/**
+ * @function schedPopMany
+ * @brief Come schedPop, ma se la coda SCH_CTRL da cui estrae il worker e'
+ *        lunga (piu' connessioni che worker attivi) ne estrae fino a max
+ *        con un'unica prenotazione delle celle
+ *
+ * @param s          puntatore allo scheduler
+ * @param w          slot del worker (0 .. maxworkers-1)
+ * @param fds        dove copiare i descrittori estratti
+ * @param max        numero massimo di descrittori (al piu' SCH_MAXBATCH)
+ *
+ * @return numero di descrittori in fds. Se fds[0] e' SCH_EXIT o negativo
+ *         e' l'unico estratto
+ */
+int schedPopMany(sched_t *s, int w, long *fds, int max){
+    long items[SCH_MAXBATCH];
+    int n = 1;
+    fds[0] = schedPop(s, w);
+    if(fds[0] < 0 || max <= 1 || s->inbulk[w]) return 1;
+    if(max > SCH_MAXBATCH) max = SCH_MAXBATCH;
+
+    // La coda condivisa e' lunga se ci sono piu' connessioni che worker,
+    // quella del worker se altre connessioni lo aspettano
+    Queue_t *q = s->mode == SCH_FIFO ? s->fifo : s->local[w];
+    long backlog = (long) length(q) - (s->mode == SCH_FIFO ? LOAD(&s->nactive) : 0);
+    if(backlog <= 0) return 1;
+    if(backlog > max - 1) backlog = max - 1;
+
+    int k = tryPopMany(q, items, (int) backlog);
+    unsigned long now = nowUs();
+    for(int i = 0; i < k; i++){
+        long fd = itemFd(items[i]);
+        if(fd < 0){
+            // Richieste di terminazione per un altro worker
+            pushItem(s, items[i], SCH_CTRL);
+            continue;
+        }
+        ADD(&s->wait_us, (uint32_t)((uint32_t)now - itemTime(items[i])));
+        ADD(&s->npops, 1);
+        fds[n++] = fd;
+    }
+    return n;
+}
+
+/**
+ * @function schedResize
+ * @brief Porta a n il numero di worker. I worker in eccesso terminano alla
+ *        successiva schedPop, per quelli mancanti restituisce gli slot su cui
+ *        il chiamante deve avviare un thread
+ *
+ * @param s          puntatore allo scheduler
+ * @param n          worker richiesti (1 .. maxworkers)
+ * @param spawn      array di almeno maxworkers elementi dove scrivere gli slot
+ *
+ * @return numero di slot scritti in spawn
+ */
+int schedResize(sched_t *s, int n, int *spawn){
+    int nspawn = 0;
+    if(n < 1) n = 1;
+    if(n > s->maxworkers) n = s->maxworkers;
+
+    pthread_mutex_lock(&s->lock);
+    __atomic_store_n(&s->nactive, n, __ATOMIC_RELEASE);
+    if(s->mode == SCH_FIFO){
+        // Nella coda condivisa termina il primo worker che estrae la richiesta
+        int eff = s->nalive - s->nexit;
+        for(; eff > n; eff--, s->nexit++){
+            push(s->fifo, mkItem(SCH_EXIT));
+            wakeLocked(s, 0);
+        }
+        for(int w = 0; w < s->maxworkers && eff < n; w++){
+            if(s->alive[w]) continue;
+            s->alive[w] = 1;
+            s->nalive++;
+            spawn[nspawn++] = w;
+            eff++;
+        }
+    }else{
+        // Terminano gli slot oltre n, quelli sospesi vanno svegliati
+        for(int w = n; w < s->maxworkers; w++){
+            if(s->parked[w]){
+                s->parked[w] = 0;
+                pthread_cond_signal(&s->cond[w]);
+            }
+        }
+        for(int w = 0; w < n; w++){
+            if(s->alive[w]) continue;
+            s->alive[w] = 1;
+            s->nalive++;
+            spawn[nspawn++] = w;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return nspawn;
+}
+
+/**
+ * @function schedSample
+ * @brief Misure dall'ultimo campionamento: attesa media in coda ed utilizzo
+ *        dei worker attivi
+ *
+ * @param s          puntatore allo scheduler
+ * @param wait_us    attesa media in coda (microsecondi)
+ * @param util       percentuale del tempo in cui i worker hanno servito richieste
+ */
+void schedSample(sched_t *s, unsigned long *wait_us, unsigned *util){
+    unsigned long now = nowUs();
+    unsigned long dt = now - s->sample_us;
+    s->sample_us = now;
+
+    // Le richieste ancora in corso contano fino ad ora, il resto lo
+    // aggiungera' il worker quando termina
+    unsigned long busy = XCHG(&s->busy_us, 0);
+    for(int w = 0; w < s->maxworkers; w++){
+        unsigned long since = LOAD(&s->busy_since[w]);
+        if(since != 0 && since < now &&
+           __atomic_compare_exchange_n(&s->busy_since[w], &since, now, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)){
+            busy += now - since;
+        }
+    }
+    unsigned long wait = XCHG(&s->wait_us, 0);
+    unsigned long pops = XCHG(&s->npops, 0);
+
+    *wait_us = pops > 0 ? wait / pops : 0;
+    int n = LOAD(&s->nactive);
+    unsigned long u = (dt > 0 && n > 0) ? busy * 100 / (dt * n) : 0;
+    *util = u > 100 ? 100 : (unsigned) u;
+}
+
+/**
+ * @function schedSpinStats
+ * @brief Attese attive dei worker dalla creazione dello scheduler
+ *
+ * @param s          puntatore allo scheduler
+ * @param spins      attese attive iniziate
+ * @param hits       attese attive che hanno trovato lavoro senza sospendere il worker
+ */
+void schedSpinStats(sched_t *s, unsigned long *spins, unsigned long *hits){
+    *spins = __atomic_load_n(&s->nspins, __ATOMIC_RELAXED);
+    *hits  = __atomic_load_n(&s->nspinhits, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,224 @@
+/**
+ * @file  scheduler.h
+ * @brief Scheduler che distribuisce ai worker di un reactor le connessioni
+ *        con una richiesta pronta: coda FIFO condivisa oppure una coda per
+ *        worker con furto del lavoro dai worker vicini. Le richieste pesanti
+ *        hanno una corsia separata servita solo da una quota dei worker.
+ *        Un worker senza lavoro puo' attendere attivamente per un tempo
+ *        limitato prima di sospendersi sulla propria condition variable.
+ *        Misura il tempo di attesa in coda e l'utilizzo dei worker per
+ *        dimensionare il pool
+ * @author Federico Germinario 545081
+ *
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ *
+ */
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include <pthread.h>
+#include "queue.h"
+
+#define SCH_EXIT  -3     // Restituito da schedPop: il worker deve terminare
+#define SCH_MAXBATCH 64  // Connessioni al massimo per schedPushMany e schedPopMany
+
+/**
+ *  @enum sched_mode
+ *  @brief Politica di distribuzione delle connessioni ai worker
+ */
+typedef enum {
+    SCH_FIFO,        // un'unica coda condivisa da tutti i worker
+    SCH_STEAL        // una coda per worker, i worker senza lavoro rubano dagli altri
+} sched_mode_t;
+
+/**
+ *  @enum sched_lane
+ *  @brief Corsia di una connessione, scelta dall'operazione della richiesta pronta
+ */
+typedef enum {
+    SCH_CTRL,        // operazioni brevi ed interattive, servite per prime
+    SCH_BULK         // trasferimenti di file e history, al piu' bulkshare% dei worker insieme
+} sched_lane_t;
+
+/**
+ *  @struct sched
+ *  @brief Scheduler dei worker di un reactor
+ *
+ *  @var mode       politica di distribuzione
+ *  @var maxworkers numero massimo di worker (slot)
+ *  @var nactive    worker richiesti dal controllore del pool
+ *  @var nalive     worker in esecuzione
+ *  @var nexit      richieste di terminazione in coda e non ancora estratte (SCH_FIFO)
+ *  @var alive      1 se lo slot ha un worker in esecuzione
+ *  @var fifo       coda condivisa della corsia SCH_CTRL (SCH_FIFO)
+ *  @var local      coda di ogni worker per la corsia SCH_CTRL (SCH_STEAL)
+ *  @var bulk       coda condivisa della corsia SCH_BULK, NULL se bulkshare e' 0
+ *  @var bulkshare  percentuale dei worker attivi che puo' servire la corsia SCH_BULK
+ *  @var nbulk      worker che stanno servendo una richiesta SCH_BULK
+ *  @var inbulk     1 se il worker sta servendo una richiesta SCH_BULK
+ *  @var nbulkpops  connessioni estratte dalla corsia SCH_BULK
+ *  @var spin_us    microsecondi di attesa attiva prima di sospendersi, 0 nessuna
+ *  @var spinning   1 se un worker e' in attesa attiva (al piu' uno alla volta), 2 se
+ *                  gli e' gia' stato affidato un elemento pubblicato nel frattempo
+ *  @var nspins     attese attive iniziate da worker rimasti senza lavoro
+ *  @var nspinhits  attese attive concluse trovando lavoro, senza sospendersi
+ *  @var waiters    worker sospesi in attesa di lavoro
+ *  @var parked     1 se il worker e' sospeso sulla propria condition variable
+ *  @var nsteals    connessioni servite da un worker diverso da quello di casa
+ *  @var busy_since istante (us) in cui il worker ha iniziato a servire, 0 se libero
+ *  @var busy_us    tempo speso dai worker a servire richieste
+ *  @var wait_us    tempo passato in coda dalle connessioni estratte
+ *  @var npops      connessioni estratte
+ *  @var sample_us  istante dell'ultimo campionamento
+ *  @var lock       mutex per la sospensione dei worker e il ridimensionamento
+ *  @var cond       condition variable di ogni worker
+ */
+typedef struct {
+    sched_mode_t     mode;
+    int              maxworkers;
+    int              nactive;
+    int              nalive;
+    int              nexit;
+    int             *alive;
+    Queue_t         *fifo;
+    Queue_t        **local;
+    Queue_t         *bulk;
+    int              bulkshare;
+    int              nbulk;
+    int             *inbulk;
+    unsigned long    nbulkpops;
+    int              spin_us;
+    int              spinning;
+    unsigned long    nspins;
+    unsigned long    nspinhits;
+    int              waiters;
+    int             *parked;
+    unsigned long    nsteals;
+    unsigned long   *busy_since;
+    unsigned long    busy_us;
+    unsigned long    wait_us;
+    unsigned long    npops;
+    unsigned long    sample_us;
+    pthread_mutex_t  lock;
+    pthread_cond_t  *cond;
+} sched_t;
+
+/**
+ * @function createSched
+ * @brief Crea uno scheduler senza worker attivi (vedi schedResize)
+ *
+ * @param mode         politica di distribuzione
+ * @param maxworkers   numero massimo di worker che estraggono dallo scheduler
+ * @param bulkshare    percentuale di worker che servono la corsia SCH_BULK, 0 per una sola corsia
+ * @param spin_us      microsecondi di attesa attiva di un worker senza lavoro, 0 per sospenderlo subito
+ *
+ * @return puntatore al nuovo scheduler, NULL in caso di fallimento
+ */
+sched_t *createSched(sched_mode_t mode, int maxworkers, int bulkshare, int spin_us);
+
+/**
+ * @function destroySched
+ * @brief Dealloca lo scheduler
+ *
+ * @param s          puntatore allo scheduler
+ */
+void destroySched(sched_t *s);
+
+/**
+ * @function schedPush
+ * @brief Affida una connessione ai worker nella corsia della sua richiesta.
+ *        Con SCH_STEAL una connessione SCH_CTRL va sempre nella coda dello
+ *        stesso worker (fd % nactive), cosi' torna dove il suo stato e'
+ *        ancora in cache. La corsia SCH_BULK e' una coda condivisa
+ *
+ * @param s          puntatore allo scheduler
+ * @param fd         descrittore della connessione (-2 per la terminazione)
+ * @param lane       corsia della richiesta pronta sulla connessione
+ *
+ * @return 0 successo
+ */
+int schedPush(sched_t *s, long fd, sched_lane_t lane);
+
+/**
+ * @function schedPushMany
+ * @brief Affida ai worker le n connessioni pronte dopo una stessa epoll_wait:
+ *        ogni corsia condivisa riceve tutte le sue connessioni con un'unica
+ *        prenotazione delle celle ed i worker sospesi vengono risvegliati
+ *        con un'unica acquisizione della mutex
+ *
+ * @param s          puntatore allo scheduler
+ * @param fds        descrittori delle connessioni
+ * @param lanes      corsia di ogni connessione
+ * @param n          numero di connessioni (al piu' SCH_MAXBATCH)
+ *
+ * @return 0 successo
+ */
+int schedPushMany(sched_t *s, long *fds, sched_lane_t *lanes, int n);
+
+/**
+ * @function schedPop
+ * @brief Estrae la prossima connessione per il worker w, sospendendolo se
+ *        non c'e' lavoro (dopo al piu' spin_us di attesa attiva). La corsia SCH_CTRL ha sempre la precedenza: con
+ *        SCH_STEAL prova prima la propria coda e poi quelle degli altri
+ *        worker, la corsia SCH_BULK solo entro la quota di worker bulkshare
+ *
+ * @param s          puntatore allo scheduler
+ * @param w          slot del worker (0 .. maxworkers-1)
+ *
+ * @return descrittore estratto, SCH_EXIT se il worker deve terminare
+ */
+long schedPop(sched_t *s, int w);
+
+/**
+ * @function schedPopMany
+ * @brief Come schedPop, ma se la coda SCH_CTRL da cui estrae il worker e'
+ *        lunga (piu' connessioni che worker attivi) ne estrae fino a max
+ *        con un'unica prenotazione delle celle
+ *
+ * @param s          puntatore allo scheduler
+ * @param w          slot del worker (0 .. maxworkers-1)
+ * @param fds        dove copiare i descrittori estratti
+ * @param max        numero massimo di descrittori (al piu' SCH_MAXBATCH)
+ *
+ * @return numero di descrittori in fds. Se fds[0] e' SCH_EXIT o negativo
+ *         e' l'unico estratto
+ */
+int schedPopMany(sched_t *s, int w, long *fds, int max);
+
+/**
+ * @function schedResize
+ * @brief Porta a n il numero di worker. I worker in eccesso terminano alla
+ *        successiva schedPop, per quelli mancanti restituisce gli slot su cui
+ *        il chiamante deve avviare un thread
+ *
+ * @param s          puntatore allo scheduler
+ * @param n          worker richiesti (1 .. maxworkers)
+ * @param spawn      array di almeno maxworkers elementi dove scrivere gli slot
+ *
+ * @return numero di slot scritti in spawn
+ */
+int schedResize(sched_t *s, int n, int *spawn);
+
+/**
+ * @function schedSample
+ * @brief Misure dall'ultimo campionamento: attesa media in coda ed utilizzo
+ *        dei worker attivi
+ *
+ * @param s          puntatore allo scheduler
+ * @param wait_us    attesa media in coda (microsecondi)
+ * @param util       percentuale del tempo in cui i worker hanno servito richieste
+ */
+void schedSample(sched_t *s, unsigned long *wait_us, unsigned *util);
+
+/**
+ * @function schedSpinStats
+ * @brief Attese attive dei worker dalla creazione dello scheduler
+ *
+ * @param s          puntatore allo scheduler
+ * @param spins      attese attive iniziate
+ * @param hits       attese attive che hanno trovato lavoro senza sospendere il worker
+ */
+void schedSpinStats(sched_t *s, unsigned long *spins, unsigned long *hits);
+
+#endif /* SCHEDULER_H_ */
@@ -19,6 +19,13 @@ struct statistics {
     unsigned long nfiledelivered;               // n. di file consegnati
     unsigned long nfilenotdelivered;            // n. di file non ancora consegnati
     unsigned long nerrors;                      // n. di messaggi di errore
+    unsigned long nthreads;                     // n. di worker attivi
+    unsigned long npoolgrow;                    // n. di worker aggiunti dal controllore del pool
+    unsigned long npoolshrink;                  // n. di worker tolti dal controllore del pool
+    unsigned long nspins;                       // n. di attese attive di worker senza lavoro
+    unsigned long nspinhits;                    // n. di attese attive concluse trovando lavoro
+    unsigned long nbuckets;                     // n. di posizioni della tabella degli utenti
+    unsigned long loadfactor;                   // utenti registrati per 100 posizioni
 };
 
 /* aggiungere qui altre funzioni di utilita' per le statistiche */
@@ -35,7 +42,7 @@ struct statistics {
 static inline int printStats(FILE *fout) {
     extern struct statistics chattyStats;
 
-    if (fprintf(fout, "%ld - %ld %ld %ld %ld %ld %ld %ld\n",
+    if (fprintf(fout, "%ld - %ld %ld %ld %ld %ld %ld %ld %ld %ld %ld %ld %ld %ld %ld\n",
 		(unsigned long)time(NULL),
 		chattyStats.nusers, 
 		chattyStats.nonline,
@@ -43,7 +50,14 @@ static inline int printStats(FILE *fout) {
 		chattyStats.nnotdelivered,
 		chattyStats.nfiledelivered,
 		chattyStats.nfilenotdelivered,
-		chattyStats.nerrors
+		chattyStats.nerrors,
+		chattyStats.nthreads,
+		chattyStats.npoolgrow,
+		chattyStats.npoolshrink,
+		chattyStats.nspins,
+		chattyStats.nspinhits,
+		chattyStats.nbuckets,
+		chattyStats.loadfactor
 		) < 0) return -1;
     fflush(fout);
     return 0;
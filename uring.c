@@ -0,0 +1,198 @@
+/**
+ * @file  uring.c
+ * @author Federico Germinario 545081
+ *
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ *
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+// Gli indici degli anelli sono condivisi con il kernel
+#define LOAD_ACQ(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_REL(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/**
+ * @function uringCreate
+ * @brief Crea un io_uring
+ *
+ * @param entries   numero di richieste che possono essere in volo
+ *
+ * @return puntatore al nuovo io_uring, NULL se il kernel non lo supporta
+ */
+uring_t *uringCreate(unsigned entries){
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(struct io_uring_params));
+    int fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+    if(fd == -1){
+        perror("io_uring_setup");
+        return NULL;
+    }
+
+    uring_t *u = calloc(1, sizeof(uring_t));
+    if(u == NULL){
+        close(fd);
+        return NULL;
+    }
+    u->fd = fd;
+    u->sq_sz   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_sz   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Con IORING_FEAT_SINGLE_MMAP i due anelli stanno in un'unica mappatura
+    int single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single && u->cq_sz > u->sq_sz) u->sq_sz = u->cq_sz;
+    u->sq_ptr = mmap(NULL, u->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_SQ_RING);
+    if(u->sq_ptr == MAP_FAILED){
+        perror("mmap sq");
+        close(fd);
+        free(u);
+        return NULL;
+    }
+    if(single){
+        u->cq_ptr = u->sq_ptr;
+        u->cq_sz  = 0;
+    }else{
+        u->cq_ptr = mmap(NULL, u->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_CQ_RING);
+        if(u->cq_ptr == MAP_FAILED){
+            perror("mmap cq");
+            munmap(u->sq_ptr, u->sq_sz);
+            close(fd);
+            free(u);
+            return NULL;
+        }
+    }
+    u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_SQES);
+    if(u->sqes == MAP_FAILED){
+        perror("mmap sqes");
+        if(u->cq_sz) munmap(u->cq_ptr, u->cq_sz);
+        munmap(u->sq_ptr, u->sq_sz);
+        close(fd);
+        free(u);
+        return NULL;
+    }
+
+    char *sq = u->sq_ptr, *cq = u->cq_ptr;
+    u->sq_head    = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail    = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask    = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array   = (unsigned *)(sq + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+    u->cq_head    = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail    = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask    = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes       = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return u;
+}
+
+/**
+ * @function uringDestroy
+ * @brief Rilascia l'io_uring
+ *
+ * @param u         puntatore all'io_uring
+ */
+void uringDestroy(uring_t *u){
+    if(u == NULL) return;
+    munmap(u->sqes, u->sqes_sz);
+    if(u->cq_sz) munmap(u->cq_ptr, u->cq_sz);
+    munmap(u->sq_ptr, u->sq_sz);
+    close(u->fd);
+    free(u);
+}
+
+/**
+ * @function uringGetSqe
+ * @brief Restituisce una richiesta libera e azzerata da preparare
+ *
+ * @param u         puntatore all'io_uring
+ *
+ * @return puntatore alla richiesta, NULL se l'anello e' pieno
+ */
+struct io_uring_sqe *uringGetSqe(uring_t *u){
+    unsigned head = LOAD_ACQ(u->sq_head);
+    unsigned tail = *u->sq_tail + u->pending;
+    if(tail - head >= u->sq_entries) return NULL;
+
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &(u->sqes[idx]);
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    u->sq_array[idx] = idx;
+    u->pending++;
+    return sqe;
+}
+
+/**
+ * @function uringSubmit
+ * @brief Sottomette le richieste preparate ed attende almeno wait completamenti,
+ *        con una sola io_uring_enter
+ *
+ * @param u         puntatore all'io_uring
+ * @param wait      completamenti da attendere
+ *
+ * @return numero di richieste sottomesse, -1 errore
+ */
+int uringSubmit(uring_t *u, unsigned wait){
+    unsigned n = u->pending;
+    unsigned head = LOAD_ACQ(u->sq_head);
+    // Pubblico le nuove richieste al kernel
+    STORE_REL(u->sq_tail, *u->sq_tail + n);
+    u->pending = 0;
+
+    unsigned flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int r;
+    while((r = (int) syscall(__NR_io_uring_enter, u->fd, n, wait, flags, NULL, 0)) == -1 && errno == EINTR){
+        // Ripeto sottomettendo solo le richieste non ancora consumate dal kernel
+        n = *u->sq_tail - LOAD_ACQ(u->sq_head);
+    }
+    if(r == -1) perror("io_uring_enter");
+    // Le richieste consumate sono in volo anche se io_uring_enter e' fallita,
+    // le altre le ritiro dall'anello
+    u->inflight += LOAD_ACQ(u->sq_head) - head;
+    STORE_REL(u->sq_tail, LOAD_ACQ(u->sq_head));
+    return r;
+}
+
+/**
+ * @function uringWait
+ * @brief Attende, bloccandosi, almeno un completamento se ci sono richieste
+ *        in volo
+ *
+ * @param u         puntatore all'io_uring
+ */
+void uringWait(uring_t *u){
+    while(u->inflight > 0 && *u->cq_head == LOAD_ACQ(u->cq_tail)){
+        if(syscall(__NR_io_uring_enter, u->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1 && errno != EINTR){
+            // Es. ENOMEM: i completamenti arrivano comunque, riprovo senza girare a vuoto
+            struct timespec ts = { 0, 1000000 };
+            nanosleep(&ts, NULL);
+        }
+    }
+}
+
+/**
+ * @function uringReap
+ * @brief Estrae un completamento
+ *
+ * @param u         puntatore all'io_uring
+ * @param cqe       dove copiare il completamento
+ *
+ * @return 1 completamento estratto, 0 nessun completamento
+ */
+int uringReap(uring_t *u, struct io_uring_cqe *cqe){
+    unsigned head = *u->cq_head;
+    if(head == LOAD_ACQ(u->cq_tail)) return 0;
+    *cqe = u->cqes[head & *u->cq_mask];
+    STORE_REL(u->cq_head, head + 1);
+    u->inflight--;
+    return 1;
+}
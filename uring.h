@@ -0,0 +1,120 @@
+/**
+ * @file  uring.h
+ * @brief Interfaccia minima ad io_uring (senza liburing): un reactor prepara
+ *        piu' operazioni e le sottomette con una sola io_uring_enter
+ * @author Federico Germinario 545081
+ *
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ *
+ */
+#ifndef URING_H_
+#define URING_H_
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/**
+ *  @struct uring
+ *  @brief Anelli di sottomissione e completamento condivisi con il kernel
+ *
+ *  @var fd         descrittore restituito da io_uring_setup
+ *  @var sq_*       puntatori ai campi dell'anello di sottomissione
+ *  @var sqes       array delle richieste
+ *  @var cq_*       puntatori ai campi dell'anello di completamento
+ *  @var cqes       array dei completamenti
+ *  @var sq_ptr     mappatura dell'anello di sottomissione
+ *  @var cq_ptr     mappatura dell'anello di completamento
+ *  @var sq_sz      dimensione di sq_ptr
+ *  @var cq_sz      dimensione di cq_ptr (0 se condivisa con sq_ptr)
+ *  @var sqes_sz    dimensione di sqes
+ *  @var pending    richieste preparate e non ancora sottomesse
+ *  @var inflight   richieste consumate dal kernel e non ancora estratte con uringReap
+ */
+typedef struct {
+    int                  fd;
+    unsigned            *sq_head;
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    unsigned             sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_cqe *cqes;
+    void                *sq_ptr;
+    void                *cq_ptr;
+    size_t               sq_sz;
+    size_t               cq_sz;
+    size_t               sqes_sz;
+    unsigned             pending;
+    unsigned             inflight;
+} uring_t;
+
+/**
+ * @function uringCreate
+ * @brief Crea un io_uring
+ *
+ * @param entries   numero di richieste che possono essere in volo
+ *
+ * @return puntatore al nuovo io_uring, NULL se il kernel non lo supporta
+ */
+uring_t *uringCreate(unsigned entries);
+
+/**
+ * @function uringDestroy
+ * @brief Rilascia l'io_uring
+ *
+ * @param u         puntatore all'io_uring
+ */
+void uringDestroy(uring_t *u);
+
+/**
+ * @function uringGetSqe
+ * @brief Restituisce una richiesta libera e azzerata da preparare
+ *
+ * @param u         puntatore all'io_uring
+ *
+ * @return puntatore alla richiesta, NULL se l'anello e' pieno
+ */
+struct io_uring_sqe *uringGetSqe(uring_t *u);
+
+/**
+ * @function uringSubmit
+ * @brief Sottomette le richieste preparate ed attende almeno wait completamenti,
+ *        con una sola io_uring_enter. Le richieste che il kernel non consuma
+ *        vengono ritirate dall'anello: non ne arrivera' il completamento e
+ *        non partono con la io_uring_enter successiva
+ *
+ * @param u         puntatore all'io_uring
+ * @param wait      completamenti da attendere
+ *
+ * @return numero di richieste sottomesse, -1 errore (u->inflight conta le
+ *         richieste comunque in volo, di cui vanno estratti i completamenti)
+ */
+int uringSubmit(uring_t *u, unsigned wait);
+
+/**
+ * @function uringWait
+ * @brief Attende, bloccandosi, almeno un completamento se ci sono richieste
+ *        in volo. Non fallisce: se io_uring_enter non e' utilizzabile riprova
+ *        dopo una pausa, perche' le richieste in volo usano ancora la memoria
+ *        del chiamante
+ *
+ * @param u         puntatore all'io_uring
+ */
+void uringWait(uring_t *u);
+
+/**
+ * @function uringReap
+ * @brief Estrae un completamento
+ *
+ * @param u         puntatore all'io_uring
+ * @param cqe       dove copiare il completamento
+ *
+ * @return 1 completamento estratto, 0 nessun completamento
+ */
+int uringReap(uring_t *u, struct io_uring_cqe *cqe);
+
+#endif /* URING_H_ */
@@ -12,101 +12,113 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <errno.h>
-#include "icl_hash.h"
+#include <limits.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "usertab.h"
 #include "user.h"
 #include "config.h"
 #include "util.h"
 
 #define DEFAULT_NBUCKETS_HASH 1024
 
-// Mutex utilizzata per le operazioni in m.e sull' array degli utenti connessi 
+#define NAME_SIZE (MAX_NAME_LENGTH + 1)
+
+// Mutex della lista densa degli utenti connessi: viene presa solo per
+// spostare un elemento o per ricostruire la lista inviata ai client. E'
+// unica perche' ogni cambio di presenza tocca l'ultimo elemento della lista
+// densa e il contatore, comuni a tutti gli fd: la sezione critica sono
+// poche scritture in tempo costante
 static pthread_mutex_t online_mtx = PTHREAD_MUTEX_INITIALIZER;
 
+// Mutex delle liste libere (online_list_t)
+static pthread_mutex_t lists_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 /**
  * @function add_user_online
- * @brief Aggiunge un utente all' array degli utenti connessi in mutua esclusione
+ * @brief Aggiunge un utente a quelli connessi in tempo costante
  *
  * @param users_db          puntatore alla struttura dati del server
- * @param name              nome utente da inserire nell' array
+ * @param name              nome utente connesso
+ * @param fd                file descriptor dell'utente
  *
  * @returns 0 successo, -1 fallimento
  */
 int add_user_online(users_db_t *users_db, char * name, int fd){
-    if(users_db == NULL || name == NULL){
+    if(users_db == NULL || name == NULL || fd < 0 || fd >= users_db->max_fd){
         errno = EINVAL;
         return -1;
     }
-    int i = 0;
-    int stop = 0;
+    user_online_t *u = &(users_db->users_online[fd]);
+
     pthread_mutex_lock(&online_mtx);
-    // Itero sull' array 
-    while(!stop && i < users_db->max_connections){
-        if(strcmp(users_db->users_online[i].name, "") == 0 ){
-            strncpy(users_db->users_online[i].name, name, MAX_NAME_LENGTH + 1);
-            users_db->users_online[i].fd = fd;
-            stop = 1;
-        }
-        i++;
+    int n = users_db->n_users_online;
+    // Sull'fd e' gia' connesso un utente: il suo nome non va sovrascritto
+    if(u->pos != -1 || n >= users_db->max_connections){
+        pthread_mutex_unlock(&online_mtx);
+        return -1;
     }
+    strncpy(u->name, name, MAX_NAME_LENGTH + 1);
+    u->pos = n;
+    users_db->online[n] = fd;
+    strncpy(users_db->online_names + (size_t)n * NAME_SIZE, name, NAME_SIZE);
+    __atomic_store_n(&users_db->n_users_online, n + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&users_db->online_version, 1, __ATOMIC_RELEASE);
     pthread_mutex_unlock(&online_mtx);
-    if(!stop) return -1;
-    users_db->n_users_online ++;
     return 0;
 }
 
 /**
  * @function delete_user_online
- * @brief Elimina un utente dall' array degli utenti connessi in mutua esclusione
+ * @brief Elimina un utente da quelli connessi in tempo costante: l'ultimo
+ *        della lista densa prende il suo posto
  *
  * @param users_db          puntatore alla struttura dati del server
- * @param name              nome utente da eliminare dall' array
+ * @param fd                file descriptor dell'utente
  *
  * @returns 0 successo, -1 fallimento
  */
-int delete_user_online(users_db_t *users_db, char * name){
-    if(users_db == NULL || name == NULL){
+int delete_user_online(users_db_t *users_db, int fd){
+    if(users_db == NULL || fd < 0 || fd >= users_db->max_fd){
         errno = EINVAL;
         return -1;
     }
-    int i = 0;
-    int stop = 0;
+    user_online_t *u = &(users_db->users_online[fd]);
+
     pthread_mutex_lock(&online_mtx);
-    // Itero sull' array fino a quando non trovo name
-    while(!stop && i < users_db->max_connections){
-        if(strncmp(users_db->users_online[i].name, name, MAX_NAME_LENGTH + 1) == 0 ){
-            strcpy(users_db->users_online[i].name, "");
-            users_db->users_online[i].fd = -1;
-            stop = 1;
-        }
-        i++;
-    }
-    if(!stop){
+    int pos = u->pos;
+    if(pos == -1){
         pthread_mutex_unlock(&online_mtx);
         return -1;
     }
-    users_db->n_users_online--;
+    int last = users_db->n_users_online - 1;
+    int moved = users_db->online[last];
+    users_db->online[pos] = moved;
+    users_db->users_online[moved].pos = pos;
+    memcpy(users_db->online_names + (size_t)pos * NAME_SIZE, users_db->online_names + (size_t)last * NAME_SIZE, NAME_SIZE);
+    u->pos = -1;
+    __atomic_store_n(&users_db->n_users_online, last, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&users_db->online_version, 1, __ATOMIC_RELEASE);
     pthread_mutex_unlock(&online_mtx);
     return 0;
 }
 
 /**
- * @function free_data 
- * @brief Dealloca risorse del campo data della hash table
+ * @function free_user 
+ * @brief Dealloca le risorse di un utente della tabella
  *
  * @param user      puntatore all' utente da deallocare 
  */
-void free_data(void *user){
-    user_t *tmp = (user_t *) user;
-    destroyHistory(tmp->history);
-    free(tmp);
-    tmp = NULL;
+static void free_user(user_t *user){
+    destroyHistory(user->history);
+    user->history = NULL;
 }
 
 /**
  * @function users_db_create
  * @brief Inizializza le strutture dati del server
  *
- * @param nbuckets          dimensione tabella hash utenti registrati
+ * @param nbuckets          posizioni iniziali della tabella degli utenti registrati
  * @param maxconnections    numero massimo di connessioni gestite dal server
  * @param history_size      numero massimo di messaggi che il server 'ricorda' per ogni client
  *
@@ -118,21 +130,30 @@ users_db_t * users_db_create(int nbuckets, int max_connections, int history_size
         return NULL;
     }
 
-    // Controllo numero buckets della tabella hash 
+    // Controllo numero di posizioni della tabella
     if(nbuckets <= 0) nbuckets = DEFAULT_NBUCKETS_HASH;
 
     users_db_t * users_db = (users_db_t *) Calloc(1,sizeof(users_db_t));
     users_db->max_connections = max_connections;
-    // Inizializzo tabella hash 
-    users_db->db = icl_hash_create(nbuckets, NULL, NULL);
+    // Inizializzo la tabella degli utenti
+    users_db->db = utCreate(nbuckets);
     if(users_db->db == NULL) return NULL;
-    users_db->users_online = (user_online_t *) Calloc(max_connections, sizeof(user_online_t));
-    
-    // Inizializzo l'array degli utenti online 
-    for(int i = 0; i < max_connections; i++){
-        strncpy(users_db->users_online[i].name, "", 1);
-        users_db->users_online[i].fd = -1;
+
+    // La presenza ha un elemento per ogni fd che il processo puo' aprire
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > INT_MAX){
+        users_db->max_fd = (int) sysconf(_SC_OPEN_MAX);
+    }else{
+        users_db->max_fd = (int) rl.rlim_cur;
     }
+    users_db->users_online = (user_online_t *) Calloc(users_db->max_fd, sizeof(user_online_t));
+    for(int i = 0; i < users_db->max_fd; i++) users_db->users_online[i].pos = -1;
+    users_db->online = (int *) Calloc(max_connections, sizeof(int));
+    users_db->online_names = (char *) Calloc(max_connections, NAME_SIZE);
+    
+    // Lista vuota iniziale, versione 0
+    users_db->online_list = (online_list_t *) Calloc(1, sizeof(online_list_t) + (size_t)max_connections * NAME_SIZE);
+    users_db->online_list->refs = 1;
     
     users_db->history_size = history_size;
     return users_db;
@@ -151,11 +172,17 @@ int users_db_destroy(users_db_t *users_db){
         errno = EINVAL;
         return -1;
     }
-    if(!icl_hash_destroy(users_db->db, NULL, free_data)){ 
-        free(users_db->users_online);
-        return 0;
+    utDestroy(users_db->db, free_user);
+    free(users_db->users_online);
+    free(users_db->online);
+    free(users_db->online_names);
+    free(users_db->online_list);
+    while(users_db->free_lists != NULL){
+        online_list_t *l = users_db->free_lists;
+        users_db->free_lists = l->next;
+        free(l);
     }
-    return -1;
+    return 0;
 }
 
 /**
@@ -173,21 +200,21 @@ int register_user(users_db_t *users_db, char * name){
         return -2;
     }
 
-    // Prendo la mutua esclusione sulla sezione della tabella hash che contiene name come chiave 
-    lock_hash_section(users_db->db, name);
-    user_t *user = (user_t *) Malloc(sizeof(user_t));          // Creo un nuovo utente
-    strncpy(user->name, name, MAX_NAME_LENGTH + 1);   
-    user->history = createHistory(users_db->history_size);     // Creo una nuova history per l'utente
-    user->fd = -1;
+    // Prendo la mutua esclusione sulla sezione della tabella che contiene name
+    ut_ref_t ref;
+    if(utLockFind(users_db->db, name, &ref) != NULL){ // Utente gia registrato
+        utUnlock(users_db->db, &ref);
+        return -1;
+    }
 
-    // Inserisco il nuovo utente nella tabella hash 
-    int ret = icl_hash_insert(users_db->db, user->name, (void *)user);
-    if(ret == -1 || ret == -2){ // Utente gia registrato o errore generico 
-        free_data(user);
-        unlock_hash_section(users_db->db, name);
-        return ret;
+    // Il nuovo utente e' memorizzato direttamente nella tabella
+    user_t *user = utInsert(users_db->db, &ref, name);
+    if(user == NULL){
+        utUnlock(users_db->db, &ref);
+        return -2;
     }
-    unlock_hash_section(users_db->db, name);
+    user->history = createHistory(users_db->history_size);     // Creo una nuova history per l'utente
+    utUnlock(users_db->db, &ref);
     return 0;
 }
 
@@ -206,58 +233,127 @@ int unregister_user(users_db_t *users_db, char *name){
         return -2;
     }
 
-    // Prendo la mutua esclusione sulla sezione della tabella hash che contiene name come chiave 
-    lock_hash_section(users_db->db, name);
+    // Prendo la mutua esclusione sulla sezione della tabella che contiene name
+    ut_ref_t ref;
 
     // Controllo che l'utente sia registrato
-    user_t *user = icl_hash_find(users_db->db, name);
+    user_t *user = utLockFind(users_db->db, name, &ref);
     if(user == NULL){
-        unlock_hash_section(users_db->db, name);
+        utUnlock(users_db->db, &ref);
         return -1;
     }
    
-    // Elimino l'utente dall' array degli utenti connessi 
-    delete_user_online(users_db, name);
+    // Elimino l'utente da quelli connessi 
+    if(user->fd != -1) delete_user_online(users_db, user->fd);
 
-    // Elimino l'utente dalla tabella hash deallocando la memoria allocata
-    // precedentemente 
-    int ret = icl_hash_delete(users_db->db, name, NULL, free_data);   
-    unlock_hash_section(users_db->db, name);
-    return ret;
+    // Elimino l'utente dalla tabella deallocando la sua history
+    free_user(user);
+    utDelete(users_db->db, &ref);
+    utUnlock(users_db->db, &ref);
+    return 0;
+}
+
+/**
+ * @function listGet
+ * @brief Prende un riferimento ad una lista solo se non e' libera
+ *
+ * @returns 1 riferimento preso, 0 lista libera
+ */
+static int listGet(online_list_t *l){
+    int r = __atomic_load_n(&l->refs, __ATOMIC_RELAXED);
+    do{
+        if(r == 0) return 0;
+    }while(!__atomic_compare_exchange_n(&l->refs, &r, r + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    return 1;
+}
+
+/**
+ * @function rebuild_users_online
+ * @brief Sostituisce la lista corrente con una costruita dalla presenza
+ *        attuale, se e' cambiata: una sola copia dei nomi gia' nel formato
+ *        inviato ai client
+ *
+ * @returns 0 successo, -1 fallimento
+ */
+static int rebuild_users_online(users_db_t *users_db){
+    pthread_mutex_lock(&online_mtx);
+    online_list_t *old = users_db->online_list;
+    if(old->version == users_db->online_version){   // Gia' ricostruita da un altro lettore
+        pthread_mutex_unlock(&online_mtx);
+        return 0;
+    }
+
+    pthread_mutex_lock(&lists_mtx);
+    online_list_t *l = users_db->free_lists;
+    if(l != NULL) users_db->free_lists = l->next;
+    pthread_mutex_unlock(&lists_mtx);
+    if(l == NULL) l = malloc(sizeof(online_list_t) + (size_t)users_db->max_connections * NAME_SIZE);
+    if(l == NULL){
+        pthread_mutex_unlock(&online_mtx);
+        return -1;
+    }
+
+    l->version = users_db->online_version;
+    l->n       = users_db->n_users_online;
+    l->next    = NULL;
+    memcpy(l->names, users_db->online_names, (size_t)l->n * NAME_SIZE);
+    __atomic_store_n(&l->refs, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&users_db->online_list, l, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&online_mtx);
+
+    // Tolgo alla vecchia lista il riferimento di lista corrente
+    release_users_online(users_db, old);
+    return 0;
 }
 
 /**
- * @function get_users_online
- * @brief Lista utenti online
+ * @function acquire_users_online
+ * @brief Lista degli utenti online, senza copiarla e senza mutua esclusione
+ *        se la presenza non e' cambiata dall'ultima costruzione. Va
+ *        restituita con release_users_online
  *
  * @param users_db       puntatore alla struttura dati del server 
- * @param list_online    puntatore alla lista dove andare a scrivere
- *                       i nomi degli utenti online  
  *
- * @returns >= 0 numero utenti online, -1 fallimento
+ * @returns lista degli utenti online, NULL fallimento
  */
-int get_users_online(users_db_t *users_db, char **list_online){
-     if(users_db == NULL){
+online_list_t *acquire_users_online(users_db_t *users_db){
+    if(users_db == NULL){
         errno = EINVAL;
-        return -1;
+        return NULL;
     }
 
-    // Prendo la mutua esclusione sull' array degli utenti connessi
-    pthread_mutex_lock(&online_mtx);
-    int ret = users_db->n_users_online;
-    *list_online = (char *)Calloc(ret * (MAX_NAME_LENGTH + 1), sizeof(char));
-    char * tmp = *list_online;
-
-    // Itero sull'array 
-    for(int i = 0; i < users_db->max_connections; i++){
-        if(strncmp(users_db->users_online[i].name, "", 1) != 0 ){
-            strncpy(tmp, users_db->users_online[i].name, MAX_NAME_LENGTH + 1);
-            tmp += MAX_NAME_LENGTH + 1;
+    while(1){
+        online_list_t *l = __atomic_load_n(&users_db->online_list, __ATOMIC_ACQUIRE);
+        // La lista puo' essere stata sostituita e liberata (anche riusata)
+        // tra la lettura del puntatore e il riferimento: vale solo se e'
+        // ancora quella corrente
+        if(listGet(l)){
+            if(__atomic_load_n(&users_db->online_list, __ATOMIC_ACQUIRE) == l){
+                if(l->version == __atomic_load_n(&users_db->online_version, __ATOMIC_ACQUIRE)) return l;
+                release_users_online(users_db, l);
+                if(rebuild_users_online(users_db) == -1) return NULL;
+                continue;
+            }
+            release_users_online(users_db, l);
         }
     }
-    pthread_mutex_unlock(&online_mtx);
+}
 
-    return ret;
+/**
+ * @function release_users_online
+ * @brief Restituisce una lista ottenuta con acquire_users_online
+ *
+ * @param users_db       puntatore alla struttura dati del server 
+ * @param list           lista da restituire
+ */
+void release_users_online(users_db_t *users_db, online_list_t *list){
+    if(users_db == NULL || list == NULL) return;
+    if(__atomic_sub_fetch(&list->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+    // Ultimo riferimento: la lista torna tra quelle libere
+    pthread_mutex_lock(&lists_mtx);
+    list->next = users_db->free_lists;
+    users_db->free_lists = list;
+    pthread_mutex_unlock(&lists_mtx);
 }
 
 /**
@@ -276,23 +372,22 @@ int connect_user(users_db_t *users_db, char* name, int fd){
         return -1;
     }
     
-    // Prendo la mutua esclusione sulla sezione della tabella hash che contiene name come chiave 
-    lock_hash_section(users_db->db, name);
-    
-    user_t *user = icl_hash_find(users_db->db, name);
+    // Prendo la mutua esclusione sulla sezione della tabella che contiene name
+    ut_ref_t ref;
+    user_t *user = utLockFind(users_db->db, name, &ref);
     if(user == NULL){        // Utente non registrato
-        unlock_hash_section(users_db->db, name);
+        utUnlock(users_db->db, &ref);
         return -2;
     }else if(user->fd != -1){ // Utente gia connesso
-        unlock_hash_section(users_db->db, name);
+        utUnlock(users_db->db, &ref);
         return -3;
     }
     // Utente registrato ma non connesso
      
     // Aggiorno informazioni sull' utente
-    user->fd = fd;
     int ret = add_user_online(users_db, name, fd);
-    unlock_hash_section(users_db->db, name);
+    if(ret == 0) user->fd = fd;
+    utUnlock(users_db->db, &ref);
     return ret;
 }
 
@@ -311,23 +406,23 @@ int disconnect_user(users_db_t *users_db, char *name){
         return -1;
     }
 
-    // Prendo la mutua esclusione sulla sezione della tabella hash che contiene name come chiave 
-    lock_hash_section(users_db->db, name);
+    // Prendo la mutua esclusione sulla sezione della tabella che contiene name
+    ut_ref_t ref;
     
     //Controllo che l'utente sia registrato
-    user_t *user = icl_hash_find(users_db->db, name);
+    user_t *user = utLockFind(users_db->db, name, &ref);
     if (user == NULL){          // Utente non registrato
-        unlock_hash_section(users_db->db, name);  
+        utUnlock(users_db->db, &ref);  
         return -2;
     }else if(user->fd == -1){   // Utente gia disconnesso
-        unlock_hash_section(users_db->db, name);
+        utUnlock(users_db->db, &ref);
         return -3;
     }
     //Utente registrato e online 
     
+    int ret = delete_user_online(users_db, user->fd);
     user->fd = -1;
-    int ret = delete_user_online(users_db, name);
-    unlock_hash_section(users_db->db, name);
+    utUnlock(users_db->db, &ref);
     return ret;
 }
 
@@ -341,79 +436,61 @@ int disconnect_user(users_db_t *users_db, char *name){
  * @returns 0 successo, -1 fallimento, -2 utente non registrato, -3 utente gia disconnesso.
  */
 int disconnect_user_fd(users_db_t *users_db, int fd){
-    if(users_db == NULL || fd < 0){
+    if(users_db == NULL || fd < 0 || fd >= users_db->max_fd){
         errno = EINVAL;
         return -1;
     }
 
-    int i = 0;
-    int stop = 0;
-
-    char *name;  
-    
-    // Prendo la mutua esclusione sull' array degli utenti connessi
+    // Il nome dell'utente connesso sull'fd e' nella sua voce della presenza
+    char name[MAX_NAME_LENGTH + 1];
     pthread_mutex_lock(&online_mtx);
-
-    // Cerco nell'array il file descriptor, ricavo il suo nome utente e lo elimino  
-    while(!stop && i < users_db->max_connections){
-        if(users_db->users_online[i].fd == fd ){
-            name = Calloc((strlen(users_db->users_online[i].name) + 1), sizeof(char));
-            strncpy(name, users_db->users_online[i].name,(strlen(users_db->users_online[i].name) + 1));
-            strncpy(users_db->users_online[i].name, "", 1);
-            users_db->users_online[i].fd = -1;
-            stop = 1;
-        }
-        i++;
-    }
+    int online = users_db->users_online[fd].pos != -1;
+    if(online) strncpy(name, users_db->users_online[fd].name, MAX_NAME_LENGTH + 1);
     pthread_mutex_unlock(&online_mtx);
+    if(!online) return -1;
 
-    // Controllo se ho trovato in nome utente relativo a fd 
-    if(stop != 1){ 
-        return -1;
-    }
-
-    // Prendo la mutua esclusione sulla sezione della tabella hash che contiene name come chiave 
-    lock_hash_section(users_db->db, name);
+    // Prendo la mutua esclusione sulla sezione della tabella che contiene name
+    ut_ref_t ref;
 
     //Controllo che l'utente sia registrato
-    user_t *user = icl_hash_find(users_db->db, name);
+    user_t *user = utLockFind(users_db->db, name, &ref);
     if (user == NULL){          // Utente non registrato
-        unlock_hash_section(users_db->db, name);
-        free(name);  
+        utUnlock(users_db->db, &ref);
         return -2;
-    }else if(user->fd == -1){   // Utente gia disconnesso
-        unlock_hash_section(users_db->db, name);
-        free(name);
+    }else if(user->fd != fd){   // Utente gia disconnesso (anche da un altro fd)
+        utUnlock(users_db->db, &ref);
         return -3;
     }
    
+    int ret = delete_user_online(users_db, fd);
     user->fd = -1;
-    users_db->n_users_online --;  // Aggiorno numero utenti online
-    unlock_hash_section(users_db->db, name);
-    free(name);
-    return 0;
+    utUnlock(users_db->db, &ref);
+    return ret;
 }
 
 /**
  * @function get_user
- * @brief Restituisce la struttura dell' utente name
+ * @brief Copia la struttura dell' utente name: gli utenti stanno nella
+ *        tabella e cambiano posto quando questa cresce
  *
  * @param users_db      puntatore alla struttura dati del server
  * @param name          nome utente di cui si vuole recuperare la struttura
+ * @param user          dove copiare la struttura dell' utente
  *
- * @returns puntatore alla struttura dati dell' utente
+ * @returns 0 successo, -1 utente non registrato o fallimento
  */
-user_t * get_user(users_db_t *users_db, char* name){
-    if(users_db == NULL || name == NULL){
+int get_user(users_db_t *users_db, char* name, user_t *user){
+    if(users_db == NULL || name == NULL || user == NULL){
         errno = EINVAL;
-        return NULL;
+        return -1;
     }
 
-    lock_hash_section(users_db->db, name);
-    user_t *user = icl_hash_find(users_db->db, name);
-    unlock_hash_section(users_db->db, name);
+    ut_ref_t ref;
+    user_t *found = utLockFind(users_db->db, name, &ref);
+    if(found != NULL) *user = *found;
+    utUnlock(users_db->db, &ref);
 
-    return user;
+    return found != NULL ? 0 : -1;
 }     
 
 /**
@@ -431,15 +508,15 @@ history_t *history_sender(users_db_t *users_db, char *name){
         return NULL;
     }
     
-    // Prendo la mutua esclusione sulla sezione della tabella hash che contiene name come chiave 
-    lock_hash_section(users_db->db, name);
-    user_t *user = icl_hash_find(users_db->db, (void *) name);
+    // Prendo la mutua esclusione sulla sezione della tabella che contiene name
+    ut_ref_t ref;
+    user_t *user = utLockFind(users_db->db, name, &ref);
     if(user == NULL){
-        unlock_hash_section(users_db->db, name);
+        utUnlock(users_db->db, &ref);
         return NULL;
     }
     history_t * ret = user->history;
-    unlock_hash_section(users_db->db, name);
+    utUnlock(users_db->db, &ref);
     return ret;
 }
 
@@ -8,61 +8,85 @@
  *  originale dell'autore
  * 
  */
+#ifndef USER_H_
+#define USER_H_
+
 #include <stdio.h>
-#include "icl_hash.h"
+#include "usertab.h"
 #include "config.h"
 #include "history.h"
 
-/**
- *  @struct user
- *  @brief Struttura utente registrato
- *
- *  @var name       nickname 
- *  @var fd         file descriptor del nickname
- *  @var history    puntatore alla history del nickname     
- */
-typedef struct {
-    char name[MAX_NAME_LENGTH + 1];
-    int fd;
-    history_t *history; 
-}user_t;
-
 /**
  *  @struct user_online
- *  @brief Struttura utente online
+ *  @brief Presenza di un utente su un file descriptor (un elemento per fd)
  *
- *  @var name       nickname 
- *  @var fd         file descriptor del nickname   
+ *  @var name       nickname dell'ultimo utente connesso sull'fd
+ *  @var pos        posizione dell'fd nella lista densa degli utenti online, -1 se offline
  */
 typedef struct {
     char name[MAX_NAME_LENGTH + 1];
-    int fd;
+    int pos;
 }user_online_t;
 
+/**
+ *  @struct online_list
+ *  @brief Lista degli utenti online gia' nel formato inviato ai client,
+ *         immutabile e condivisa dai lettori. Viene sostituita da una nuova
+ *         quando la presenza cambia; le liste non piu' usate tornano libere
+ *         per essere riusate e non vengono deallocate fino alla distruzione
+ *         del server, cosi' un lettore puo' sempre toccarne una vecchia
+ *
+ *  @var refs       riferimenti: 1 se e' la lista corrente piu' uno per lettore, 0 se libera
+ *  @var version    versione della presenza da cui e' stata costruita
+ *  @var n          numero di nomi
+ *  @var next       lista successiva tra quelle libere
+ *  @var names      n nomi da MAX_NAME_LENGTH+1 caratteri (spazio per max_connections)
+ */
+typedef struct online_list {
+    int refs;
+    unsigned long version;
+    int n;
+    struct online_list *next;
+    char names[];
+}online_list_t;
+
 /**
  *  @struct users_db
  *  @brief Struttura dati utilizzata dal server
  *
- *  @var db                 puntatore a una tabella hash contenente gli utenti registrati 
- *  @var users_online       puntatore a un array contenente gli utenti online
- *  @var n_users_online     numero utenti online
+ *  @var db                 tabella degli utenti registrati (utenti memorizzati nella tabella)
+ *  @var users_online       presenza degli utenti indicizzata per file descriptor
+ *  @var max_fd             numero di elementi di users_online
+ *  @var online             lista densa degli fd con un utente online (i primi n_users_online)
+ *  @var online_names       nomi degli utenti online, nello stesso ordine di online
+ *  @var n_users_online     numero utenti online (letto senza mutua esclusione)
+ *  @var online_version     incrementata ad ogni cambio della presenza
+ *  @var online_list        lista corrente degli utenti online (vedi acquire_users_online)
+ *  @var free_lists         liste libere da riusare
  *  @var history_size       dimensione massima history per ogni utente
  *  @var max_connections    connessioni massime contemporanee accettate dal server
  */
 typedef struct {
-    icl_hash_t *db;                  
+    usertab_t *db;                  
     user_online_t *users_online;     
+    int max_fd;
+    int *online;
+    char *online_names;
     int n_users_online;             
+    unsigned long online_version;
+    online_list_t *online_list;
+    online_list_t *free_lists;
     int history_size;               
     int max_connections;            
 }users_db_t;
 
 /**
  * @function add_user_online
- * @brief Aggiunge un utente all' array degli utenti connessi in mutua escusione
+ * @brief Aggiunge un utente a quelli connessi in tempo costante
  *
  * @param users_db          puntatore alla struttura dati del server
- * @param name              nome utente da inserire nell' array
+ * @param name              nome utente connesso
+ * @param fd                file descriptor dell'utente
  *
  * @returns 0 successo, -1 fallimento
  */
@@ -70,20 +94,20 @@ int add_user_online(users_db_t *users_db, char * name, int fd);
 
 /**
  * @function delete_user_online
- * @brief Elimina un utente dall' array degli utenti connessi in mutua escusione
+ * @brief Elimina un utente da quelli connessi in tempo costante
  *
  * @param users_db          puntatore alla struttura dati del server
- * @param name              nome utente da eliminare dall' array
+ * @param fd                file descriptor dell'utente
  *
  * @returns 0 successo, -1 fallimento
  */
-int delete_user_online(users_db_t *users_db, char * name);
+int delete_user_online(users_db_t *users_db, int fd);
 
 /**
  * @function users_db_create
  * @brief Inizializza le strutture dati del server
  *
- * @param nbuckets          dimensione tabella hash utenti registrati
+ * @param nbuckets          posizioni iniziali della tabella degli utenti registrati
  * @param maxconnections    numero massimo di connessioni gestite dal server
  * @param history_size      numero massimo di messaggi che il server 'ricorda' per ogni client
  *
@@ -124,16 +148,25 @@ int register_user(users_db_t *users_db, char *name);
 int unregister_user(users_db_t *users_db, char *name);
 
 /**
- * @function get_users_online
- * @brief Lista utenti online
+ * @function acquire_users_online
+ * @brief Lista degli utenti online, senza copiarla e senza mutua esclusione
+ *        se la presenza non e' cambiata dall'ultima costruzione. Va
+ *        restituita con release_users_online
  *
  * @param users_db       puntatore alla struttura dati del server 
- * @param list_online    puntatore alla lista dove andare a scrivere
- *                       i nomi degli utenti online  
  *
- * @returns >= 0 numero utenti online, -1 fallimento
+ * @returns lista degli utenti online, NULL fallimento
  */
-int get_users_online(users_db_t *users_db, char **list_online);
+online_list_t *acquire_users_online(users_db_t *users_db);
+
+/**
+ * @function release_users_online
+ * @brief Restituisce una lista ottenuta con acquire_users_online
+ *
+ * @param users_db       puntatore alla struttura dati del server 
+ * @param list           lista da restituire
+ */
+void release_users_online(users_db_t *users_db, online_list_t *list);
 
 /**
  * @function connect_user
@@ -171,14 +204,16 @@ int disconnect_user_fd(users_db_t *users_db, int fd);
 
 /**
  * @function get_user
- * @brief Restituisce la struttura dell' utente name
+ * @brief Copia la struttura dell' utente name: gli utenti stanno nella
+ *        tabella e cambiano posto quando questa cresce
  *
  * @param users_db      puntatore alla struttura dati del server
  * @param name          nome utente di cui si vuole recuperare la struttura
+ * @param user          dove copiare la struttura dell' utente
  *
- * @returns puntatore alla struttura dati dell' utente
+ * @returns 0 successo, -1 utente non registrato o fallimento
  */
-user_t * get_user(users_db_t *users_db, char* name);      
+int get_user(users_db_t *users_db, char* name, user_t *user);
 
 /**
  * @function history_sender
@@ -190,3 +225,5 @@ user_t * get_user(users_db_t *users_db, char* name);
  * @returns puntatore alla history
  */
 history_t * history_sender(users_db_t *users_db, char *name);
+
+#endif /* USER_H_ */
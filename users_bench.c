@@ -0,0 +1,187 @@
+/**
+ * @file  users_bench.c
+ * @brief Microbenchmark della tabella degli utenti registrati: confronta la
+ *        tabella ad indirizzamento aperto di usertab.c, usata attraverso
+ *        users_db (register_user, get_user, unregister_user), con la
+ *        precedente icl_hash a liste con un elemento e un utente allocati
+ *        per ogni registrazione (riportata qui sotto come prima in user.c),
+ *        con 10000, 50000 e 100000 utenti
+ * @author Federico Germinario 545081
+ *
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ *
+ *  Uso: ./users_bench [thread per le ricerche concorrenti]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "icl_hash.h"
+#include "user.h"
+
+#define NBUCKETS   1024    // Dimensione iniziale di entrambe le tabelle (come chatty.c)
+#define HISTORY    8       // Messaggi per history
+#define LOOKUPS    4       // Ricerche per utente registrato
+#define NTHREADS   4
+
+/* ---------- tabella precedente: icl_hash + user_t allocati ----------- */
+
+static icl_hash_t *ht;
+
+static void oldFree(void *user){
+    destroyHistory(((user_t *)user)->history);
+    free(user);
+}
+
+static int oldRegister(char *name){
+    icl_ref_t ref;
+    if(icl_hash_lock_find(ht, name, &ref) != NULL){
+        icl_hash_unlock_ref(ht, &ref);
+        return -1;
+    }
+    user_t *user = malloc(sizeof(user_t));
+    strncpy(user->name, name, MAX_NAME_LENGTH + 1);
+    user->history = createHistory(HISTORY);
+    user->fd = -1;
+    int ret = icl_hash_insert_ref(ht, &ref, user->name, user);
+    if(ret != 0) oldFree(user);
+    icl_hash_unlock_ref(ht, &ref);
+    return ret;
+}
+
+static int oldGet(char *name, user_t *out){
+    icl_ref_t ref;
+    user_t *user = icl_hash_lock_find(ht, name, &ref);
+    if(user != NULL) *out = *user;
+    icl_hash_unlock_ref(ht, &ref);
+    return user != NULL ? 0 : -1;
+}
+
+static int oldUnregister(char *name){
+    icl_ref_t ref;
+    if(icl_hash_lock_find(ht, name, &ref) == NULL){
+        icl_hash_unlock_ref(ht, &ref);
+        return -1;
+    }
+    int ret = icl_hash_delete_ref(ht, &ref, name, NULL, oldFree);
+    icl_hash_unlock_ref(ht, &ref);
+    return ret;
+}
+
+/* --------------------------- benchmark ------------------------------- */
+
+static int use_tab;                  // 0 icl_hash, 1 usertab
+static users_db_t *db;
+static char (*names)[MAX_NAME_LENGTH + 1];
+static int *order;                   // Ordine casuale delle ricerche
+static int nusers;
+static int nthreads = NTHREADS;
+static int errors;
+
+static double now(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void *lookups(void *arg){
+    long id = (long)arg, n = (long)nusers * LOOKUPS;
+    user_t user;
+    for(long i = id; i < n; i += nthreads){
+        char *name = names[order[i % nusers]];
+        int r = use_tab ? get_user(db, name, &user) : oldGet(name, &user);
+        if(r != 0) __atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/**
+ * @function run
+ * @brief Registra nusers utenti, li cerca in ordine casuale con uno e con
+ *        nthreads thread e li deregistra
+ *
+ * @param ns    dove scrivere i ns per operazione delle quattro fasi
+ */
+static void run(double ns[4]){
+    double t0, n = nusers;
+    pthread_t th[nthreads];
+
+    if(use_tab) db = users_db_create(NBUCKETS, 1, HISTORY);
+    else ht = icl_hash_create(NBUCKETS, NULL, NULL);
+
+    t0 = now();
+    for(int i = 0; i < nusers; i++){
+        if((use_tab ? register_user(db, names[i]) : oldRegister(names[i])) != 0) errors++;
+    }
+    ns[0] = (now() - t0) * 1e9 / n;
+
+    int saved = nthreads;
+    nthreads = 1;
+    t0 = now();
+    lookups((void *)0);
+    ns[1] = (now() - t0) * 1e9 / (n * LOOKUPS);
+    nthreads = saved;
+
+    t0 = now();
+    for(long i = 0; i < nthreads; i++) pthread_create(&th[i], NULL, lookups, (void *)i);
+    for(int i = 0; i < nthreads; i++) pthread_join(th[i], NULL);
+    ns[2] = (now() - t0) * 1e9 / (n * LOOKUPS);
+
+    t0 = now();
+    for(int i = 0; i < nusers; i++){
+        if((use_tab ? unregister_user(db, names[order[i]]) : oldUnregister(names[order[i]])) != 0) errors++;
+    }
+    ns[3] = (now() - t0) * 1e9 / n;
+
+    if(use_tab){
+        users_db_destroy(db);
+        free(db);
+    }else{
+        icl_hash_destroy(ht, NULL, oldFree);
+    }
+}
+
+int main(int argc, char *argv[]){
+    if(argc > 1) nthreads = (int)strtol(argv[1], NULL, 10);
+    if(nthreads < 1) nthreads = 1;
+    int sizes[] = { 10000, 50000, 100000 };
+    const char *phase[] = { "register", "get", "get x%d", "unregister" };
+
+    printf("%-8s %-12s %14s %14s\n", "utenti", "operazione", "icl_hash ns/op", "usertab ns/op");
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        nusers = sizes[s];
+        names = calloc(nusers, sizeof(*names));
+        order = malloc(nusers * sizeof(int));
+        if(names == NULL || order == NULL) return EXIT_FAILURE;
+
+        unsigned int seed = 1;
+        for(int i = 0; i < nusers; i++){
+            snprintf(names[i], MAX_NAME_LENGTH + 1, "user%d", i);
+            order[i] = i;
+        }
+        for(int i = nusers - 1; i > 0; i--){
+            int j = rand_r(&seed) % (i + 1), tmp = order[i];
+            order[i] = order[j];
+            order[j] = tmp;
+        }
+
+        double old[4], tab[4];
+        use_tab = 0;
+        run(old);
+        use_tab = 1;
+        run(tab);
+        for(int p = 0; p < 4; p++){
+            char label[16];
+            snprintf(label, sizeof(label), phase[p], nthreads);
+            printf("%-8d %-12s %14.1f %14.1f\n", nusers, label, old[p], tab[p]);
+        }
+        free(names);
+        free(order);
+    }
+    if(errors) fprintf(stderr, "ERRORE: %d operazioni fallite\n", errors);
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
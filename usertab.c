@@ -0,0 +1,348 @@
+/**
+ * @file  usertab.c
+ * @author Federico Germinario 545081
+ *
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "usertab.h"
+
+#define HASH_K1  0x9E3779B97F4A7C15ULL
+#define HASH_K2  0xC2B2AE3D27D4EB4FULL
+
+#define LSB      0x0101010101010101ULL   // Bit basso di ogni byte di una parola
+#define MSB      0x8080808080808080ULL   // Bit alto di ogni byte di una parola
+
+#define SECTION_BITS  __builtin_ctz(UT_SECTIONS)
+
+static inline uint64_t rotl64(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * @function hashName
+ * @brief Hash dei primi len byte di name letti 8 alla volta (come hash_words
+ *        di icl_hash.c, ma a 64 bit: i bit bassi scelgono sezione e gruppo,
+ *        i 7 alti sono il byte di controllo)
+ */
+static uint64_t hashName(const char *name, size_t len){
+    const unsigned char *p = (const unsigned char *)name;
+    uint64_t h = len * HASH_K1, w;
+    for(; len >= sizeof(w); len -= sizeof(w), p += sizeof(w)){
+        memcpy(&w, p, sizeof(w));
+        h = rotl64(h ^ (w * HASH_K2), 31) * HASH_K1;
+    }
+    if(len > 0){
+        w = 0;
+        memcpy(&w, p, len);
+        h = rotl64(h ^ (w * HASH_K2), 31) * HASH_K1;
+    }
+    h ^= h >> 33;
+    h *= HASH_K2;
+    h ^= h >> 29;
+    return h;
+}
+
+static inline uint8_t ctrlOf(uint64_t h){
+    return (uint8_t)(h >> 57);
+}
+
+static inline uint64_t loadGroup(const uint8_t *ctrl){
+    uint64_t w;
+    memcpy(&w, ctrl, sizeof(w));
+    return w;
+}
+
+// Byte del gruppo uguali a b (qualche falso positivo oltre un byte uguale)
+static inline uint64_t matchByte(uint64_t w, uint8_t b){
+    uint64_t x = w ^ (LSB * b);
+    return (x - LSB) & ~x & MSB;
+}
+
+// Byte UT_EMPTY: bit alto a 1 e bit 1 a 0 (UT_DELETED ha il bit 1 a 1)
+static inline uint64_t matchEmpty(uint64_t w){
+    return w & ~(w << 6) & MSB;
+}
+
+// Byte UT_EMPTY o UT_DELETED
+static inline uint64_t matchFree(uint64_t w){
+    return w & MSB;
+}
+
+/**
+ * @function nextMatch
+ * @brief Toglie da m il primo byte segnalato
+ *
+ * @return indice del byte nel gruppo
+ */
+static inline int nextMatch(uint64_t *m){
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    int bit = 63 - __builtin_clzll(*m);
+    *m &= ~(1ULL << bit);
+    return 7 - bit / 8;
+#else
+    int bit = __builtin_ctzll(*m);
+    *m &= *m - 1;
+    return bit / 8;
+#endif
+}
+
+/**
+ * @function findPos
+ * @brief Cerca name scorrendo i gruppi della sezione a passi crescenti
+ *        (1, 2, 3, ... : con un numero di gruppi potenza di 2 li visita tutti)
+ *        fino al primo gruppo con una posizione mai usata (m.e. della sezione presa)
+ *
+ * @return posizione di name, -1 se non c'e'
+ */
+static int findPos(ut_section_t *s, uint64_t h, const char *name){
+    int mask = s->cap / UT_GROUP - 1;
+    int g = (int)(h >> SECTION_BITS) & mask;
+    uint8_t c = ctrlOf(h);
+    for(int i = 1; i <= mask + 1; i++){
+        uint64_t w = loadGroup(s->ctrl + g * UT_GROUP);
+        uint64_t m = matchByte(w, c);
+        while(m){
+            int pos = g * UT_GROUP + nextMatch(&m);
+            if(s->ctrl[pos] == c && strncmp(s->slots[pos].name, name, MAX_NAME_LENGTH) == 0) return pos;
+        }
+        if(matchEmpty(w)) return -1;
+        g = (g + i) & mask;
+    }
+    return -1;
+}
+
+/**
+ * @function freePos
+ * @brief Prima posizione libera (mai usata o liberata) nella sequenza di
+ *        gruppi di h (m.e. della sezione presa, almeno una posizione libera)
+ */
+static int freePos(ut_section_t *s, uint64_t h){
+    int mask = s->cap / UT_GROUP - 1;
+    int g = (int)(h >> SECTION_BITS) & mask;
+    for(int i = 1; ; i++){
+        uint64_t m = matchFree(loadGroup(s->ctrl + g * UT_GROUP));
+        if(m) return g * UT_GROUP + nextMatch(&m);
+        g = (g + i) & mask;
+    }
+}
+
+/**
+ * @function resize
+ * @brief Ricostruisce la sezione con cap posizioni, eliminando le posizioni
+ *        liberate (m.e. della sezione presa)
+ *
+ * @return 0 successo, -1 fallimento (sezione invariata)
+ */
+static int resize(ut_section_t *s, int cap){
+    uint8_t *ctrl = malloc(cap);
+    user_t *slots = malloc((size_t)cap * sizeof(user_t));
+    if(!ctrl || !slots){
+        free(ctrl);
+        free(slots);
+        return -1;
+    }
+    memset(ctrl, UT_EMPTY, cap);
+
+    uint8_t *oldctrl = s->ctrl;
+    user_t *oldslots = s->slots;
+    int oldcap = s->cap;
+    s->ctrl = ctrl;
+    s->slots = slots;
+    s->cap = cap;
+    s->deleted = 0;
+    for(int i = 0; i < oldcap; i++){
+        if(oldctrl[i] & UT_EMPTY) continue;
+        uint64_t h = hashName(oldslots[i].name, strlen(oldslots[i].name));
+        int pos = freePos(s, h);
+        ctrl[pos] = ctrlOf(h);
+        slots[pos] = oldslots[i];
+    }
+    free(oldctrl);
+    free(oldslots);
+    return 0;
+}
+
+/**
+ * @function utCreate
+ * @brief Crea una tabella vuota
+ *
+ * @param nslots    posizioni iniziali complessive (arrotondate per sezione)
+ *
+ * @return puntatore alla nuova tabella, NULL fallimento
+ */
+usertab_t *utCreate(int nslots){
+    usertab_t *t = calloc(1, sizeof(usertab_t));
+    if(!t) return NULL;
+    t->sections = calloc(UT_SECTIONS, sizeof(ut_section_t));
+    if(!t->sections){
+        free(t);
+        return NULL;
+    }
+
+    // Posizioni per sezione: potenza di 2, almeno un gruppo
+    int cap = UT_GROUP;
+    while(cap < nslots / UT_SECTIONS && cap <= INT_MAX / 2) cap <<= 1;
+
+    for(int i = 0; i < UT_SECTIONS; i++){
+        ut_section_t *s = &(t->sections[i]);
+        pthread_mutex_init(&(s->mtx), NULL);
+        s->ctrl = malloc(cap);
+        s->slots = malloc((size_t)cap * sizeof(user_t));
+        if(!s->ctrl || !s->slots){
+            free(s->ctrl);
+            free(s->slots);
+            s->ctrl = NULL;
+            s->slots = NULL;
+            s->cap = 0;
+            utDestroy(t, NULL);
+            return NULL;
+        }
+        memset(s->ctrl, UT_EMPTY, cap);
+        s->cap = cap;
+    }
+    return t;
+}
+
+/**
+ * @function utDestroy
+ * @brief Distrugge la tabella
+ *
+ * @param t           tabella
+ * @param free_user   funzione che libera le risorse di un utente, NULL nessuna
+ */
+void utDestroy(usertab_t *t, void (*free_user)(user_t *)){
+    if(!t) return;
+    for(int i = 0; i < UT_SECTIONS; i++){
+        ut_section_t *s = &(t->sections[i]);
+        for(int j = 0; free_user && j < s->cap; j++){
+            if(!(s->ctrl[j] & UT_EMPTY)) free_user(&(s->slots[j]));
+        }
+        free(s->ctrl);
+        free(s->slots);
+        pthread_mutex_destroy(&(s->mtx));
+    }
+    free(t->sections);
+    free(t);
+}
+
+/**
+ * @function utLockFind
+ * @brief Prende la m.e. della sezione di name e cerca name. L'utente
+ *        restituito resta valido solo fino a utUnlock o ad un utInsert
+ *
+ * @param t       tabella
+ * @param name    nome da cercare
+ * @param ref     dove memorizzare hash, sezione e posizione di name
+ *
+ * @return utente, NULL se name non e' registrato o in caso di errore
+ *         (ref->sec NULL, nessuna m.e. presa)
+ */
+user_t *utLockFind(usertab_t *t, const char *name, ut_ref_t *ref){
+    if(!ref) return NULL;
+    ref->sec = NULL;
+    ref->pos = -1;
+    if(!t || !name) return NULL;
+
+    ref->hash = hashName(name, strnlen(name, MAX_NAME_LENGTH));
+    ref->sec = &(t->sections[ref->hash & (UT_SECTIONS - 1)]);
+    pthread_mutex_lock(&(ref->sec->mtx));
+    ref->pos = findPos(ref->sec, ref->hash, name);
+    return ref->pos >= 0 ? &(ref->sec->slots[ref->pos]) : NULL;
+}
+
+/**
+ * @function utInsert
+ * @brief Inserisce name, non trovato da utLockFind, nella sezione presa.
+ *        Oltre 7/8 di posizioni usate la sezione raddoppia, o si ricostruisce
+ *        della stessa dimensione se e' piena soprattutto di posizioni liberate
+ *
+ * @param t       tabella
+ * @param ref     sezione presa con utLockFind su name
+ * @param name    nome da inserire
+ *
+ * @return nuovo utente (fd -1, history NULL), NULL fallimento
+ */
+user_t *utInsert(usertab_t *t, ut_ref_t *ref, const char *name){
+    if(!t || !ref || !ref->sec || !name || ref->pos >= 0) return NULL;
+    ut_section_t *s = ref->sec;
+
+    int pos = freePos(s, ref->hash);
+    if(s->ctrl[pos] == UT_EMPTY && (long)(s->used + s->deleted + 1) * 8 > (long)s->cap * 7){
+        int cap = s->cap;
+        if((s->used + 1) * 2 > cap){
+            if(cap > INT_MAX / 2) return NULL;
+            cap *= 2;
+        }
+        if(resize(s, cap) == -1) return NULL;
+        pos = freePos(s, ref->hash);
+    }
+    if(s->ctrl[pos] == UT_DELETED) s->deleted--;
+    s->ctrl[pos] = ctrlOf(ref->hash);
+    s->used++;
+    __atomic_add_fetch(&t->nentries, 1, __ATOMIC_RELAXED);
+
+    user_t *user = &(s->slots[pos]);
+    memset(user->name, 0, sizeof(user->name));
+    strncpy(user->name, name, MAX_NAME_LENGTH);
+    user->fd = -1;
+    user->history = NULL;
+    ref->pos = pos;
+    return user;
+}
+
+/**
+ * @function utDelete
+ * @brief Elimina l'utente trovato da utLockFind (la history non viene
+ *        liberata). La posizione torna mai usata se il suo gruppo ne ha gia'
+ *        una: nessuna ricerca e' passata oltre il gruppo
+ */
+void utDelete(usertab_t *t, ut_ref_t *ref){
+    if(!t || !ref || !ref->sec || ref->pos < 0) return;
+    ut_section_t *s = ref->sec;
+
+    int g = ref->pos & ~(UT_GROUP - 1);
+    if(matchEmpty(loadGroup(s->ctrl + g))){
+        s->ctrl[ref->pos] = UT_EMPTY;
+    }else{
+        s->ctrl[ref->pos] = UT_DELETED;
+        s->deleted++;
+    }
+    s->used--;
+    __atomic_sub_fetch(&t->nentries, 1, __ATOMIC_RELAXED);
+    ref->pos = -1;
+}
+
+/**
+ * @function utUnlock
+ * @brief Rilascia la sezione presa con utLockFind
+ */
+void utUnlock(usertab_t *t, ut_ref_t *ref){
+    if(!t || !ref || !ref->sec) return;
+    pthread_mutex_unlock(&(ref->sec->mtx));
+    ref->sec = NULL;
+}
+
+/**
+ * @function utLoad
+ * @brief Dimensione e riempimento della tabella, letti senza mutua esclusione
+ *
+ * @param t         tabella
+ * @param nslots    dove scrivere il numero di posizioni
+ *
+ * @return utenti per 100 posizioni (fattore di carico in centesimi)
+ */
+unsigned long utLoad(usertab_t *t, unsigned long *nslots){
+    if(!t) return 0;
+    unsigned long n = 0;
+    for(int i = 0; i < UT_SECTIONS; i++) n += __atomic_load_n(&(t->sections[i].cap), __ATOMIC_RELAXED);
+    unsigned long e = __atomic_load_n(&t->nentries, __ATOMIC_RELAXED);
+    if(nslots) *nslots = n;
+    return n > 0 ? e * 100 / n : 0;
+}
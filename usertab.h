@@ -0,0 +1,186 @@
+/**
+ * @file  usertab.h
+ * @brief Tabella degli utenti registrati ad indirizzamento aperto: nome e
+ *        campi dell'utente stanno direttamente nelle posizioni della tabella,
+ *        affiancate da un byte di controllo ciascuna (alla Swiss table). Una
+ *        ricerca legge una parola di byte di controllo e, solo per i byte
+ *        uguali ai 7 bit dell'hash, la posizione dell'utente
+ * @author Federico Germinario 545081
+ *
+ *  Si dichiara che il contenuto di questo file e' in ogni sua parte opera
+ *  originale dell'autore
+ *
+ */
+#ifndef USERTAB_H_
+#define USERTAB_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "config.h"
+#include "history.h"
+
+#define UT_GROUP      8      // Byte di controllo letti insieme (una parola da 64 bit)
+#define UT_SECTIONS   64     // Sezioni (mutex): ciascuna e' una tabella che cresce da sola
+#define UT_EMPTY      0x80   // Byte di controllo di una posizione mai usata
+#define UT_DELETED    0xFE   // Byte di controllo di una posizione liberata (tombstone)
+
+/**
+ *  @struct user
+ *  @brief Struttura utente registrato, memorizzata nella tabella
+ *
+ *  @var name       nickname
+ *  @var fd         file descriptor del nickname
+ *  @var history    puntatore alla history del nickname
+ */
+typedef struct {
+    char name[MAX_NAME_LENGTH + 1];
+    int fd;
+    history_t *history;
+}user_t;
+
+/**
+ *  @struct ut_section
+ *  @brief Sezione della tabella: cap posizioni divise in gruppi da UT_GROUP,
+ *         ctrl[i] e' UT_EMPTY, UT_DELETED o i 7 bit alti dell'hash del nome
+ *         in slots[i]. Una sezione raddoppia sotto la sola propria mutex
+ *
+ *  @var mtx        mutua esclusione sulla sezione
+ *  @var ctrl       byte di controllo
+ *  @var slots      utenti
+ *  @var cap        numero di posizioni (potenza di 2, multiplo di UT_GROUP)
+ *  @var used       posizioni occupate
+ *  @var deleted    posizioni liberate e non ancora riusate
+ */
+typedef struct {
+    pthread_mutex_t mtx;
+    uint8_t *ctrl;
+    user_t *slots;
+    int cap;
+    int used;
+    int deleted;
+    char pad[128 - sizeof(pthread_mutex_t) - sizeof(uint8_t *) - sizeof(user_t *) - 3 * sizeof(int)];
+}ut_section_t;
+
+/**
+ *  @struct usertab
+ *  @brief Tabella degli utenti: la sezione di un nome sono i bit bassi del
+ *         suo hash, il gruppo da cui parte la ricerca i bit successivi
+ *
+ *  @var nentries   utenti registrati (letto senza mutua esclusione)
+ *  @var sections   UT_SECTIONS sezioni
+ */
+typedef struct {
+    int nentries;
+    ut_section_t *sections;
+}usertab_t;
+
+/**
+ *  @struct ut_ref
+ *  @brief Nome cercato con utLockFind: hash calcolato una volta sola,
+ *         sezione presa e posizione trovata
+ */
+typedef struct {
+    uint64_t hash;
+    ut_section_t *sec;
+    int pos;
+}ut_ref_t;
+
+/**
+ * @function utCreate
+ * @brief Crea una tabella vuota
+ *
+ * @param nslots    posizioni iniziali complessive (arrotondate per sezione)
+ *
+ * @return puntatore alla nuova tabella, NULL fallimento
+ */
+usertab_t *utCreate(int nslots);
+
+/**
+ * @function utDestroy
+ * @brief Distrugge la tabella
+ *
+ * @param t           tabella
+ * @param free_user   funzione che libera le risorse di un utente, NULL nessuna
+ */
+void utDestroy(usertab_t *t, void (*free_user)(user_t *));
+
+/**
+ * @function utLockFind
+ * @brief Prende la m.e. della sezione di name e cerca name. L'utente
+ *        restituito resta valido solo fino a utUnlock o ad un utInsert
+ *
+ * @param t       tabella
+ * @param name    nome da cercare
+ * @param ref     dove memorizzare hash, sezione e posizione di name
+ *
+ * @return utente, NULL se name non e' registrato
+ */
+user_t *utLockFind(usertab_t *t, const char *name, ut_ref_t *ref);
+
+/**
+ * @function utInsert
+ * @brief Inserisce name, non trovato da utLockFind, nella sezione presa.
+ *        La sezione puo' crescere: gli utenti ottenuti prima cambiano posto
+ *
+ * @param t       tabella
+ * @param ref     sezione presa con utLockFind su name
+ * @param name    nome da inserire
+ *
+ * @return nuovo utente (fd -1, history NULL), NULL fallimento
+ */
+user_t *utInsert(usertab_t *t, ut_ref_t *ref, const char *name);
+
+/**
+ * @function utDelete
+ * @brief Elimina l'utente trovato da utLockFind (la history non viene liberata)
+ */
+void utDelete(usertab_t *t, ut_ref_t *ref);
+
+/**
+ * @function utUnlock
+ * @brief Rilascia la sezione presa con utLockFind
+ */
+void utUnlock(usertab_t *t, ut_ref_t *ref);
+
+/**
+ * @function utLoad
+ * @brief Dimensione e riempimento della tabella, letti senza mutua esclusione
+ *
+ * @param t         tabella
+ * @param nslots    dove scrivere il numero di posizioni
+ *
+ * @return utenti per 100 posizioni (fattore di carico in centesimi)
+ */
+unsigned long utLoad(usertab_t *t, unsigned long *nslots);
+
+//Permette di scorrere la tabella (senza altri thread attivi)
+#define usertab_foreach(t, up, code)                                             \
+    for (int tmpsec=0; tmpsec<UT_SECTIONS; tmpsec++){                            \
+        ut_section_t *tmps = &((t)->sections[tmpsec]);                           \
+        for (int tmpi=0; tmpi<tmps->cap; tmpi++){                                \
+            if (tmps->ctrl[tmpi] & UT_EMPTY) continue;                           \
+            up = &(tmps->slots[tmpi]);                                           \
+            code                                                                 \
+        }                                                                        \
+    }
+
+//Permette di scorrere la tabella in mutua esclusione, una sezione alla volta:
+//end viene eseguito alla fine di ogni sezione, prima di rilasciarne la mutex
+#define usertab_foreach_mutex_end(t, up, code, end)                              \
+    for (int tmpsec=0; tmpsec<UT_SECTIONS; tmpsec++){                            \
+        ut_section_t *tmps = &((t)->sections[tmpsec]);                           \
+        pthread_mutex_lock(&(tmps->mtx));                                        \
+        for (int tmpi=0; tmpi<tmps->cap; tmpi++){                                \
+            if (tmps->ctrl[tmpi] & UT_EMPTY) continue;                           \
+            up = &(tmps->slots[tmpi]);                                           \
+            code                                                                 \
+        }                                                                        \
+        end                                                                      \
+        pthread_mutex_unlock(&(tmps->mtx));                                      \
+    }
+
+//Permette di scorrere la tabella in mutua esclusione, una sezione alla volta
+#define usertab_foreach_mutex(t, up, code)                                       \
+    usertab_foreach_mutex_end(t, up, code, ;)
+
+#endif /* USERTAB_H_ */